@@ -0,0 +1,52 @@
+# Writes the SPIR-V of the shaders into a C++ header as constexpr arrays, so the executable does not
+# read them at runtime. Run in script mode:
+#
+#   cmake -DSPIRV_DIR=<dir with NAME.spv> -DSHADER_NAMES=<NAME,NAME,...> -DOUTPUT=<header> -P EmbedShaders.cmake
+#
+# NAME is the shader's file name (e.g. grass.vert); ShaderModule::Create looks shaders up by it.
+
+string(REPLACE "," ";" SHADER_NAMES "${SHADER_NAMES}")
+
+set(ARRAYS "")
+set(ENTRIES "")
+foreach(NAME ${SHADER_NAMES})
+    file(READ "${SPIRV_DIR}/${NAME}.spv" HEX HEX)
+    string(LENGTH "${HEX}" HEX_LENGTH)
+    math(EXPR REMAINDER "${HEX_LENGTH} % 8")
+    if(HEX_LENGTH EQUAL 0 OR NOT REMAINDER EQUAL 0)
+        message(FATAL_ERROR "${SPIRV_DIR}/${NAME}.spv is not a whole number of SPIR-V words")
+    endif()
+
+    # SPIR-V is a stream of little endian 32-bit words
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])" "0x\\4\\3\\2\\1u, " WORDS "${HEX}")
+    # Eight words per line (CMake regexes have no {n} quantifier)
+    string(REPEAT "0x[0-9a-f]+u, " 8 LINE_PATTERN)
+    string(REGEX REPLACE "(${LINE_PATTERN})" "\\1\n        " WORDS "${WORDS}")
+    string(REPLACE " \n" "\n" WORDS "${WORDS}")
+    string(STRIP "${WORDS}" WORDS)
+
+    string(MAKE_C_IDENTIFIER "${NAME}" IDENTIFIER)
+    string(APPEND ARRAYS "    constexpr uint32_t ${IDENTIFIER}[] = {\n        ${WORDS}\n    };\n\n")
+    string(APPEND ENTRIES "        { \"${NAME}\", ${IDENTIFIER}, sizeof(${IDENTIFIER}) },\n")
+endforeach()
+
+set(CONTENT "#pragma once
+
+// Generated by cmake/EmbedShaders.cmake from the shaders in src/shaders. Do not edit.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace EmbeddedShaders {
+${ARRAYS}    struct Entry {
+        const char* name;
+        const uint32_t* code;
+        size_t size;
+    };
+
+    constexpr Entry entries[] = {
+${ENTRIES}    };
+}
+")
+
+file(WRITE "${OUTPUT}" "${CONTENT}")
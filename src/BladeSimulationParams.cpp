@@ -0,0 +1,121 @@
+#include "BladeSimulationParams.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    std::string trim(const std::string& s) {
+        size_t first = s.find_first_not_of(" \t\r");
+        if (first == std::string::npos) {
+            return "";
+        }
+        size_t last = s.find_last_not_of(" \t\r");
+        return s.substr(first, last - first + 1);
+    }
+
+    template <typename T>
+    T parseValue(const std::string& value, const std::string& where) {
+        std::istringstream stream(value);
+        T result;
+        if (!(stream >> result) || !(stream >> std::ws).eof()) {
+            throw std::runtime_error(where + ": invalid value '" + value + "'");
+        }
+        return result;
+    }
+
+    template <>
+    bool parseValue<bool>(const std::string& value, const std::string& where) {
+        if (value == "1" || value == "true" || value == "on") {
+            return true;
+        }
+        if (value == "0" || value == "false" || value == "off") {
+            return false;
+        }
+        throw std::runtime_error(where + ": invalid value '" + value + "'");
+    }
+}
+
+BladeSimulationParams BladeSimulationParams::Load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open simulation config " + path);
+    }
+
+    BladeSimulationParams params;
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); ++lineNumber) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+
+        std::string where = path + ":" + std::to_string(lineNumber);
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            throw std::runtime_error(where + ": expected key = value");
+        }
+        std::string key = trim(line.substr(0, equals));
+        std::string value = trim(line.substr(equals + 1));
+
+        if (key == "gravity_magnitude") {
+            params.gravityMagnitude = parseValue<float>(value, where);
+        }
+        else if (key == "wind_magnitude") {
+            params.windMagnitude = parseValue<float>(value, where);
+        }
+        else if (key == "wind_freq") {
+            params.windFreq = parseValue<float>(value, where);
+        }
+        else if (key == "stiffness_coefficient") {
+            params.stiffnessCoefficient = parseValue<float>(value, where);
+        }
+        else if (key == "orient_cull") {
+            params.orientCull = parseValue<bool>(value, where);
+        }
+        else if (key == "view_frustum_cull") {
+            params.viewFrustumCull = parseValue<bool>(value, where);
+        }
+        else if (key == "dist_cull") {
+            params.distCull = parseValue<bool>(value, where);
+        }
+        else if (key == "orientation_threshold") {
+            params.orientationThreshold = parseValue<float>(value, where);
+        }
+        else if (key == "frustum_tolerance") {
+            params.frustumTolerance = parseValue<float>(value, where);
+        }
+        else if (key == "max_dist") {
+            params.maxDist = parseValue<float>(value, where);
+        }
+        else if (key == "lod_near_dist") {
+            params.lodNearDist = parseValue<float>(value, where);
+        }
+        else if (key == "lod_fade_band") {
+            params.lodFadeBand = parseValue<float>(value, where);
+        }
+        else if (key == "max_width_scale") {
+            params.maxWidthScale = parseValue<float>(value, where);
+        }
+        else if (key == "trample_bend") {
+            params.trampleBend = parseValue<float>(value, where);
+        }
+        else if (key == "workgroup_size") {
+            params.workgroupSize = parseValue<uint32_t>(value, where);
+        }
+        else {
+            throw std::runtime_error(where + ": unknown key '" + key + "'");
+        }
+    }
+
+    if (params.lodNearDist < 0.0f || params.lodNearDist >= params.maxDist) {
+        throw std::runtime_error(path + ": lod_near_dist must be in [0, max_dist)");
+    }
+    if (params.lodFadeBand <= 0.0f) {
+        throw std::runtime_error(path + ": lod_fade_band must be positive");
+    }
+    if (params.maxWidthScale < 1.0f) {
+        throw std::runtime_error(path + ": max_width_scale must be at least 1");
+    }
+    return params;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Tunables of shaders/compute.comp, passed to it as specialization constants (see
+// Renderer::CreateComputePipeline) and used as-is by the CPU reference in BladeSimulator.
+// The defaults match the default values of the shader's constants.
+struct BladeSimulationParams {
+    float gravityMagnitude = 4.8f;
+    float windMagnitude = 1.0f;
+    float windFreq = 0.4f;
+    float stiffnessCoefficient = 0.7f;
+
+    bool orientCull = true;
+    bool viewFrustumCull = true;
+    bool distCull = true;
+
+    float orientationThreshold = 0.6f;
+    float frustumTolerance = -0.2f;
+    float maxDist = 40.0f;
+
+    // Distance LOD (with distCull): beyond lodNearDist blades thin out stochastically until none are
+    // left at maxDist, the survivors widened by up to maxWidthScale to keep the coverage. lodFadeBand is
+    // the fraction of the thinning range over which a dropping blade narrows away instead of popping.
+    float lodNearDist = 10.0f;
+    float lodFadeBand = 0.1f;
+    float maxWidthScale = 3.0f;
+
+    // How far a fully trampled blade's rest position leans from up towards the ground
+    float trampleBend = 0.85f;
+
+    // Local size of the simulation. 0 lets the renderer pick one for the device; otherwise a power of
+    // two that divides CLUSTER_SIZE and fits the device's compute limits.
+    uint32_t workgroupSize = 0;
+
+    // Reads "key = value" lines (the snake_case names of the fields above, '#' starts a comment) over
+    // the defaults. Throws on a missing file, an unknown key or a malformed value.
+    static BladeSimulationParams Load(const std::string& path);
+};
@@ -0,0 +1,501 @@
+#include "BladeSimulator.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <glm/packing.hpp>
+
+namespace {
+    // Blades are processed LANES at a time in structure-of-arrays form. Every operation below is a
+    // fixed-length loop over plain floats, which the compiler turns into SSE/AVX/NEON code without
+    // tying the source to one instruction set.
+    constexpr int LANES = 8;
+    static_assert(CLUSTER_SIZE % LANES == 0, "A batch must not straddle two clusters");
+
+    struct FloatL {
+        alignas(32) float v[LANES];
+    };
+
+    struct MaskL {
+        alignas(32) int v[LANES];
+    };
+
+    struct Vec3L {
+        FloatL x, y, z;
+    };
+
+    #define LANE_LOOP for (int l = 0; l < LANES; ++l)
+
+    inline FloatL splat(float s) { FloatL r; LANE_LOOP r.v[l] = s; return r; }
+
+    inline FloatL operator+(const FloatL& a, const FloatL& b) { FloatL r; LANE_LOOP r.v[l] = a.v[l] + b.v[l]; return r; }
+    inline FloatL operator-(const FloatL& a, const FloatL& b) { FloatL r; LANE_LOOP r.v[l] = a.v[l] - b.v[l]; return r; }
+    inline FloatL operator*(const FloatL& a, const FloatL& b) { FloatL r; LANE_LOOP r.v[l] = a.v[l] * b.v[l]; return r; }
+    inline FloatL operator/(const FloatL& a, const FloatL& b) { FloatL r; LANE_LOOP r.v[l] = a.v[l] / b.v[l]; return r; }
+    inline FloatL operator*(const FloatL& a, float s) { FloatL r; LANE_LOOP r.v[l] = a.v[l] * s; return r; }
+    inline FloatL operator*(float s, const FloatL& a) { return a * s; }
+
+    inline FloatL lmin(const FloatL& a, const FloatL& b) { FloatL r; LANE_LOOP r.v[l] = a.v[l] < b.v[l] ? a.v[l] : b.v[l]; return r; }
+    inline FloatL lmax(const FloatL& a, const FloatL& b) { FloatL r; LANE_LOOP r.v[l] = a.v[l] > b.v[l] ? a.v[l] : b.v[l]; return r; }
+    inline FloatL labs(const FloatL& a) { FloatL r; LANE_LOOP r.v[l] = std::fabs(a.v[l]); return r; }
+    inline FloatL lsqrt(const FloatL& a) { FloatL r; LANE_LOOP r.v[l] = std::sqrt(a.v[l]); return r; }
+
+    // sin(x + phase) for phase in [0, pi/2], without a library call, so the lane loops calling it stay
+    // vectorized: x is reduced to [-pi, pi] with 2 pi split in two (the first part exact for the multiples
+    // that occur), shifted by the phase, folded onto [-pi/2, pi/2] and evaluated with the odd Taylor
+    // polynomial up to x^11 (error below 1e-7 there)
+    inline float sinLane(float x, float phase) {
+        float k = static_cast<float>(static_cast<int>(x * 0.15915494f + std::copysign(0.5f, x)));
+        x = (x - k * 6.28125f) - k * 1.9353072e-3f + phase;
+        // sin(x) = sin(pi - x) = sin(-pi - x), as min/max so there is no branch
+        float upper = 3.1415927f - x;
+        x = x < upper ? x : upper;
+        float lower = -3.1415927f - x;
+        x = x > lower ? x : lower;
+        float x2 = x * x;
+        return x * (1.0f + x2 * (-1.6666667e-1f + x2 * (8.3333338e-3f + x2 * (-1.9841270e-4f
+            + x2 * (2.7557319e-6f + x2 * -2.5052108e-8f)))));
+    }
+    inline FloatL lsin(const FloatL& a) { FloatL r; LANE_LOOP r.v[l] = sinLane(a.v[l], 0.0f); return r; }
+    inline FloatL lcos(const FloatL& a) { FloatL r; LANE_LOOP r.v[l] = sinLane(a.v[l], 1.5707964f); return r; }
+
+    inline MaskL operator<(const FloatL& a, const FloatL& b) { MaskL r; LANE_LOOP r.v[l] = a.v[l] < b.v[l] ? -1 : 0; return r; }
+    inline MaskL operator&(const MaskL& a, const MaskL& b) { MaskL r; LANE_LOOP r.v[l] = a.v[l] & b.v[l]; return r; }
+    inline MaskL operator|(const MaskL& a, const MaskL& b) { MaskL r; LANE_LOOP r.v[l] = a.v[l] | b.v[l]; return r; }
+    inline MaskL operator~(const MaskL& a) { MaskL r; LANE_LOOP r.v[l] = ~a.v[l]; return r; }
+
+    inline FloatL select(const MaskL& m, const FloatL& a, const FloatL& b) { FloatL r; LANE_LOOP r.v[l] = m.v[l] ? a.v[l] : b.v[l]; return r; }
+    inline Vec3L select(const MaskL& m, const Vec3L& a, const Vec3L& b) { return { select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z) }; }
+
+    inline Vec3L splat(const glm::vec3& v) { return { splat(v.x), splat(v.y), splat(v.z) }; }
+    inline Vec3L operator+(const Vec3L& a, const Vec3L& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    inline Vec3L operator-(const Vec3L& a, const Vec3L& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    inline Vec3L operator*(const Vec3L& a, const FloatL& s) { return { a.x * s, a.y * s, a.z * s }; }
+    inline Vec3L operator*(const FloatL& s, const Vec3L& a) { return a * s; }
+    inline Vec3L operator*(const Vec3L& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+    inline Vec3L operator*(float s, const Vec3L& a) { return a * s; }
+
+    inline FloatL dot(const Vec3L& a, const Vec3L& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline FloatL length(const Vec3L& a) { return lsqrt(dot(a, a)); }
+    inline FloatL distance(const Vec3L& a, const Vec3L& b) { return length(a - b); }
+    inline Vec3L normalize(const Vec3L& a) { return a * (splat(1.0f) / length(a)); }
+    inline Vec3L cross(const Vec3L& a, const Vec3L& b) {
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    }
+
+    // closestOnCollider() from compute.comp
+    inline Vec3L closestOnCollider(const Collider& collider, const Vec3L& p) {
+        glm::vec3 start(collider.start);
+        glm::vec3 segment = glm::vec3(collider.end) - start;
+        float lengthSq = glm::dot(segment, segment);
+        if (lengthSq <= 0.0f) {
+            return splat(start);
+        }
+        FloatL t = lmin(lmax(dot(p - splat(start), splat(segment)) / splat(lengthSq), splat(0.0f)), splat(1.0f));
+        return splat(start) + splat(segment) * t;
+    }
+
+    // isInFrustum() from compute.comp, with the view-projection rows the test needs
+    struct FrustumRows {
+        glm::vec4 x, y, w;
+    };
+
+    inline MaskL isInFrustum(const Vec3L& p, const FrustumRows& rows, float tolerance) {
+        auto row = [&](const glm::vec4& r) { return p.x * r.x + p.y * r.y + p.z * r.z + splat(r.w); };
+        FloatL clipX = row(rows.x);
+        FloatL clipY = row(rows.y);
+        FloatL wTol = row(rows.w) + splat(tolerance);
+
+        MaskL r;
+        LANE_LOOP {
+            bool inX = clipX.v[l] >= -wTol.v[l] && clipX.v[l] <= wTol.v[l];
+            bool inY = clipY.v[l] >= -wTol.v[l] && clipY.v[l] <= wTol.v[l];
+            r.v[l] = (inX && inY) ? -1 : 0;
+        }
+        return r;
+    }
+
+    // bladeRandom of shaders/compute.comp
+    inline float bladeRandom(uint32_t id) {
+        id ^= id >> 16;
+        id *= 0x7feb352du;
+        id ^= id >> 15;
+        id *= 0x846ca68bu;
+        id ^= id >> 16;
+        return static_cast<float>(id >> 8) / 16777216.0f;
+    }
+
+    // lodWidthScale of shaders/compute.comp: the blade's width scale, 0 if distance LOD culls it
+    inline float lodWidthScale(const BladeSimulationParams& p, uint32_t id, float viewDist) {
+        if (!p.distCull || viewDist <= p.lodNearDist) {
+            return 1.0f;
+        }
+        float density = glm::clamp((p.maxDist - viewDist) / (p.maxDist - p.lodNearDist), 0.0f, 1.0f);
+        float margin = density - bladeRandom(id);
+        if (margin <= 0.0f) {
+            return 0.0f;
+        }
+        return std::min(1.0f / density, p.maxWidthScale) * std::min(margin / p.lodFadeBand, 1.0f);
+    }
+
+    struct KernelConstants {
+        BladeSimulationParams params;
+        FrustumRows frustum;
+        glm::vec3 camPos;
+        float deltaTime;
+        float totalTime;
+        const std::vector<Collider>* colliders;
+        // The CPU trample field and its window, null while nothing has trampled the grass
+        const glm::vec4* trample;
+        glm::ivec2 trampleWindowMin;
+    };
+
+    // sampleTrample of compute.comp: bilinear with the sampler's repeat addressing over the toroidal storage.
+    // Flat grass outside the window.
+    glm::vec3 sampleTrample(const KernelConstants& k, float x, float z) {
+        const int resolution = static_cast<int>(TRAMPLE_RESOLUTION);
+        glm::vec2 texel = glm::vec2(x, z) / TRAMPLE_TEXEL_SIZE;
+        glm::vec2 windowMin(k.trampleWindowMin);
+        if (texel.x < windowMin.x || texel.y < windowMin.y
+            || texel.x >= windowMin.x + resolution || texel.y >= windowMin.y + resolution) {
+            return glm::vec3(0.0f);
+        }
+
+        glm::vec2 corner = glm::floor(texel - 0.5f);
+        glm::vec2 weight = texel - 0.5f - corner;
+        int x0 = static_cast<int>(corner.x);
+        int y0 = static_cast<int>(corner.y);
+        auto at = [&](int tx, int ty) {
+            return glm::vec3(k.trample[(ty & (resolution - 1)) * resolution + (tx & (resolution - 1))]);
+        };
+        return glm::mix(glm::mix(at(x0, y0), at(x0 + 1, y0), weight.x),
+            glm::mix(at(x0, y0 + 1), at(x0 + 1, y0 + 1), weight.x), weight.y);
+    }
+
+    // Point of the collider's segment, projected onto the ground plane, closest to p (trample.comp)
+    glm::vec2 closestOnFootprint(const Collider& collider, const glm::vec2& p) {
+        glm::vec2 start(collider.start.x, collider.start.z);
+        glm::vec2 segment = glm::vec2(collider.end.x, collider.end.z) - start;
+        float lengthSq = glm::dot(segment, segment);
+        float t = lengthSq > 0.0f ? glm::clamp(glm::dot(p - start, segment) / lengthSq, 0.0f, 1.0f) : 0.0f;
+        return start + t * segment;
+    }
+
+    // The rgba16f image stores every texel at half precision
+    glm::vec4 roundToHalf(const glm::vec4& v) {
+        return glm::vec4(glm::unpackHalf2x16(glm::packHalf2x16(glm::vec2(v.x, v.y))),
+            glm::unpackHalf2x16(glm::packHalf2x16(glm::vec2(v.z, v.w))));
+    }
+
+    // One batch of the compute.comp main() body. first is the index of lane 0 (gl_GlobalInvocationID.x),
+    // count the number of valid lanes. Visible blades are appended to out, their indices to outIds.
+    void simulateBatch(Blade* blades, size_t first, int count, const KernelConstants& k, std::vector<Blade>& out,
+        std::vector<uint32_t>& outIds) {
+        const BladeSimulationParams& p = k.params;
+
+        Vec3L base, mid, tip, up;
+        FloatL orientation, height, width, stiffness;
+        MaskL type1, type2;
+
+        // Load; padding lanes repeat the last valid blade and are dropped on store
+        LANE_LOOP {
+            const Blade& b = blades[first + std::min(l, count - 1)];
+            base.x.v[l] = b.v0.x; base.y.v[l] = b.v0.y; base.z.v[l] = b.v0.z; orientation.v[l] = b.v0.w;
+            mid.x.v[l] = b.v1.x;  mid.y.v[l] = b.v1.y;  mid.z.v[l] = b.v1.z;  height.v[l] = b.v1.w;
+            tip.x.v[l] = b.v2.x;  tip.y.v[l] = b.v2.y;  tip.z.v[l] = b.v2.z;  width.v[l] = b.v2.w;
+            up.x.v[l] = b.up.x;   up.y.v[l] = b.up.y;   up.z.v[l] = b.up.z;   stiffness.v[l] = b.up.w;
+            type1.v[l] = b.bladeType == 1 ? -1 : 0;
+            type2.v[l] = b.bladeType == 2 ? -1 : 0;
+        }
+
+        // Per-type customization
+        height = select(type1, height * 0.8f, select(type2, height * 1.3f, height));
+        width = select(type1, width * 1.3f, select(type2, width * 0.6f, width));
+        stiffness = select(type2, stiffness * 1.5f, stiffness);
+        up = select(type2, splat(glm::normalize(glm::vec3(0.0f, 1.0f, 0.2f))), up);
+
+        // Gravity
+        Vec3L gravity = splat(glm::vec3(0.0f, -1.0f, 0.0f) * p.gravityMagnitude);
+        Vec3L t1 = normalize(Vec3L{ splat(0.0f) - lcos(orientation), splat(0.0f), lsin(orientation) });
+        Vec3L front = normalize(cross(t1, up));
+        Vec3L frontGravity = front * (0.25f * p.gravityMagnitude);
+        Vec3L totalGravity = gravity + frontGravity;
+
+        // Hooke's law recovery, towards a rest position leaning the way the trample field pushed the blade
+        Vec3L restUp = up;
+        if (k.trample != nullptr) {
+            LANE_LOOP {
+                glm::vec3 trample = sampleTrample(k, base.x.v[l], base.z.v[l]);
+                if (trample.z > 0.001f) {
+                    glm::vec3 laneUp(up.x.v[l], up.y.v[l], up.z.v[l]);
+                    float leanLength = glm::length(glm::vec2(trample.x, trample.y));
+                    glm::vec3 lean = leanLength > 0.001f ? glm::vec3(trample.x, 0.0f, trample.y) / leanLength
+                        : glm::vec3(front.x.v[l], front.y.v[l], front.z.v[l]);
+                    glm::vec3 rest = glm::normalize(glm::mix(laneUp, lean, std::min(trample.z, 1.0f) * p.trampleBend));
+                    restUp.x.v[l] = rest.x;
+                    restUp.y.v[l] = rest.y;
+                    restUp.z.v[l] = rest.z;
+                }
+            }
+        }
+        Vec3L originalTip = base + height * restUp;
+        Vec3L recoveryForce = (originalTip - tip) * stiffness * p.stiffnessCoefficient;
+
+        // Wind
+        FloatL time = splat(k.totalTime);
+        Vec3L wind = Vec3L{ lsin(p.windFreq * base.x * time), splat(0.0f), lcos(p.windFreq * base.z * time) } * p.windMagnitude;
+        FloatL fd = splat(1.0f) - labs(dot(normalize(wind), normalize(tip - base)));
+        FloatL fr = dot(tip - base, up) / height;
+        Vec3L windForce = wind * fd * fr;
+
+        // Position update
+        Vec3L totalForce = (totalGravity + recoveryForce + windForce) * k.deltaTime;
+        tip = tip + totalForce;
+
+        // Collision. Every collider is tested; the GPU skips the ones its spatial hash shows cannot reach
+        // the blade, which leaves the same result.
+        Vec3L massCenter = 0.25f * base + 0.5f * mid + 0.25f * tip;
+        for (const Collider& collider : *k.colliders) {
+            FloatL radius = splat(collider.start.w);
+            Vec3L center = closestOnCollider(collider, tip);
+
+            Vec3L pushed = center + normalize(tip - center) * radius;
+            MaskL tipInside = distance(tip, center) < radius;
+            MaskL massInside = distance(massCenter, closestOnCollider(collider, massCenter)) < radius;
+            tip = select(tipInside, pushed, select(massInside, tip + (pushed - tip) * 4.0f, tip));
+        }
+
+        // Validation
+        tip = tip - up * lmin(dot(up, tip - base), splat(0.0f));
+
+        FloatL groundProjLen = length(tip - base - up * dot(tip - base, up));
+        FloatL projRatio = groundProjLen / height;
+        mid = base + height * up * lmax(splat(1.0f) - projRatio, 0.05f * lmax(projRatio, splat(1.0f)));
+
+        FloatL L0 = distance(base, tip);
+        FloatL L1 = distance(base, mid) + distance(mid, tip);
+        FloatL avgLength = (2.0f * L0 + L1) / splat(3.0f);
+        FloatL ratio = height / avgLength;
+        mid = base + ratio * (mid - base);
+        tip = mid + ratio * (tip - mid);
+
+        // Write back
+        for (int l = 0; l < count; ++l) {
+            Blade& b = blades[first + l];
+            b.v1.x = mid.x.v[l]; b.v1.y = mid.y.v[l]; b.v1.z = mid.z.v[l];
+            b.v2.x = tip.x.v[l]; b.v2.y = tip.y.v[l]; b.v2.z = tip.z.v[l];
+        }
+
+        // Culling
+        Vec3L toBlade = base - splat(k.camPos);
+        Vec3L viewDir = toBlade - up * dot(toBlade, up);
+
+        MaskL culled = {};
+        if (p.orientCull) {
+            culled = culled | (labs(dot(normalize(viewDir), t1)) < splat(p.orientationThreshold));
+        }
+
+        if (p.viewFrustumCull) {
+            Vec3L curveMid = 0.25f * base + 0.5f * mid + 0.25f * tip;
+            MaskL visible = isInFrustum(base, k.frustum, p.frustumTolerance)
+                | isInFrustum(tip, k.frustum, p.frustumTolerance)
+                | isInFrustum(curveMid, k.frustum, p.frustumTolerance);
+            culled = culled | ~visible;
+        }
+
+        for (int l = 0; l < count; ++l) {
+            if (culled.v[l]) {
+                continue;
+            }
+
+            // Ground-plane distance, like the shader
+            float viewDist = std::hypot(base.x.v[l] - k.camPos.x, base.z.v[l] - k.camPos.z);
+            float widthScale = lodWidthScale(p, static_cast<uint32_t>(first + l), viewDist);
+            if (widthScale <= 0.0f) {
+                continue;
+            }
+
+            out.push_back(blades[first + l]);
+            out.back().v2.w *= widthScale;
+            outIds.push_back(static_cast<uint32_t>(first + l));
+        }
+    }
+
+    #undef LANE_LOOP
+
+    // Bounds of blades [begin, end), as Blades::PrepareTile computes those of a cluster
+    BladeBounds computeClusterBounds(const std::vector<Blade>& blades, size_t begin, size_t end) {
+        glm::vec3 lo(std::numeric_limits<float>::max());
+        glm::vec3 hi(-std::numeric_limits<float>::max());
+        for (size_t i = begin; i < end; ++i) {
+            lo = glm::min(lo, glm::vec3(blades[i].v0));
+            hi = glm::max(hi, glm::vec3(blades[i].v0));
+        }
+
+        BladeBounds bounds;
+        bounds.min = glm::vec4(lo - glm::vec3(MAX_BLADE_REACH), 0.0f);
+        bounds.max = glm::vec4(hi + glm::vec3(MAX_BLADE_REACH), 0.0f);
+        return bounds;
+    }
+
+    // Distance test of cluster_cull.comp: the box is further than maxDist from the camera on the ground plane
+    bool isBeyondMaxDist(const BladeBounds& bounds, const glm::vec3& camPos, float maxDist) {
+        glm::vec2 camXZ(camPos.x, camPos.z);
+        glm::vec2 away = glm::max(glm::max(glm::vec2(bounds.min.x, bounds.min.z) - camXZ, camXZ - glm::vec2(bounds.max.x, bounds.max.z)), glm::vec2(0.0f));
+        return glm::length(away) > maxDist;
+    }
+}
+
+BladeSimulator::BladeSimulator(ThreadPool* pool)
+    : pool(pool ? pool : &ThreadPool::Shared()),
+      trampleWindowMin(TrampleWindowMin(glm::vec3(0.0f))),
+      trampleUsed(false) {
+}
+
+glm::ivec2 BladeSimulator::TrampleWindowMin(const glm::vec3& position) {
+    // TrampleField::Follow
+    glm::ivec2 center(static_cast<int>(std::floor(position.x / TRAMPLE_TEXEL_SIZE)), static_cast<int>(std::floor(position.z / TRAMPLE_TEXEL_SIZE)));
+    return center - static_cast<int>(TRAMPLE_RESOLUTION / 2);
+}
+
+void BladeSimulator::AdvanceTrample(const glm::vec3& camPos, float deltaTime, const std::vector<Collider>& colliders) {
+    glm::ivec2 previousWindowMin = trampleWindowMin;
+    trampleWindowMin = TrampleWindowMin(camPos);
+
+    // Colliders without a radius cannot flatten anything, so the field stays flat (and is never
+    // allocated) until one shows up
+    std::vector<Collider> splatting;
+    for (const Collider& collider : colliders) {
+        if (collider.start.w > 0.0f) {
+            splatting.push_back(collider);
+        }
+    }
+    if (!trampleUsed && splatting.empty()) {
+        return;
+    }
+    if (!trampleUsed) {
+        trample.assign(TRAMPLE_RESOLUTION * TRAMPLE_RESOLUTION, glm::vec4(0.0f));
+        trampleUsed = true;
+    }
+
+    const int resolution = static_cast<int>(TRAMPLE_RESOLUTION);
+    float fade = std::exp(-deltaTime / TRAMPLE_RECOVERY_TIME);
+    glm::ivec2 windowMin = trampleWindowMin;
+
+    // trample.comp for every texel. The GPU only tests the colliders binned under the texel's cell, which
+    // are all the ones whose footprint can reach it, so testing every collider gives the same result.
+    pool->ParallelFor(TRAMPLE_RESOLUTION, [&](size_t beginRow, size_t endRow, size_t) {
+        for (int y = static_cast<int>(beginRow); y < static_cast<int>(endRow); ++y) {
+            for (int x = 0; x < resolution; ++x) {
+                glm::ivec2 texel(x, y);
+                glm::ivec2 world = windowMin + ((texel - windowMin) & (resolution - 1));
+                glm::vec4& stored = trample[y * resolution + x];
+
+                glm::vec4 value(0.0f);
+                if (world.x >= previousWindowMin.x && world.y >= previousWindowMin.y
+                    && world.x < previousWindowMin.x + resolution && world.y < previousWindowMin.y + resolution) {
+                    value = stored * fade;
+                }
+
+                glm::vec2 position = (glm::vec2(world) + 0.5f) * TRAMPLE_TEXEL_SIZE;
+                for (const Collider& collider : splatting) {
+                    float radius = collider.start.w;
+                    glm::vec2 away = position - closestOnFootprint(collider, position);
+                    float distanceToCollider = glm::length(away);
+                    float flatness = glm::clamp(2.0f * (radius - distanceToCollider) / std::max(radius, 1e-4f), 0.0f, 1.0f);
+
+                    if (flatness > value.z) {
+                        glm::vec2 direction = distanceToCollider > 1e-4f ? away / distanceToCollider : glm::vec2(0.0f);
+                        value = glm::vec4(direction * flatness, flatness, 0.0f);
+                    }
+                }
+
+                stored = roundToHalf(value);
+            }
+        }
+    });
+}
+
+BladeSimulationParams& BladeSimulator::GetParams() {
+    return params;
+}
+
+bool BladeSimulator::IsClusterSimulated(size_t cluster) const {
+    return cluster < clusterSimulated.size() && clusterSimulated[cluster] != 0;
+}
+
+BladeDrawIndirect BladeSimulator::Simulate(std::vector<Blade>& blades,
+    const CameraBufferObject& camera,
+    const Time& time,
+    const std::vector<Collider>& colliders,
+    std::vector<Blade>& culledBlades,
+    std::vector<uint32_t>* culledIds,
+    const BladeBounds* clusterBounds) {
+
+    KernelConstants k;
+    k.params = params;
+    k.deltaTime = time.deltaTime;
+    k.totalTime = time.totalTime;
+    k.colliders = &colliders;
+    k.camPos = glm::vec3(glm::inverse(camera.viewMatrix)[3]);
+
+    // The trample pass runs before the simulation, with the window centered on the camera
+    AdvanceTrample(k.camPos, time.deltaTime, colliders);
+    k.trample = trampleUsed ? trample.data() : nullptr;
+    k.trampleWindowMin = trampleWindowMin;
+
+    // Every blade of a cluster beyond maxDist would be culled by its distance anyway, so cluster_cull.comp
+    // drops the whole cluster before the simulation
+    size_t numClusters = (blades.size() + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    clusterSimulated.assign(numClusters, 1);
+    if (params.distCull) {
+        pool->ParallelFor(numClusters, [&](size_t beginCluster, size_t endCluster, size_t) {
+            for (size_t cluster = beginCluster; cluster < endCluster; ++cluster) {
+                size_t begin = cluster * CLUSTER_SIZE;
+                BladeBounds bounds = clusterBounds != nullptr ? clusterBounds[cluster]
+                    : computeClusterBounds(blades, begin, std::min(blades.size(), begin + CLUSTER_SIZE));
+                clusterSimulated[cluster] = isBeyondMaxDist(bounds, k.camPos, params.maxDist) ? 0 : 1;
+            }
+        });
+    }
+
+    // glm is column-major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+    glm::mat4 viewProj = camera.projectionMatrix * camera.viewMatrix;
+    auto row = [&](int i) { return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]); };
+    k.frustum = { row(0), row(1), row(3) };
+
+    // Whole batches per chunk so every lane group stays inside one thread's range
+    size_t numBatches = (blades.size() + LANES - 1) / LANES;
+    size_t numChunks = std::max<size_t>(1, std::min<size_t>(pool->GetThreadCount(), numBatches));
+    chunkOutputs.resize(numChunks);
+    chunkIds.resize(numChunks);
+    for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+        chunkOutputs[chunk].clear();
+        chunkIds[chunk].clear();
+    }
+
+    pool->ParallelFor(numBatches, [&](size_t beginBatch, size_t endBatch, size_t chunk) {
+        for (size_t batch = beginBatch; batch < endBatch; ++batch) {
+            size_t first = batch * LANES;
+            if (!clusterSimulated[first / CLUSTER_SIZE]) {
+                continue;
+            }
+            int count = static_cast<int>(std::min<size_t>(LANES, blades.size() - first));
+            simulateBatch(blades.data(), first, count, k, chunkOutputs[chunk], chunkIds[chunk]);
+        }
+    }, numChunks);
+
+    culledBlades.clear();
+    if (culledIds != nullptr) {
+        culledIds->clear();
+    }
+    for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+        culledBlades.insert(culledBlades.end(), chunkOutputs[chunk].begin(), chunkOutputs[chunk].end());
+        if (culledIds != nullptr) {
+            culledIds->insert(culledIds->end(), chunkIds[chunk].begin(), chunkIds[chunk].end());
+        }
+    }
+
+    return MakeBladeDrawIndirect(static_cast<uint32_t>(culledBlades.size()));
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "BladeSimulationParams.h"
+#include "Blades.h"
+#include "Camera.h"
+#include "Colliders.h"
+#include "Scene.h"
+#include "TrampleField.h"
+
+class ThreadPool;
+
+// CPU reference of the blade simulation and culling kernel in shaders/compute.comp.
+// Used to validate the GPU output (--validate) and as a fallback where no GPU is available; --bench cpu-sim
+// times it. Blade i gets the random values of GPU blade id i, so pass the whole pool in pool order to match it.
+// Of the cluster pre-pass of shaders/cluster_cull.comp only the distance test is mirrored: blades of clusters
+// outside the view keep moving here while the GPU leaves them as they were. The trample field
+// (TrampleField) is mirrored by a CPU copy that every Simulate call advances like shaders/trample.comp, so
+// one simulator has to see every frame, like the GPU field.
+class BladeSimulator {
+public:
+    explicit BladeSimulator(ThreadPool* pool = nullptr);
+
+    BladeSimulationParams& GetParams();
+
+    // Advances every blade in place (sb_InputBlades) and writes the visible ones to culledBlades
+    // (sb_CulledBlades). Visible blades are emitted in blade order, unlike the GPU's atomicAdd order.
+    // If culledIds is given, it receives the index in blades of every visible blade, in the same order.
+    // Returns the indirect draw arguments the kernel leaves in sb_VertexCount.
+    // With distCull, clusters of CLUSTER_SIZE blades further than maxDist are skipped like in
+    // cluster_cull.comp, their blades left as they were. clusterBounds, one per cluster like the cluster
+    // part of Blades' bounds buffer, are computed from the blade bases if not given.
+    BladeDrawIndirect Simulate(std::vector<Blade>& blades,
+        const CameraBufferObject& camera,
+        const Time& time,
+        const std::vector<Collider>& colliders,
+        std::vector<Blade>& culledBlades,
+        std::vector<uint32_t>* culledIds = nullptr,
+        const BladeBounds* clusterBounds = nullptr);
+
+    // Whether the last Simulate call simulated cluster c (blades [c * CLUSTER_SIZE, (c + 1) * CLUSTER_SIZE))
+    bool IsClusterSimulated(size_t cluster) const;
+
+private:
+    ThreadPool* pool;
+    BladeSimulationParams params;
+
+    // Window of the trample field centered on position, as TrampleField::Follow places it
+    static glm::ivec2 TrampleWindowMin(const glm::vec3& position);
+    // Moves the trample window to the camera, fades the field and splats the colliders (trample.comp)
+    void AdvanceTrample(const glm::vec3& camPos, float deltaTime, const std::vector<Collider>& colliders);
+
+    // CPU trample field, TRAMPLE_RESOLUTION^2 texels stored toroidally like the image. Allocated once a
+    // collider with a radius has been seen; until then the grass is untrampled.
+    std::vector<glm::vec4> trample;
+    glm::ivec2 trampleWindowMin;
+    bool trampleUsed;
+
+    // Per cluster of the last Simulate call, 0 if the distance test skipped it
+    std::vector<uint8_t> clusterSimulated;
+
+    // Per-chunk visible lists, kept between calls so steady-state frames do not allocate
+    std::vector<std::vector<Blade>> chunkOutputs;
+    std::vector<std::vector<uint32_t>> chunkIds;
+};
@@ -1,98 +1,485 @@
+#include <cstring>
+#include <limits>
 #include <vector>
+#include <glm/packing.hpp>
 #include "Blades.h"
 #include "BufferUtils.h"
+#include "Random.h"
+#include "ThreadPool.h"
+#include "UploadBatcher.h"
 
-float generateRandomFloat() {
-    return rand() / (float)RAND_MAX;
+#ifdef GRASS_COMPACT_BLADES
+namespace {
+    void packHalf4(const glm::vec4& v, uint32_t* out) {
+        out[0] = glm::packHalf2x16(glm::vec2(v.x, v.y));
+        out[1] = glm::packHalf2x16(glm::vec2(v.z, v.w));
+    }
+
+    // Lay the blades out as the base / middle / tip / attribs streams described in Blades.h
+    std::vector<uint32_t> packCompactBlades(const std::vector<Blade>& blades, const glm::vec3& origin) {
+        std::vector<uint32_t> streams(BLADES_BUFFER_SIZE / sizeof(uint32_t));
+        uint32_t* base = streams.data();
+        uint32_t* middle = base + 2 * NUM_BLADES;
+        uint32_t* tip = middle + 2 * NUM_BLADES;
+        uint32_t* attribs = tip + 2 * NUM_BLADES;
+
+        for (size_t i = 0; i < blades.size(); i++) {
+            const Blade& blade = blades[i];
+            packHalf4(glm::vec4(glm::vec3(blade.v0) - origin, blade.v0.w), base + 2 * i);
+            packHalf4(glm::vec4(glm::vec3(blade.v1) - origin, blade.v1.w), middle + 2 * i);
+            packHalf4(glm::vec4(glm::vec3(blade.v2) - origin, blade.v2.w), tip + 2 * i);
+
+            uint32_t stiffness = glm::packHalf2x16(glm::vec2(blade.up.w, 0.0f)) & 0xFFFFu;
+            attribs[i] = stiffness | (static_cast<uint32_t>(blade.bladeType & 0x3) << 16);
+        }
+
+        return streams;
+    }
 }
+#endif
 
 
-Blades::Blades(Device* device, VkCommandPool commandPool, float tileSize, float tileOffsetX, float tileOffsetZ) : Model(device, commandPool, {}, {}) {
-    std::vector<Blade> blades;
-    blades.reserve(NUM_BLADES);
+namespace {
+    // Bounds of blades [begin, end), grown by the furthest the simulation can move a blade from its base
+    BladeBounds computeBounds(const std::vector<Blade>& blades, size_t begin, size_t end) {
+        glm::vec3 lo(std::numeric_limits<float>::max());
+        glm::vec3 hi(-std::numeric_limits<float>::max());
+        for (size_t i = begin; i < end; i++) {
+            lo = glm::min(lo, glm::vec3(blades[i].v0));
+            hi = glm::max(hi, glm::vec3(blades[i].v0));
+        }
 
-    for (int i = 0; i < NUM_BLADES; i++) {
-        Blade currentBlade = Blade();
+        BladeBounds bounds;
+        bounds.min = glm::vec4(lo - glm::vec3(MAX_BLADE_REACH), 0.0f);
+        bounds.max = glm::vec4(hi + glm::vec3(MAX_BLADE_REACH), 0.0f);
+        return bounds;
+    }
+
+    // Counters of blade i are [i * BLADE_COUNTERS, (i + 1) * BLADE_COUNTERS)
+    constexpr uint64_t BLADE_COUNTERS = 8;
+    enum BladeCounter : uint64_t { COUNTER_X, COUNTER_Z, COUNTER_DIRECTION, COUNTER_HEIGHT, COUNTER_WIDTH, COUNTER_STIFFNESS };
+
+    // Blades per ParallelFor chunk; small enough to balance, large enough to amortize the noise lattice
+    constexpr size_t GENERATION_CHUNK = 2048;
+
+    uint64_t tileStream(float tileOffsetX, float tileOffsetZ) {
+        uint32_t x, z;
+        std::memcpy(&x, &tileOffsetX, sizeof(x));
+        std::memcpy(&z, &tileOffsetZ, sizeof(z));
+        return (static_cast<uint64_t>(x) << 32) | z;
+    }
+}
+
+std::vector<Blade> Blades::GenerateTile(uint64_t seed, float tileSize, float tileOffsetX, float tileOffsetZ, ThreadPool* pool) {
+    if (pool == nullptr) {
+        pool = &ThreadPool::Shared();
+    }
+
+    CounterRng rng(seed, tileStream(tileOffsetX, tileOffsetZ));
+    std::vector<Blade> blades(NUM_BLADES);
+
+    size_t numChunks = (NUM_BLADES + GENERATION_CHUNK - 1) / GENERATION_CHUNK;
+    pool->ParallelFor(NUM_BLADES, [&](size_t begin, size_t end, size_t) {
+        size_t count = end - begin;
+        std::vector<float> x(count), z(count), noiseX(count), noiseZ(count), y(count);
+
+        // Positions first, so the terrain height of the whole chunk is sampled in one batch
+        for (size_t i = 0; i < count; i++) {
+            uint64_t counter = (begin + i) * BLADE_COUNTERS;
+            x[i] = (rng.Uniform(counter + COUNTER_X) - 0.5f) * tileSize + tileOffsetX;
+            z[i] = (rng.Uniform(counter + COUNTER_Z) - 0.5f) * tileSize + tileOffsetZ;
+            noiseX[i] = x[i] * 0.5f;
+            noiseZ[i] = z[i] * 0.5f;
+        }
+        NoiseUtils::NoiseBatch(noiseX.data(), noiseZ.data(), y.data(), count); // scale coords & height
 
         glm::vec3 bladeUp(0.0f, 1.0f, 0.0f);
+        for (size_t i = 0; i < count; i++) {
+            uint64_t counter = (begin + i) * BLADE_COUNTERS;
+            Blade& currentBlade = blades[begin + i];
+
+            // Position and direction (v0)
+            float direction = rng.Uniform(counter + COUNTER_DIRECTION) * 2.f * 3.14159265f;
+            glm::vec3 bladePosition(x[i], y[i] * 2.0f, z[i]);
+            currentBlade.v0 = glm::vec4(bladePosition, direction);
+
+            // Bezier point and height (v1)
+            float height = MIN_HEIGHT + (rng.Uniform(counter + COUNTER_HEIGHT) * (MAX_HEIGHT - MIN_HEIGHT));
+            currentBlade.v1 = glm::vec4(bladePosition + bladeUp * height, height);
+
+            // Physical model guide and width (v2)
+            float width = MIN_WIDTH + (rng.Uniform(counter + COUNTER_WIDTH) * (MAX_WIDTH - MIN_WIDTH));
+            currentBlade.v2 = glm::vec4(bladePosition + bladeUp * height, width);
+
+            // Up vector and stiffness coefficient (up)
+            float stiffness = MIN_BEND + (rng.Uniform(counter + COUNTER_STIFFNESS) * (MAX_BEND - MIN_BEND));
+            currentBlade.up = glm::vec4(bladeUp, stiffness);
+        }
+    }, numChunks);
+
+    return blades;
+}
+
+Blades::Blades(Device* device, UploadBatcher* uploader, uint32_t tileCapacity, uint64_t seed)
+    : Model(device, uploader, {}, {}), tileCapacity(tileCapacity), seed(seed) {
+
+    const VkPhysicalDeviceFeatures& features = device->GetEnabledFeatures();
+    firstInstance = features.drawIndirectFirstInstance == VK_TRUE;
+#ifdef GRASS_COMPACT_BLADES
+    // Compact positions are relative to the tile origin, which is read per draw through firstInstance
+    multiDraw = features.multiDrawIndirect == VK_TRUE && firstInstance;
+#else
+    multiDraw = features.multiDrawIndirect == VK_TRUE;
+#endif
+
+#ifdef GRASS_CULL_INDICES
+    // The grass pipeline reads the simulated blades directly and the culled indices as its index buffer
+    VkBufferUsageFlags bladesUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    VkBufferUsageFlags culledUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+#else
+    VkBufferUsageFlags bladesUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VkBufferUsageFlags culledUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+#endif
+
+    // Blade data is filled in per tile by LoadTile. Buffers the compute queue writes and the graphics queue
+    // reads are shared between the two families, see BufferUtils::CreateSharedBuffer. Everything the
+    // simulation reads or writes is also a transfer source, for the readbacks of --validate.
+    for (uint32_t i = 0; i < BLADE_STATE_COPIES; i++) {
+        BufferUtils::CreateSharedBuffer(device, GetBladesBufferSize(), bladesUsage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, bladesBuffers[i], bladesBufferMemories[i]);
+    }
+
+    // The compute pass resets the counts every frame by copying the template over the live arguments
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::CreateSharedBuffer(device, GetCulledBladesBufferSize(), culledUsage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, culledBladesBuffers[i], culledBladesBufferMemories[i]);
+        BufferUtils::CreateSharedBuffer(device, GetNumBladesBufferSize(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, numBladesBuffers[i], numBladesBufferMemories[i]);
+    }
+    BufferUtils::CreateBuffer(device, GetNumBladesBufferSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, initialNumBladesBuffer, initialNumBladesBufferMemory);
+    initialNumBladesData = static_cast<BladeDrawIndirect*>(initialNumBladesBufferMemory.mapped);
+
+    // Tile origins, read by the compute pass and as a per-instance attribute of the grass pass
+    BufferUtils::CreateSharedBuffer(device, GetTileBufferSize(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, tileBuffer, tileBufferMemory);
+    tileData = static_cast<glm::vec4*>(tileBufferMemory.mapped);
+
+    // Tile and cluster bounds are only read by the cluster culling pass, which fills the cluster list
+    // that sizes the simulation dispatch
+    BufferUtils::CreateBuffer(device, GetBoundsBufferSize(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, boundsBuffer, boundsBufferMemory);
+    boundsData = static_cast<BladeBounds*>(boundsBufferMemory.mapped);
+    BufferUtils::CreateBuffer(device, GetClusterBufferSize(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, clusterBuffer, clusterBufferMemory);
+
+    // Each slot draws from its own range of culledBladesBuffer, so the draw arguments never change
+    for (uint32_t tile = 0; tile < tileCapacity; tile++) {
+        BladeDrawIndirect& indirectDraw = initialNumBladesData[tile];
+        indirectDraw = MakeBladeDrawIndirect(0);
+#ifdef GRASS_CULL_INDICES
+        indirectDraw.firstIndex = tile * NUM_BLADES;
+#else
+        indirectDraw.firstVertex = tile * NUM_BLADES;
+#endif
+        indirectDraw.firstInstance = firstInstance ? tile : 0;
+        tileData[tile] = glm::vec4(0.0f);
+    }
+    memset(boundsData, 0, GetBoundsBufferSize());
+
+    tileBounds.resize(tileCapacity);
+    activeTiles.assign(tileCapacity, true);
+    for (uint32_t tile = 0; tile < tileCapacity; tile++) {
+        SetTileActive(tile, false);
+    }
+
+    poolInfo = {};
+    poolInfo.bladeCapacity = tileCapacity * NUM_BLADES;
+
+    // Never changes, so one copy serves every frame in flight
+    BufferUtils::CreateBuffer(device, sizeof(BladePoolInfo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, poolInfoBuffer, poolInfoBufferMemory);
+    memcpy(poolInfoBufferMemory.mapped, &poolInfo, sizeof(BladePoolInfo));
+}
+
+void Blades::UploadBlades(UploadBatcher* uploader, const void* data, VkDeviceSize size, VkDeviceSize dstOffset) {
+    // Staged once for all copies
+    uploader->Upload(data, size, bladesBuffers.data(), BLADE_STATE_COPIES, dstOffset);
+}
+
+BladeTile Blades::PrepareTile(float tileSize, float tileOffsetX, float tileOffsetZ, ThreadPool* pool) const {
+    return PrepareTile(seed, tileSize, tileOffsetX, tileOffsetZ, pool);
+}
+
+BladeTile Blades::PrepareTile(uint64_t seed, float tileSize, float tileOffsetX, float tileOffsetZ, ThreadPool* pool) {
+    std::vector<Blade> blades = GenerateTile(seed, tileSize, tileOffsetX, tileOffsetZ, pool);
+
+    BladeTile bladeTile;
+    bladeTile.origin = glm::vec3(tileOffsetX, 0.0f, tileOffsetZ);
+
+    // The tile's bounds enclose those of its clusters
+    bladeTile.bounds.min = glm::vec4(std::numeric_limits<float>::max());
+    bladeTile.bounds.max = glm::vec4(-std::numeric_limits<float>::max());
+    bladeTile.clusterBounds.resize(CLUSTERS_PER_TILE);
+    for (uint32_t cluster = 0; cluster < CLUSTERS_PER_TILE; cluster++) {
+        BladeBounds bounds = computeBounds(blades, cluster * CLUSTER_SIZE, (cluster + 1) * CLUSTER_SIZE);
+        bladeTile.clusterBounds[cluster] = bounds;
+        bladeTile.bounds.min = glm::min(bladeTile.bounds.min, bounds.min);
+        bladeTile.bounds.max = glm::max(bladeTile.bounds.max, bounds.max);
+    }
+
+#ifdef GRASS_COMPACT_BLADES
+    // Positions are stored relative to the tile; both passes add the origin back from tileBuffer
+    bladeTile.data = packCompactBlades(blades, bladeTile.origin);
+#else
+    bladeTile.data = std::move(blades);
+#endif
+    return bladeTile;
+}
+
+void Blades::LoadTile(UploadBatcher* uploader, uint32_t tile, const BladeTileView& bladeTile) {
+    if (tile >= tileCapacity) {
+        throw std::runtime_error("Blade tile slot out of range");
+    }
+    if (activeTiles[tile]) {
+        throw std::runtime_error("Cannot load into an active blade tile slot");
+    }
+
+#ifdef GRASS_COMPACT_BLADES
+    // Each stream spans the whole pool, so the tile's part of every stream is uploaded separately
+    const uint32_t* streams = static_cast<const uint32_t*>(bladeTile.data);
+    const VkDeviceSize halfStream = 2 * sizeof(uint32_t) * NUM_BLADES;
+    for (uint32_t stream = 0; stream < 3; stream++) {
+        UploadBlades(uploader, streams + stream * 2 * NUM_BLADES, halfStream,
+            stream * tileCapacity * halfStream + tile * halfStream);
+    }
+    UploadBlades(uploader, streams + 6 * NUM_BLADES, sizeof(uint32_t) * NUM_BLADES,
+        3 * tileCapacity * halfStream + tile * sizeof(uint32_t) * NUM_BLADES);
+#else
+    UploadBlades(uploader, bladeTile.data, BLADES_BUFFER_SIZE, tile * BLADES_BUFFER_SIZE);
+#endif
+
+    // Nothing reads the origin or the cluster bounds of an inactive slot
+    tileData[tile] = glm::vec4(bladeTile.origin, 0.0f);
+    for (uint32_t cluster = 0; cluster < CLUSTERS_PER_TILE; cluster++) {
+        boundsData[tileCapacity + tile * CLUSTERS_PER_TILE + cluster] = bladeTile.clusterBounds[cluster];
+    }
+    tileBounds[tile] = bladeTile.bounds;
+}
+
+void Blades::SetTileActive(uint32_t tile, bool active) {
+    if (activeTiles[tile] == active) {
+        return;
+    }
+    activeTiles[tile] = active;
+
+    BladeBounds bounds = tileBounds[tile];
+    bounds.min.w = active ? 0.0f : 1.0f;
+    boundsData[tile] = bounds;
+}
+
+bool Blades::IsTileActive(uint32_t tile) const {
+    return activeTiles[tile];
+}
+
+uint32_t Blades::GetTileCapacity() const {
+    return tileCapacity;
+}
+
+uint64_t Blades::GetSeed() const {
+    return seed;
+}
+
+void Blades::RecordResetDrawArguments(VkCommandBuffer commandBuffer, uint32_t frame) const {
+    VkBufferCopy copyRegion = {};
+    copyRegion.size = GetNumBladesBufferSize();
+    vkCmdCopyBuffer(commandBuffer, initialNumBladesBuffer, numBladesBuffers[frame], 1, &copyRegion);
+
+    // Zero workgroups; the cluster culling pass adds CLUSTER_SIZE / WORKGROUP_SIZE per visible cluster
+    const uint32_t emptyDispatch[4] = { 0, 1, 1, 0 };
+    vkCmdUpdateBuffer(commandBuffer, clusterBuffer, 0, sizeof(emptyDispatch), emptyDispatch);
+}
+
+void Blades::RecordDraw(VkCommandBuffer commandBuffer, uint32_t frame) const {
+    // Binding 0: tile origins (per instance), bindings 1+: blade data
+    VkBuffer vertexBuffers[MAX_BLADE_VERTEX_STREAMS];
+    VkDeviceSize offsets[MAX_BLADE_VERTEX_STREAMS];
+    uint32_t streamCount = 1;
+    vertexBuffers[0] = tileBuffer;
+    offsets[0] = 0;
+
+    VkBuffer culledBladesBuffer = culledBladesBuffers[frame];
+    VkBuffer numBladesBuffer = numBladesBuffers[frame];
+
+#if defined(GRASS_CULL_INDICES) && defined(GRASS_COMPACT_BLADES)
+    // base, middle and tip streams are bladeCapacity half4s each, followed by the attribs words
+    for (uint32_t i = 0; i < MAX_BLADE_VERTEX_STREAMS - 1; i++) {
+        vertexBuffers[streamCount] = GetBladesBuffer(frame);
+        offsets[streamCount++] = i * poolInfo.bladeCapacity * 2 * sizeof(uint32_t);
+    }
+#elif defined(GRASS_CULL_INDICES)
+    vertexBuffers[streamCount] = GetBladesBuffer(frame);
+    offsets[streamCount++] = 0;
+#else
+    vertexBuffers[streamCount] = culledBladesBuffer;
+    offsets[streamCount++] = 0;
+#endif
+    vkCmdBindVertexBuffers(commandBuffer, 0, streamCount, vertexBuffers, offsets);
+
+#ifdef GRASS_CULL_INDICES
+    vkCmdBindIndexBuffer(commandBuffer, culledBladesBuffer, 0, VK_INDEX_TYPE_UINT32);
+#endif
 
-        // Generate positions and direction (v0)
-        float x = (generateRandomFloat() - 0.5f) * tileSize + tileOffsetX;
-        float z = (generateRandomFloat() - 0.5f) * tileSize + tileOffsetZ;
-        //float y = 0.0f;
-        float y = NoiseUtils::Noise(x * 0.5f, z * 0.5f) * 2.0f; // scale coords & height
-        float direction = generateRandomFloat() * 2.f * 3.14159265f;
-        glm::vec3 bladePosition(x, y, z);
-        currentBlade.v0 = glm::vec4(bladePosition, direction);
+    if (multiDraw) {
+#ifdef GRASS_CULL_INDICES
+        vkCmdDrawIndexedIndirect(commandBuffer, numBladesBuffer, 0, tileCapacity, sizeof(BladeDrawIndirect));
+#else
+        vkCmdDrawIndirect(commandBuffer, numBladesBuffer, 0, tileCapacity, sizeof(BladeDrawIndirect));
+#endif
+        return;
+    }
 
-        // Bezier point and height (v1)
-        float height = MIN_HEIGHT + (generateRandomFloat() * (MAX_HEIGHT - MIN_HEIGHT));
-        currentBlade.v1 = glm::vec4(bladePosition + bladeUp * height, height);
+    // Fallback: one indirect draw per tile, with the tile origin selected through the binding offset
+    for (uint32_t tile = 0; tile < tileCapacity; tile++) {
+        if (!firstInstance) {
+            VkDeviceSize tileOffset = tile * sizeof(glm::vec4);
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &tileBuffer, &tileOffset);
+        }
+#ifdef GRASS_CULL_INDICES
+        vkCmdDrawIndexedIndirect(commandBuffer, numBladesBuffer, tile * sizeof(BladeDrawIndirect), 1, sizeof(BladeDrawIndirect));
+#else
+        vkCmdDrawIndirect(commandBuffer, numBladesBuffer, tile * sizeof(BladeDrawIndirect), 1, sizeof(BladeDrawIndirect));
+#endif
+    }
+}
 
-        // Physical model guide and width (v2)
-        float width = MIN_WIDTH + (generateRandomFloat() * (MAX_WIDTH - MIN_WIDTH));
-        currentBlade.v2 = glm::vec4(bladePosition + bladeUp * height, width);
+std::vector<VkVertexInputBindingDescription> Blades::GetVertexBindingDescriptions() {
+    // Binding 0 steps once per draw: the tile origin of the tile being drawn
+    VkVertexInputBindingDescription tileBinding = {};
+    tileBinding.binding = 0;
+    tileBinding.stride = sizeof(glm::vec4);
+    tileBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
-        // Up vector and stiffness coefficient (up)
-        float stiffness = MIN_BEND + (generateRandomFloat() * (MAX_BEND - MIN_BEND));
-        currentBlade.up = glm::vec4(bladeUp, stiffness);
+#if defined(GRASS_CULL_INDICES) && defined(GRASS_COMPACT_BLADES)
+    // One binding per structure-of-arrays stream, bindings 1..4
+    const uint32_t strides[MAX_BLADE_VERTEX_STREAMS - 1] = {
+        2 * sizeof(uint32_t), 2 * sizeof(uint32_t), 2 * sizeof(uint32_t), sizeof(uint32_t)
+    };
 
-        blades.push_back(currentBlade);
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions = { tileBinding };
+    for (uint32_t i = 0; i < MAX_BLADE_VERTEX_STREAMS - 1; i++) {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 1 + i;
+        bindingDescription.stride = strides[i];
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        bindingDescriptions.push_back(bindingDescription);
     }
+    return bindingDescriptions;
+#elif defined(GRASS_CULL_INDICES)
+    return { tileBinding, Blade::getBindingDescription() };
+#else
+    return { tileBinding, CulledBlade::getBindingDescription() };
+#endif
+}
 
-    BladeDrawIndirect indirectDraw;
-    indirectDraw.vertexCount = NUM_BLADES;
-    indirectDraw.instanceCount = 1;
-    indirectDraw.firstVertex = 0;
-    indirectDraw.firstInstance = 0;
+std::vector<VkVertexInputAttributeDescription> Blades::GetVertexAttributeDescriptions() {
+#if defined(GRASS_CULL_INDICES) && defined(GRASS_COMPACT_BLADES)
+    // Same locations and formats as CompactBlade, but every attribute comes from its own stream
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions(MAX_BLADE_VERTEX_STREAMS - 1);
+    const uint32_t locations[MAX_BLADE_VERTEX_STREAMS - 1] = { 0, 1, 2, 4 };
+    for (uint32_t i = 0; i < MAX_BLADE_VERTEX_STREAMS - 1; i++) {
+        attributeDescriptions[i].binding = 1 + i;
+        attributeDescriptions[i].location = locations[i];
+        attributeDescriptions[i].format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        attributeDescriptions[i].offset = 0;
+    }
+    attributeDescriptions[3].format = VK_FORMAT_R32_UINT;
+#elif defined(GRASS_CULL_INDICES)
+    auto bladeAttributes = Blade::getAttributeDescriptions();
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions(bladeAttributes.begin(), bladeAttributes.end());
+#else
+    auto bladeAttributes = CulledBlade::getAttributeDescriptions();
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions(bladeAttributes.begin(), bladeAttributes.end());
+#endif
 
-    BufferUtils::CreateBufferFromData(device, commandPool, blades.data(), NUM_BLADES * sizeof(Blade), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bladesBuffer, bladesBufferMemory);
-    BufferUtils::CreateBuffer(device, NUM_BLADES * sizeof(Blade), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT , culledBladesBuffer, culledBladesBufferMemory);
-    BufferUtils::CreateBufferFromData(device, commandPool, &indirectDraw, sizeof(BladeDrawIndirect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, numBladesBuffer, numBladesBufferMemory);
+#ifdef GRASS_COMPACT_BLADES
+    // Tile origin the compact positions are relative to
+    VkVertexInputAttributeDescription tileAttribute = {};
+    tileAttribute.binding = 0;
+    tileAttribute.location = 5;
+    tileAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    tileAttribute.offset = 0;
+    attributeDescriptions.push_back(tileAttribute);
+#endif
 
+    return attributeDescriptions;
+}
 
-    BufferUtils::CreateBuffer(device, sizeof(TransformationInfo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, transformBuffer, transBufferMemory);
-    vkMapMemory(device->GetVkDevice(), transBufferMemory, 0, sizeof(TransformationInfo), 0, &data);
-    memcpy(data, &transformData, sizeof(TransformationInfo));
-    vkUnmapMemory(device->GetVkDevice(), transBufferMemory);
+VkBuffer Blades::GetBladesBuffer(uint32_t frame) const {
+    return bladesBuffers[frame % BLADE_STATE_COPIES];
 }
 
-void Blades::UpdateTransformation(const glm::vec4 transform) {
-    transformData.transform = transform;
+VkBuffer Blades::GetPreviousBladesBuffer(uint32_t frame) const {
+    return bladesBuffers[(frame + BLADE_STATE_COPIES - 1) % BLADE_STATE_COPIES];
+}
+
+VkBuffer Blades::GetCulledBladesBuffer(uint32_t frame) const {
+    return culledBladesBuffers[frame];
+}
+
+VkBuffer Blades::GetNumBladesBuffer(uint32_t frame) const {
+    return numBladesBuffers[frame];
+}
+
+VkBuffer Blades::GetTileBuffer() const {
+    return tileBuffer;
+}
 
-    vkMapMemory(device->GetVkDevice(), transBufferMemory, 0, sizeof(TransformationInfo), 0, &data);
-    memcpy(data, &transformData, sizeof(TransformationInfo));
-    vkUnmapMemory(device->GetVkDevice(), transBufferMemory);
+VkBuffer Blades::GetBoundsBuffer() const {
+    return boundsBuffer;
 }
 
-VkBuffer Blades::GetBladesBuffer() const {
-    return bladesBuffer;
+VkBuffer Blades::GetClusterBuffer() const {
+    return clusterBuffer;
 }
 
-VkBuffer Blades::GetCulledBladesBuffer() const {
-    return culledBladesBuffer;
+VkDeviceSize Blades::GetBladesBufferSize() const {
+    return tileCapacity * BLADES_BUFFER_SIZE;
 }
 
-VkBuffer Blades::GetNumBladesBuffer() const {
-    return numBladesBuffer;
+VkDeviceSize Blades::GetCulledBladesBufferSize() const {
+    return tileCapacity * CULLED_BLADES_BUFFER_SIZE;
 }
 
-VkBuffer Blades::GetTransformationBuffer() const {
-    return transformBuffer;
+VkDeviceSize Blades::GetNumBladesBufferSize() const {
+    return tileCapacity * sizeof(BladeDrawIndirect);
 }
 
-TransformationInfo Blades::GetTransformationData() const
-{
-    return transformData;
+VkDeviceSize Blades::GetTileBufferSize() const {
+    return tileCapacity * sizeof(glm::vec4);
+}
+
+VkDeviceSize Blades::GetBoundsBufferSize() const {
+    return (tileCapacity + tileCapacity * CLUSTERS_PER_TILE) * sizeof(BladeBounds);
+}
+
+VkDeviceSize Blades::GetClusterBufferSize() const {
+    return 4 * sizeof(uint32_t) + tileCapacity * CLUSTERS_PER_TILE * sizeof(uint32_t);
+}
+
+const BladeBounds* Blades::GetClusterBounds() const {
+    return boundsData + tileCapacity;
+}
+
+VkBuffer Blades::GetPoolInfoBuffer() const {
+    return poolInfoBuffer;
 }
 
 Blades::~Blades() {
-    vkDestroyBuffer(device->GetVkDevice(), bladesBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), bladesBufferMemory, nullptr);
-    vkDestroyBuffer(device->GetVkDevice(), culledBladesBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), culledBladesBufferMemory, nullptr);
-    vkDestroyBuffer(device->GetVkDevice(), numBladesBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), numBladesBufferMemory, nullptr);
-    vkDestroyBuffer(device->GetVkDevice(), transformBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), transBufferMemory, nullptr);
+    for (uint32_t i = 0; i < BLADE_STATE_COPIES; i++) {
+        BufferUtils::DestroyBuffer(device, bladesBuffers[i], bladesBufferMemories[i]);
+    }
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::DestroyBuffer(device, culledBladesBuffers[i], culledBladesBufferMemories[i]);
+        BufferUtils::DestroyBuffer(device, numBladesBuffers[i], numBladesBufferMemories[i]);
+    }
+
+    BufferUtils::DestroyBuffer(device, initialNumBladesBuffer, initialNumBladesBufferMemory);
+    BufferUtils::DestroyBuffer(device, tileBuffer, tileBufferMemory);
+    BufferUtils::DestroyBuffer(device, boundsBuffer, boundsBufferMemory);
+    BufferUtils::DestroyBuffer(device, clusterBuffer, clusterBufferMemory);
+    BufferUtils::DestroyBuffer(device, poolInfoBuffer, poolInfoBufferMemory);
 }
@@ -2,8 +2,12 @@
 #include <vulkan/vulkan.h>
 #include <glm/glm.hpp>
 #include <array>
+#include <vector>
 #include "Model.h"
 #include "NoiseUtils.h"
+#include "FramesInFlight.h"
+
+class ThreadPool;
 
 constexpr static unsigned int NUM_BLADES = 1 << 15;
 constexpr static float MIN_HEIGHT = 1.3f;
@@ -13,6 +17,9 @@ constexpr static float MAX_WIDTH = 0.14f;
 constexpr static float MIN_BEND = 7.0f;
 constexpr static float MAX_BEND = 13.0f;
 
+// Seed of the blade generation. The blades of a tile depend only on the seed and the tile's offset.
+constexpr static uint64_t DEFAULT_BLADE_SEED = 0x6772617373ull;
+
 struct Blade {
     // Position and direction
     glm::vec4 v0;
@@ -76,40 +83,291 @@ struct Blade {
     }
 };
 
+#ifdef GRASS_COMPACT_BLADES
+// Compact layout (build with GRASS_COMPACT_BLADES). The simulated blades are stored as
+// structure-of-arrays streams in a single buffer, NUM_BLADES entries each:
+//   base   : half4, xyz relative to the tile origin, w = orientation
+//   middle : half4, xyz relative to the tile origin, w = height
+//   tip    : half4, xyz relative to the tile origin, w = width
+//   attribs: uint, low 16 bits = half stiffness, bits 16..17 = bladeType
+// The up vector is not stored; generated blades always point along +y.
+// 28 bytes per blade instead of the 80 of Blade.
+struct CompactBlade {
+    uint32_t v0[2];
+    uint32_t v1[2];
+    uint32_t v2[2];
+    uint32_t attribs;
+    uint32_t pad;
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 1;
+        bindingDescription.stride = sizeof(CompactBlade);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions = {};
+
+        // v0, v1, v2 are decoded from half floats by the vertex fetch
+        attributeDescriptions[0].binding = 1;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        attributeDescriptions[0].offset = offsetof(CompactBlade, v0);
+
+        attributeDescriptions[1].binding = 1;
+        attributeDescriptions[1].location = 1;
+        attributeDescriptions[1].format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(CompactBlade, v1);
+
+        attributeDescriptions[2].binding = 1;
+        attributeDescriptions[2].location = 2;
+        attributeDescriptions[2].format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        attributeDescriptions[2].offset = offsetof(CompactBlade, v2);
+
+        // stiffness + bladeType
+        attributeDescriptions[3].binding = 1;
+        attributeDescriptions[3].location = 4;
+        attributeDescriptions[3].format = VK_FORMAT_R32_UINT;
+        attributeDescriptions[3].offset = offsetof(CompactBlade, attribs);
+
+        return attributeDescriptions;
+    }
+};
+
+constexpr static const char* BLADE_LAYOUT_NAME = "compact";
+constexpr static VkDeviceSize BLADES_BUFFER_SIZE = NUM_BLADES * (3 * 2 * sizeof(uint32_t) + sizeof(uint32_t));
+#else
+constexpr static const char* BLADE_LAYOUT_NAME = "default";
+constexpr static VkDeviceSize BLADES_BUFFER_SIZE = NUM_BLADES * sizeof(Blade);
+#endif
+
+#ifdef GRASS_CULL_INDICES
+// Culling writes the 32-bit index of every visible blade (build with GRASS_CULL_INDICES).
+// culledBladesBuffer is bound as the index buffer and the grass pipeline fetches the
+// blades straight out of bladesBuffer, so nothing but the index is copied per blade.
+using CulledBlade = uint32_t;
+constexpr static const char* CULL_OUTPUT_NAME = "indices";
+
+// Matches VkDrawIndexedIndirectCommand
+struct BladeDrawIndirect {
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t firstInstance;
+};
+#else
+// Record written to culledBladesBuffer and read by the grass vertex stage
+#ifdef GRASS_COMPACT_BLADES
+using CulledBlade = CompactBlade;
+#else
+using CulledBlade = Blade;
+#endif
+constexpr static const char* CULL_OUTPUT_NAME = "blades";
+
+// Matches VkDrawIndirectCommand
 struct BladeDrawIndirect {
     uint32_t vertexCount;
     uint32_t instanceCount;
     uint32_t firstVertex;
     uint32_t firstInstance;
 };
+#endif
+
+constexpr static VkDeviceSize CULLED_BLADES_BUFFER_SIZE = NUM_BLADES * sizeof(CulledBlade);
+
+// Indirect arguments drawing count visible blades
+inline BladeDrawIndirect MakeBladeDrawIndirect(uint32_t count) {
+    BladeDrawIndirect indirectDraw = {};
+#ifdef GRASS_CULL_INDICES
+    indirectDraw.indexCount = count;
+#else
+    indirectDraw.vertexCount = count;
+#endif
+    indirectDraw.instanceCount = 1;
+    return indirectDraw;
+}
+
+#ifdef GRASS_CULL_INDICES
+// The grass pass fetches the simulated blades themselves, so the simulation ping-pongs between one copy
+// per frame in flight: frame f reads copy f - 1 and writes copy f while frame f - 1 may still be drawing
+constexpr static uint32_t BLADE_STATE_COPIES = MAX_FRAMES_IN_FLIGHT;
+#else
+// Only the compute pass touches the simulated blades, so they are updated in place
+constexpr static uint32_t BLADE_STATE_COPIES = 1;
+#endif
+
+// Blades are culled hierarchically. A first compute pass tests the bounds of every tile and of every
+// cluster of CLUSTER_SIZE consecutive blades against the view and the distance culling range, and only the
+// surviving clusters are simulated and culled blade by blade. Must match shaders/cluster_cull.comp and shaders/compute.comp.
+constexpr static uint32_t CLUSTER_SIZE = 256;
+constexpr static uint32_t CLUSTERS_PER_TILE = NUM_BLADES / CLUSTER_SIZE;
+
+// Furthest a simulated blade can reach from its base: bladeType 2 stretches the height by 1.3 in
+// compute.comp, and the blade is at most half its width wide on either side
+constexpr static float MAX_BLADE_REACH = MAX_HEIGHT * 1.3f + MAX_WIDTH;
+
+// World-space bounding box of a tile or cluster, padded to vec4 for the storage buffer. min.w of a tile's
+// bounds is nonzero while its slot is inactive, which makes the cluster culling pass skip the whole tile.
+struct BladeBounds {
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+// What LoadTile uploads for one tile, without owning it: a BladeTile, or a tile mapped from a TileCache
+struct BladeTileView {
+    glm::vec3 origin;
+    // BLADES_BUFFER_SIZE bytes, laid out like BladeTile::data
+    const void* data;
+    BladeBounds bounds;
+    // CLUSTERS_PER_TILE entries
+    const BladeBounds* clusterBounds;
+};
 
-struct TransformationInfo {
-    glm::vec4 transform;
+// Upload payload and bounds of one tile, built by Blades::PrepareTile
+struct BladeTile {
+    glm::vec3 origin;
+#ifdef GRASS_COMPACT_BLADES
+    // The tile's part of each compact stream, back to back
+    std::vector<uint32_t> data;
+#else
+    std::vector<Blade> data;
+#endif
+    BladeBounds bounds;
+    std::vector<BladeBounds> clusterBounds;
+
+    BladeTileView View() const {
+        return { origin, data.data(), bounds, clusterBounds.data() };
+    }
 };
 
+// Upper bound of the vertex buffers the grass pipeline binds: the tile origins plus one per blade stream
+constexpr static uint32_t MAX_BLADE_VERTEX_STREAMS = 5;
+
+// Constants of the pool, read by the compute passes
+struct BladePoolInfo {
+    // Blade slots in the pool (tileCapacity * NUM_BLADES), the length of each compact stream
+    uint32_t bladeCapacity;
+    uint32_t pad0;
+    uint32_t pad1;
+    uint32_t pad2;
+};
+
+// Pool of the blades of every terrain tile. The pool has a fixed number of tile slots that are filled,
+// activated and recycled as terrain streams in and out; all of them share one set of buffers. Tile t owns blades
+// [t * NUM_BLADES, (t + 1) * NUM_BLADES) of bladesBuffer (of every stream with GRASS_COMPACT_BLADES),
+// the same range of culledBladesBuffer and entry t of the indirect draw arguments. The compute pass
+// simulates the whole pool with one dispatch and the grass pass draws it with one multi-draw-indirect;
+// inactive slots are culled at the tile level and draw nothing, so neither command depends on which
+// slots are in use and the recorded command buffers never change.
+// Everything the compute pass writes and the grass pass reads exists once per frame in flight, so the
+// simulation of frame f + 1 can run on the compute queue while frame f is drawn.
+//
+// boundsBuffer holds the BladeBounds of tile t at index t and of cluster c (blades
+// [c * CLUSTER_SIZE, (c + 1) * CLUSTER_SIZE) of the pool) at tileCapacity + c. clusterBuffer receives
+// the VkDispatchIndirectCommand of the surviving clusters (padded to 16 bytes) followed by their ids.
 class Blades : public Model {
 private:
-    VkBuffer bladesBuffer;
-    VkBuffer culledBladesBuffer;
-    VkBuffer numBladesBuffer;
-    VkBuffer transformBuffer;
+    uint32_t tileCapacity;
+    uint64_t seed;
+    // Tiles are drawn with a single vkCmdDrawIndirect (multiDrawIndirect and, for the tile origin
+    // instance attribute, drawIndirectFirstInstance)
+    bool multiDraw;
+    bool firstInstance;
+
+    std::array<VkBuffer, BLADE_STATE_COPIES> bladesBuffers;
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> culledBladesBuffers;
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> numBladesBuffers;
+    VkBuffer initialNumBladesBuffer;
+    VkBuffer tileBuffer;
+    VkBuffer boundsBuffer;
+    VkBuffer clusterBuffer;
+    VkBuffer poolInfoBuffer;
+
+    std::array<MemoryAllocation, BLADE_STATE_COPIES> bladesBufferMemories;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> culledBladesBufferMemories;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> numBladesBufferMemories;
+    MemoryAllocation initialNumBladesBufferMemory;
+    MemoryAllocation tileBufferMemory;
+    MemoryAllocation boundsBufferMemory;
+    MemoryAllocation clusterBufferMemory;
+    MemoryAllocation poolInfoBufferMemory;
+
+    // Persistently mapped draw argument template, tile origins and bounds
+    BladeDrawIndirect* initialNumBladesData;
+    glm::vec4* tileData;
+    BladeBounds* boundsData;
+    BladePoolInfo poolInfo;
 
-    VkDeviceMemory bladesBufferMemory;
-    VkDeviceMemory culledBladesBufferMemory;
-    VkDeviceMemory numBladesBufferMemory;
-    VkDeviceMemory transBufferMemory;
+    // Bounds of every loaded slot, copied into boundsBuffer while the slot is active
+    std::vector<BladeBounds> tileBounds;
+    std::vector<bool> activeTiles;
 
-    void* data;
-    TransformationInfo transformData;
+    // Queues a copy of data to [dstOffset, dstOffset + size) of every copy of the simulated blades
+    void UploadBlades(UploadBatcher* uploader, const void* data, VkDeviceSize size, VkDeviceSize dstOffset);
 
 public:
-    Blades(Device* device, VkCommandPool commandPool, float tileSize, float tileOffsetX, float tileOffsetZ);
-    VkBuffer GetBladesBuffer() const;
-    VkBuffer GetCulledBladesBuffer() const;
-    VkBuffer GetNumBladesBuffer() const;
-
-    VkBuffer GetTransformationBuffer() const;
-    TransformationInfo GetTransformationData() const;
-    void UpdateTransformation(const glm::vec4 transformation);
+    Blades(Device* device, UploadBatcher* uploader, uint32_t tileCapacity, uint64_t seed = DEFAULT_BLADE_SEED);
+
+    // Generates the NUM_BLADES blades of the tile centered at (tileOffsetX, tileOffsetZ). Blade i takes
+    // its random values from counters of a generator keyed by (seed, tile offset), so the work is split
+    // over the pool (the shared one if null) and the result is the same whatever the thread count.
+    static std::vector<Blade> GenerateTile(uint64_t seed, float tileSize, float tileOffsetX, float tileOffsetZ,
+        ThreadPool* pool = nullptr);
+
+    // Generates the tile and lays it out for LoadTile. Touches no GPU state, so it can run on any thread.
+    static BladeTile PrepareTile(uint64_t seed, float tileSize, float tileOffsetX, float tileOffsetZ, ThreadPool* pool = nullptr);
+    // Same, with the pool's seed
+    BladeTile PrepareTile(float tileSize, float tileOffsetX, float tileOffsetZ, ThreadPool* pool = nullptr) const;
+
+    // Queues the upload of a prepared tile into the given slot. The slot must be inactive and no longer
+    // read by any frame in flight; it stays culled until the upload has landed and SetTileActive is called.
+    // The tile's data is staged before the call returns.
+    void LoadTile(UploadBatcher* uploader, uint32_t tile, const BladeTileView& bladeTile);
+    // Active slots are simulated and drawn, inactive ones only cost the GPU their tile bounds test.
+    // Takes effect with the next frame submitted.
+    void SetTileActive(uint32_t tile, bool active);
+    bool IsTileActive(uint32_t tile) const;
+    uint32_t GetTileCapacity() const;
+    uint64_t GetSeed() const;
+
+    // Simulated blades written by the given frame in flight, and the ones it reads (written by the frame
+    // before). Both are the same buffer unless BLADE_STATE_COPIES > 1.
+    VkBuffer GetBladesBuffer(uint32_t frame) const;
+    VkBuffer GetPreviousBladesBuffer(uint32_t frame) const;
+    VkBuffer GetCulledBladesBuffer(uint32_t frame) const;
+    VkBuffer GetNumBladesBuffer(uint32_t frame) const;
+    VkBuffer GetTileBuffer() const;
+    VkBuffer GetBoundsBuffer() const;
+    VkBuffer GetClusterBuffer() const;
+
+    VkDeviceSize GetBladesBufferSize() const;
+    VkDeviceSize GetCulledBladesBufferSize() const;
+    VkDeviceSize GetNumBladesBufferSize() const;
+    VkDeviceSize GetTileBufferSize() const;
+    VkDeviceSize GetBoundsBufferSize() const;
+    VkDeviceSize GetClusterBufferSize() const;
+
+    // The bounds of every cluster of the pool as uploaded to boundsBuffer, CLUSTERS_PER_TILE per tile slot
+    const BladeBounds* GetClusterBounds() const;
+
+    // Uniform buffer holding the BladePoolInfo
+    VkBuffer GetPoolInfoBuffer() const;
+
+    // Resets every tile's visible count of the given frame by copying the draw argument template over
+    // its numBladesBuffer, and empties the visible cluster list. Has to run (and be made visible) before
+    // the dispatches that append to them.
+    void RecordResetDrawArguments(VkCommandBuffer commandBuffer, uint32_t frame) const;
+
+    // Binds the vertex streams of the given frame and draws all tiles, in one call where the device allows it
+    void RecordDraw(VkCommandBuffer commandBuffer, uint32_t frame) const override;
+
+    // Vertex input of the grass pipeline for the active blade layout / cull output
+    static std::vector<VkVertexInputBindingDescription> GetVertexBindingDescriptions();
+    static std::vector<VkVertexInputAttributeDescription> GetVertexAttributeDescriptions();
+
     ~Blades();
 };
@@ -1,39 +1,65 @@
 #include "BufferUtils.h"
 #include "Instance.h"
+#include "UploadBatcher.h"
 
+#include <algorithm>
 #include <cstring>
 
-void BufferUtils::CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-    // Create buffer
-    VkBufferCreateInfo bufferInfo = {};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = size;
-    bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    if (vkCreateBuffer(device->GetVkDevice(), &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create vertex buffer");
+namespace {
+    void createBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, const std::vector<uint32_t>& queueFamilies, VkBuffer& buffer, MemoryAllocation& bufferMemory) {
+        // Create buffer
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        if (queueFamilies.size() > 1) {
+            bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+            bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+        } else {
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        }
+
+        if (vkCreateBuffer(device->GetVkDevice(), &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create vertex buffer");
+        }
+
+        // Query buffer's memory requirements
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device->GetVkDevice(), buffer, &memRequirements);
+
+        // Sub-allocate from the device's memory blocks
+        bufferMemory = device->GetAllocator()->Allocate(memRequirements, properties, true);
+
+        // Associate allocated memory with vertex buffer
+        vkBindBufferMemory(device->GetVkDevice(), buffer, bufferMemory.memory, bufferMemory.offset);
     }
+}
 
-    // Query buffer's memory requirements
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(device->GetVkDevice(), buffer, &memRequirements);
-
-    // Allocate memory in device
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = device->GetInstance()->GetMemoryTypeIndex(memRequirements.memoryTypeBits, properties);
+void BufferUtils::CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory) {
+    createBuffer(device, size, usage, properties, {}, buffer, bufferMemory);
+}
 
-    if (vkAllocateMemory(device->GetVkDevice(), &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-      throw std::runtime_error("Failed to allocate vertex buffer");
+void BufferUtils::CreateSharedBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory) {
+    // Every distinct family the buffer is touched from (uploads, simulation, drawing)
+    const QueueFamilyIndices& indices = device->GetInstance()->GetQueueFamilyIndices();
+    std::vector<uint32_t> queueFamilies;
+    for (QueueFlags flag : { QueueFlags::Graphics, QueueFlags::Compute, QueueFlags::Transfer }) {
+        uint32_t family = static_cast<uint32_t>(indices[flag]);
+        if (indices[flag] >= 0 && std::find(queueFamilies.begin(), queueFamilies.end(), family) == queueFamilies.end()) {
+            queueFamilies.push_back(family);
+        }
     }
 
-    // Associate allocated memory with vertex buffer
-    vkBindBufferMemory(device->GetVkDevice(), buffer, bufferMemory, 0);
+    createBuffer(device, size, usage, properties, queueFamilies, buffer, bufferMemory);
 }
 
-void BufferUtils::CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
+void BufferUtils::DestroyBuffer(Device* device, VkBuffer buffer, MemoryAllocation& bufferMemory) {
+    vkDestroyBuffer(device->GetVkDevice(), buffer, nullptr);
+    device->GetAllocator()->Free(bufferMemory);
+}
+
+void BufferUtils::CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize dstOffset) {
     VkCommandBufferAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
@@ -51,6 +77,7 @@ void BufferUtils::CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer
 
     VkBufferCopy copyRegion = {};
     copyRegion.size = size;
+    copyRegion.dstOffset = dstOffset;
     vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
     vkEndCommandBuffer(commandBuffer);
@@ -65,86 +92,40 @@ void BufferUtils::CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer
     vkFreeCommandBuffers(device->GetVkDevice(), commandPool, 1, &commandBuffer);
 }
 
-void BufferUtils::CreateBufferFromData(Device* device, VkCommandPool commandPool, void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-    // Create the staging buffer
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+void BufferUtils::ReadBuffer(Device* device, VkCommandPool commandPool, VkBuffer srcBuffer, VkDeviceSize size, void* data) {
+    VkBuffer readbackBuffer;
+    MemoryAllocation readbackBufferMemory;
+    CreateBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer, readbackBufferMemory);
 
-    VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    VkMemoryPropertyFlags stagingProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    BufferUtils::CreateBuffer(device, bufferSize, stagingUsage, stagingProperties, stagingBuffer, stagingBufferMemory);
+    CopyBuffer(device, commandPool, srcBuffer, readbackBuffer, size);
+    memcpy(data, readbackBufferMemory.mapped, static_cast<size_t>(size));
 
-    // Fill the staging buffer
-    void *data;
-    vkMapMemory(device->GetVkDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, bufferData, static_cast<size_t>(bufferSize));
-    vkUnmapMemory(device->GetVkDevice(), stagingBufferMemory);
+    DestroyBuffer(device, readbackBuffer, readbackBufferMemory);
+}
 
+void BufferUtils::CreateBufferFromData(Device* device, UploadBatcher* uploader, const void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, MemoryAllocation& bufferMemory) {
     // Create the buffer
     VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | bufferUsage;
     VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     BufferUtils::CreateBuffer(device, bufferSize, usage, flags, buffer, bufferMemory);
 
-    // Copy data from staging to buffer
-    BufferUtils::CopyBuffer(device, commandPool, stagingBuffer, buffer, bufferSize);
+    // Copy data through the uploader's staging ring
+    uploader->Upload(bufferData, bufferSize, buffer);
+}
 
-    // No need for the staging buffer anymore
-    vkDestroyBuffer(device->GetVkDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), stagingBufferMemory, nullptr);
+void BufferUtils::UploadToBuffer(UploadBatcher* uploader, const void* bufferData, VkDeviceSize bufferSize, VkBuffer buffer, VkDeviceSize dstOffset) {
+    uploader->Upload(bufferData, bufferSize, buffer, dstOffset);
 }
 
-void BufferUtils::CreateVertexIndexBuffers(Device* device, VkCommandPool commandPool,
+void BufferUtils::CreateVertexIndexBuffers(Device* device, UploadBatcher* uploader,
     const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
-    VkBuffer& vertexBuffer, VkDeviceMemory& vertexBufferMemory,
-    VkBuffer& indexBuffer, VkDeviceMemory& indexBufferMemory)
+    VkBuffer& vertexBuffer, MemoryAllocation& vertexBufferMemory,
+    VkBuffer& indexBuffer, MemoryAllocation& indexBufferMemory)
 {
     VkDeviceSize vertexBufferSize = sizeof(vertices[0]) * vertices.size();
     VkDeviceSize indexBufferSize = sizeof(indices[0]) * indices.size();
 
-    // Create staging buffers
-    VkBuffer stagingVertexBuffer;
-    VkDeviceMemory stagingVertexBufferMemory;
-    CreateBuffer(device, vertexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingVertexBuffer, stagingVertexBufferMemory);
-
-    void* vertexData;
-    vkMapMemory(device->GetVkDevice(), stagingVertexBufferMemory, 0, vertexBufferSize, 0, &vertexData);
-    memcpy(vertexData, vertices.data(), (size_t)vertexBufferSize);
-    vkUnmapMemory(device->GetVkDevice(), stagingVertexBufferMemory);
-
-    VkBuffer stagingIndexBuffer;
-    VkDeviceMemory stagingIndexBufferMemory;
-    CreateBuffer(device, indexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingIndexBuffer, stagingIndexBufferMemory);
-
-    void* indexData;
-    vkMapMemory(device->GetVkDevice(), stagingIndexBufferMemory, 0, indexBufferSize, 0, &indexData);
-    memcpy(indexData, indices.data(), (size_t)indexBufferSize);
-    vkUnmapMemory(device->GetVkDevice(), stagingIndexBufferMemory);
-
-    // Create device-local buffers
-    CreateBuffer(device, vertexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        vertexBuffer, vertexBufferMemory);
-
-    CreateBuffer(device, indexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        indexBuffer, indexBufferMemory);
-
-    // Copy from staging to device-local buffers
-    CopyBuffer(device, commandPool, stagingVertexBuffer, vertexBuffer, vertexBufferSize);
-    CopyBuffer(device, commandPool, stagingIndexBuffer, indexBuffer, indexBufferSize);
-
-    // Clean up staging buffers
-    vkDestroyBuffer(device->GetVkDevice(), stagingVertexBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), stagingVertexBufferMemory, nullptr);
-    vkDestroyBuffer(device->GetVkDevice(), stagingIndexBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), stagingIndexBufferMemory, nullptr);
+    // Both copies go into the same batch
+    CreateBufferFromData(device, uploader, vertices.data(), vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+    CreateBufferFromData(device, uploader, indices.data(), indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
 }
-
@@ -2,12 +2,29 @@
 
 #include <vulkan/vulkan.h>
 #include "Device.h"
+#include "MemoryAllocator.h"
 
 #include "Vertex.h"
 
+class UploadBatcher;
+
 namespace BufferUtils {
-    void CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-    void CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    void CreateBufferFromData(Device* device, VkCommandPool commandPool, void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-    void CreateVertexIndexBuffers(Device* device, VkCommandPool commandPool, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, VkBuffer& vertexBuffer, VkDeviceMemory& vertexBufferMemory, VkBuffer& indexBuffer, VkDeviceMemory& indexBufferMemory);
+    // Creates the buffer and binds it to a range of the device's MemoryAllocator. Host visible memory comes
+    // mapped (bufferMemory.mapped). Release with DestroyBuffer.
+    void CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory);
+    // CreateBuffer for buffers used from more than one queue family (e.g. written by the compute queue, drawn by
+    // the graphics queue). Sharing is concurrent when the families differ, so no ownership transfers are needed.
+    void CreateSharedBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory);
+    void DestroyBuffer(Device* device, VkBuffer buffer, MemoryAllocation& bufferMemory);
+    // Copies on the graphics queue and waits for it to go idle. Prefer an UploadBatcher for anything repeated.
+    void CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+    // Copies the first size bytes of a TRANSFER_SRC buffer into data through a host visible buffer, with CopyBuffer.
+    // Meant for validation and tools, never for anything per frame.
+    void ReadBuffer(Device* device, VkCommandPool commandPool, VkBuffer srcBuffer, VkDeviceSize size, void* data);
+
+    // The helpers below queue their copies on the uploader; the data is in place after its next Flush
+    void CreateBufferFromData(Device* device, UploadBatcher* uploader, const void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, MemoryAllocation& bufferMemory);
+    // Copies bufferData into an existing (TRANSFER_DST) buffer at dstOffset
+    void UploadToBuffer(UploadBatcher* uploader, const void* bufferData, VkDeviceSize bufferSize, VkBuffer buffer, VkDeviceSize dstOffset);
+    void CreateVertexIndexBuffers(Device* device, UploadBatcher* uploader, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, VkBuffer& vertexBuffer, MemoryAllocation& vertexBufferMemory, VkBuffer& indexBuffer, MemoryAllocation& indexBufferMemory);
 }
@@ -8,17 +8,25 @@
 #include "Camera.h"
 #include "BufferUtils.h"
 
+CameraBufferObject Camera::GetInitialBufferObject(float aspectRatio) {
+    CameraBufferObject initial;
+    initial.viewMatrix = glm::lookAt(glm::vec3(0.0f, 1.0f, 10.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    initial.projectionMatrix = glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, 100.0f);
+    initial.projectionMatrix[1][1] *= -1; // y-coordinate is flipped
+    return initial;
+}
+
 Camera::Camera(Device* device, float aspectRatio) : device(device) {
     r = 10.0f;
     theta = 0.0f;
     phi = 0.0f;
-    cameraBufferObject.viewMatrix = glm::lookAt(glm::vec3(0.0f, 1.0f, 10.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    cameraBufferObject.projectionMatrix = glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, 100.0f);
-    cameraBufferObject.projectionMatrix[1][1] *= -1; // y-coordinate is flipped
+    cameraBufferObject = GetInitialBufferObject(aspectRatio);
 
-    BufferUtils::CreateBuffer(device, sizeof(CameraBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
-    vkMapMemory(device->GetVkDevice(), bufferMemory, 0, sizeof(CameraBufferObject), 0, &mappedData);
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::CreateBuffer(device, sizeof(CameraBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffers[i], bufferMemories[i]);
+        mappedData[i] = bufferMemories[i].mapped;
+        memcpy(mappedData[i], &cameraBufferObject, sizeof(CameraBufferObject));
+    }
 }
 
 
@@ -27,7 +35,6 @@ void Camera::MoveForward(float amount) {
     position += forward * amount;
     lookAt += forward * amount;
     cameraBufferObject.viewMatrix = glm::lookAt(position, lookAt, up);
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
 void Camera::MoveRight(float amount) {
@@ -35,20 +42,22 @@ void Camera::MoveRight(float amount) {
     position += right * amount;
     lookAt += right * amount;
     cameraBufferObject.viewMatrix = glm::lookAt(position, lookAt, up);
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
 void Camera::MoveUp(float amount) {
     position += up * amount;
     lookAt += up * amount;
     cameraBufferObject.viewMatrix = glm::lookAt(position, lookAt, up);
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
 
 
-VkBuffer Camera::GetBuffer() const {
-    return buffer;
+VkBuffer Camera::GetBuffer(uint32_t frame) const {
+    return buffers[frame];
+}
+
+void Camera::UpdateBuffer(uint32_t frame) {
+    memcpy(mappedData[frame], &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
 void Camera::UpdateOrbit(float deltaX, float deltaY, float deltaZ) {
@@ -71,7 +80,6 @@ void Camera::UpdateOrbit(float deltaX, float deltaY, float deltaZ) {
     lookAt = glm::vec3(0.0f, 1.0f, 0.0f);  // target of orbit
 
     cameraBufferObject.viewMatrix = glm::lookAt(position, lookAt, up);
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
 
@@ -97,7 +105,6 @@ void Camera::UpdateLook(float deltaX, float deltaY, float deltaZ) {
     lookAt = position + direction;
 
     cameraBufferObject.viewMatrix = glm::lookAt(position, lookAt, up);
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
 glm::vec3 Camera::GetPosition() const {
@@ -117,7 +124,7 @@ glm::mat4 Camera::GetViewMatrix() const {
 
 
 Camera::~Camera() {
-  vkUnmapMemory(device->GetVkDevice(), bufferMemory);
-  vkDestroyBuffer(device->GetVkDevice(), buffer, nullptr);
-  vkFreeMemory(device->GetVkDevice(), bufferMemory, nullptr);
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    BufferUtils::DestroyBuffer(device, buffers[i], bufferMemories[i]);
+  }
 }
@@ -2,7 +2,10 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <array>
 #include "Device.h"
+#include "MemoryAllocator.h"
+#include "FramesInFlight.h"
 
 struct CameraBufferObject {
   glm::mat4 viewMatrix;
@@ -15,10 +18,11 @@ private:
     
     CameraBufferObject cameraBufferObject;
     
-    VkBuffer buffer;
-    VkDeviceMemory bufferMemory;
+    // One uniform buffer per frame in flight, so updating the next frame never races the GPU
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> buffers;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> bufferMemories;
 
-    void* mappedData;
+    std::array<void*, MAX_FRAMES_IN_FLIGHT> mappedData;
 
     float r, theta, phi;
 
@@ -35,7 +39,14 @@ public:
     Camera(Device* device, float aspectRatio);
     ~Camera();
 
-    VkBuffer GetBuffer() const;
+    // View and projection a new camera starts with, for code that needs them without a device
+    static CameraBufferObject GetInitialBufferObject(float aspectRatio);
+
+    VkBuffer GetBuffer(uint32_t frame) const;
+
+    // Copies the current view/projection into the buffer of the given frame in flight.
+    // Call once the GPU is done with that frame.
+    void UpdateBuffer(uint32_t frame);
     
     void UpdateOrbit(float deltaX, float deltaY, float deltaZ);
     void UpdateLook(float deltaX, float deltaY, float deltaZ);
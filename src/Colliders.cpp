@@ -0,0 +1,173 @@
+#include "Colliders.h"
+#include "Blades.h"
+#include "BufferUtils.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+static_assert(offsetof(ColliderGridData, colliders) == 16, "ColliderGridData must match the std430 layout of ColliderGrid");
+static_assert(offsetof(ColliderGridData, buckets) == 16 + MAX_COLLIDERS * sizeof(Collider), "ColliderGridData must match the std430 layout of ColliderGrid");
+static_assert((COLLIDER_TABLE_SIZE & (COLLIDER_TABLE_SIZE - 1)) == 0, "COLLIDER_TABLE_SIZE must be a power of two");
+
+namespace {
+    // Extra room around a collider's cells, for blades whose base the GPU rounds into the neighbouring cell
+    constexpr float CELL_MARGIN = 0.05f;
+}
+
+Collider Collider::Sphere(const glm::vec3& center, float radius) {
+    return Capsule(center, center, radius);
+}
+
+Collider Collider::Capsule(const glm::vec3& start, const glm::vec3& end, float radius) {
+    Collider collider;
+    collider.start = glm::vec4(start, radius);
+    collider.end = glm::vec4(end, 0.0f);
+    return collider;
+}
+
+Colliders::Colliders(Device* device, float cellSize)
+    : device(device), cellSize(cellSize) {
+    grid = new ColliderGridData();
+    grid->cellSize = cellSize;
+    lastCollider.resize(COLLIDER_TABLE_SIZE);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::CreateBuffer(device, GetBufferSize(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffers[i], bufferMemories[i]);
+        memcpy(bufferMemories[i].mapped, grid, sizeof(ColliderGridData));
+    }
+}
+
+Colliders::~Colliders() {
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::DestroyBuffer(device, buffers[i], bufferMemories[i]);
+    }
+    delete grid;
+}
+
+uint32_t Colliders::Add(const Collider& collider) {
+    uint32_t id;
+    if (!freeIds.empty()) {
+        id = freeIds.back();
+        freeIds.pop_back();
+    }
+    else if (colliders.size() < MAX_COLLIDERS) {
+        id = static_cast<uint32_t>(colliders.size());
+        colliders.emplace_back();
+        used.push_back(false);
+    }
+    else {
+        throw std::runtime_error("Too many colliders");
+    }
+
+    colliders[id] = collider;
+    used[id] = true;
+    return id;
+}
+
+void Colliders::Set(uint32_t id, const Collider& collider) {
+    colliders[id] = collider;
+}
+
+const Collider& Colliders::Get(uint32_t id) const {
+    return colliders[id];
+}
+
+void Colliders::Remove(uint32_t id) {
+    used[id] = false;
+    freeIds.push_back(id);
+}
+
+uint32_t Colliders::GetCount() const {
+    return static_cast<uint32_t>(colliders.size() - freeIds.size());
+}
+
+void Colliders::UpdateBuffer(uint32_t frame) {
+    Bin();
+
+    // Only the parts in use; the buffer is write-combined memory, so it is written once and never read
+    char* mapped = static_cast<char*>(bufferMemories[frame].mapped);
+    memcpy(mapped, grid, offsetof(ColliderGridData, colliders) + grid->colliderCount * sizeof(Collider));
+    memcpy(mapped + offsetof(ColliderGridData, buckets), grid->buckets, sizeof(grid->buckets));
+    memcpy(mapped + offsetof(ColliderGridData, references), grid->references, referenceCount * sizeof(uint32_t));
+}
+
+VkBuffer Colliders::GetBuffer(uint32_t frame) const {
+    return buffers[frame];
+}
+
+VkDeviceSize Colliders::GetBufferSize() const {
+    return sizeof(ColliderGridData);
+}
+
+uint32_t Colliders::GetReferenceCount() const {
+    return referenceCount;
+}
+
+void Colliders::Bin() {
+    // Gather the colliders in use and the buckets of the cells each one can affect. A collider is listed
+    // once per bucket even when several of its cells share it.
+    entries.clear();
+    std::fill(lastCollider.begin(), lastCollider.end(), UINT32_MAX);
+    uint32_t count = 0;
+    bool overflow = false;
+
+    for (size_t id = 0; id < colliders.size(); id++) {
+        if (!used[id]) {
+            continue;
+        }
+
+        const Collider& collider = colliders[id];
+        float reach = collider.start.w + MAX_BLADE_REACH + CELL_MARGIN;
+        glm::vec2 a(collider.start.x, collider.start.z);
+        glm::vec2 b(collider.end.x, collider.end.z);
+        glm::ivec2 first = glm::ivec2(glm::floor((glm::min(a, b) - reach) / cellSize));
+        glm::ivec2 last = glm::ivec2(glm::floor((glm::max(a, b) + reach) / cellSize));
+
+        size_t cells = static_cast<size_t>(last.x - first.x + 1) * static_cast<size_t>(last.y - first.y + 1);
+        if (entries.size() + cells > MAX_COLLIDER_REFERENCES) {
+            overflow = true;
+            continue;
+        }
+
+        uint32_t index = count++;
+        grid->colliders[index] = collider;
+        for (int32_t z = first.y; z <= last.y; z++) {
+            for (int32_t x = first.x; x <= last.x; x++) {
+                uint32_t bucket = ColliderBucket(x, z);
+                if (lastCollider[bucket] != index) {
+                    lastCollider[bucket] = index;
+                    entries.push_back(glm::uvec2(bucket, index));
+                }
+            }
+        }
+    }
+
+    if (overflow && !overflowReported) {
+        std::cerr << "Collider grid is full, some colliders are ignored" << std::endl;
+        overflowReported = true;
+    }
+
+    // Counting sort by bucket; colliders stay in id order within a bucket
+    for (glm::uvec2& bucket : grid->buckets) {
+        bucket = glm::uvec2(0);
+    }
+    for (const glm::uvec2& entry : entries) {
+        grid->buckets[entry.x].y++;
+    }
+    uint32_t offset = 0;
+    for (glm::uvec2& bucket : grid->buckets) {
+        bucket.x = offset;
+        offset += bucket.y;
+        bucket.y = 0;
+    }
+    for (const glm::uvec2& entry : entries) {
+        glm::uvec2& bucket = grid->buckets[entry.x];
+        grid->references[bucket.x + bucket.y++] = entry.y;
+    }
+
+    grid->colliderCount = count;
+    referenceCount = static_cast<uint32_t>(entries.size());
+}
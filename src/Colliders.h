@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+#include <array>
+#include <vector>
+#include "Device.h"
+#include "MemoryAllocator.h"
+#include "FramesInFlight.h"
+
+// Capsule pushing the grass: every point within radius of the segment [start, end]. A sphere is a
+// capsule whose ends coincide. Matches struct Collider in shaders/compute.comp.
+struct Collider {
+    // xyz = first end, w = radius
+    glm::vec4 start;
+    // xyz = second end, w unused
+    glm::vec4 end;
+
+    static Collider Sphere(const glm::vec3& center, float radius);
+    static Collider Capsule(const glm::vec3& start, const glm::vec3& end, float radius);
+};
+
+// Must match shaders/compute.comp. COLLIDER_TABLE_SIZE is a power of two.
+constexpr static uint32_t MAX_COLLIDERS = 256;
+constexpr static uint32_t COLLIDER_TABLE_SIZE = 4096;
+constexpr static uint32_t MAX_COLLIDER_REFERENCES = 16384;
+constexpr static float DEFAULT_COLLIDER_CELL_SIZE = 4.0f;
+
+// Bucket of the grid cell (x, z) in the hash table. Must match colliderBucket in shaders/compute.comp.
+inline uint32_t ColliderBucket(int32_t x, int32_t z) {
+    return (static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(z) * 19349663u) & (COLLIDER_TABLE_SIZE - 1);
+}
+
+// Contents of the collider buffer, laid out as the ColliderGrid block of shaders/compute.comp (std430)
+struct ColliderGridData {
+    uint32_t colliderCount;
+    float cellSize;
+    uint32_t pad0;
+    uint32_t pad1;
+    Collider colliders[MAX_COLLIDERS];
+    // Per bucket: first entry in references and entry count
+    glm::uvec2 buckets[COLLIDER_TABLE_SIZE];
+    // Indices into colliders, grouped by bucket
+    uint32_t references[MAX_COLLIDER_REFERENCES];
+};
+
+// The colliders of the scene, shared by every blade pool and tile, and a spatial hash over them.
+//
+// The xz plane is cut into square cells of cellSize. Each frame UpdateBuffer lists every collider under
+// each cell that a blade based in it could reach (the collider's bounds grown by MAX_BLADE_REACH), sorts
+// the lists into the buckets of a fixed-size hash table and copies the result into that frame's buffer.
+// A blade then only tests the colliders of its own cell's bucket, so its cost does not grow with the
+// number of colliders elsewhere. Cells sharing a bucket only cost a few extra (rejected) tests, and the
+// table never has to follow the camera.
+class Colliders {
+public:
+    Colliders(Device* device, float cellSize = DEFAULT_COLLIDER_CELL_SIZE);
+    ~Colliders();
+
+    // Adds a collider and returns its id; throws once MAX_COLLIDERS are in use. Changes reach the GPU with
+    // the next UpdateBuffer.
+    uint32_t Add(const Collider& collider);
+    void Set(uint32_t id, const Collider& collider);
+    const Collider& Get(uint32_t id) const;
+    // The id may be handed out again by a later Add
+    void Remove(uint32_t id);
+    // Colliders in use
+    uint32_t GetCount() const;
+
+    // Bins the colliders and copies the grid into the buffer of the given frame in flight. Colliders that
+    // would overflow MAX_COLLIDER_REFERENCES are left out for the frame.
+    void UpdateBuffer(uint32_t frame);
+
+    VkBuffer GetBuffer(uint32_t frame) const;
+    VkDeviceSize GetBufferSize() const;
+    // Cell references written by the last UpdateBuffer
+    uint32_t GetReferenceCount() const;
+
+private:
+    Device* device;
+    float cellSize;
+
+    std::vector<Collider> colliders;
+    std::vector<bool> used;
+    std::vector<uint32_t> freeIds;
+
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> buffers;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> bufferMemories;
+
+    // Binning scratch, kept between frames so steady-state frames do not allocate
+    ColliderGridData* grid;
+    // (bucket, collider) pairs, and the last collider added to each bucket
+    std::vector<glm::uvec2> entries;
+    std::vector<uint32_t> lastCollider;
+    uint32_t referenceCount = 0;
+    bool overflowReported = false;
+
+    void Bin();
+};
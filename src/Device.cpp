@@ -1,8 +1,10 @@
 #include "Device.h"
 #include "Instance.h"
+#include "MemoryAllocator.h"
 
-Device::Device(Instance* instance, VkDevice vkDevice, Queues queues)
-  : instance(instance), vkDevice(vkDevice), queues(queues) {
+Device::Device(Instance* instance, VkDevice vkDevice, Queues queues, VkPhysicalDeviceFeatures enabledFeatures)
+  : instance(instance), vkDevice(vkDevice), queues(queues), enabledFeatures(enabledFeatures) {
+    allocator = new MemoryAllocator(this);
 }
 
 Instance* Device::GetInstance() {
@@ -21,10 +23,19 @@ unsigned int Device::GetQueueIndex(QueueFlags flag) {
     return GetInstance()->GetQueueFamilyIndices()[flag];
 }
 
+const VkPhysicalDeviceFeatures& Device::GetEnabledFeatures() const {
+    return enabledFeatures;
+}
+
+MemoryAllocator* Device::GetAllocator() {
+    return allocator;
+}
+
 SwapChain* Device::CreateSwapChain(VkSurfaceKHR surface, unsigned int numBuffers) {
     return new SwapChain(this, surface, numBuffers);
 }
 
 Device::~Device() {
+    delete allocator;
     vkDestroyDevice(vkDevice, nullptr);
 }
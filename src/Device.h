@@ -6,7 +6,9 @@
 #include "QueueFlags.h"
 #include "SwapChain.h"
 
+class Instance;
 class SwapChain;
+class MemoryAllocator;
 class Device {
     friend class Instance;
 
@@ -16,15 +18,20 @@ public:
     VkDevice GetVkDevice();
     VkQueue GetQueue(QueueFlags flag);
     unsigned int GetQueueIndex(QueueFlags flag);
+    const VkPhysicalDeviceFeatures& GetEnabledFeatures() const;
+    // Sub-allocator every buffer and image of this device is bound through
+    MemoryAllocator* GetAllocator();
     ~Device();
 
 private:
     using Queues = std::array<VkQueue, sizeof(QueueFlags)>;
     
     Device() = delete;
-    Device(Instance* instance, VkDevice vkDevice, Queues queues);
+    Device(Instance* instance, VkDevice vkDevice, Queues queues, VkPhysicalDeviceFeatures enabledFeatures);
 
     Instance* instance;
     VkDevice vkDevice;
     Queues queues;
+    VkPhysicalDeviceFeatures enabledFeatures;
+    MemoryAllocator* allocator;
 };
@@ -0,0 +1,5 @@
+#pragma once
+
+// Number of frames the CPU may record and submit ahead of the GPU. Per-frame uniform buffers
+// (camera, time), their descriptor sets, command buffers and sync objects exist this many times.
+constexpr static unsigned int MAX_FRAMES_IN_FLIGHT = 2;
@@ -0,0 +1,292 @@
+#include "GpuProfiler.h"
+#include "Blades.h"
+#include "BufferUtils.h"
+#include "Instance.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+    constexpr uint32_t TIMESTAMP_COUNT = static_cast<uint32_t>(GpuTimestamp::Count);
+    constexpr uint32_t FIRST_GRAPHICS_TIMESTAMP = static_cast<uint32_t>(GpuTimestamp::GraphicsBegin);
+
+    // In the order the results come back in, lowest bit first
+    constexpr VkQueryPipelineStatisticFlags GRASS_STATISTICS =
+        VK_QUERY_PIPELINE_STATISTIC_TESSELLATION_EVALUATION_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+    uint64_t validBitsMask(uint32_t validBits) {
+        return validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    }
+
+    uint32_t visibleCount(const BladeDrawIndirect& draw) {
+#ifdef GRASS_CULL_INDICES
+        return draw.indexCount;
+#else
+        return draw.vertexCount;
+#endif
+    }
+}
+
+GpuProfiler::GpuProfiler(Device* device, size_t historySize) : device(device), history(historySize) {
+    if (historySize == 0) {
+        throw std::runtime_error("GpuProfiler needs room for at least one frame");
+    }
+
+    VkPhysicalDevice physicalDevice = device->GetInstance()->GetPhysicalDevice();
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+    uint32_t computeBits = families[device->GetQueueIndex(QueueFlags::Compute)].timestampValidBits;
+    uint32_t graphicsBits = families[device->GetQueueIndex(QueueFlags::Graphics)].timestampValidBits;
+    computeTimestamps = computeBits > 0;
+    graphicsTimestamps = graphicsBits > 0;
+    computeTimestampMask = validBitsMask(computeBits);
+    graphicsTimestampMask = validBitsMask(graphicsBits);
+    pipelineStatistics = device->GetEnabledFeatures().pipelineStatisticsQuery == VK_TRUE;
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VkQueryPoolCreateInfo timestampInfo = {};
+        timestampInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        timestampInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        timestampInfo.queryCount = TIMESTAMP_COUNT;
+
+        if (vkCreateQueryPool(device->GetVkDevice(), &timestampInfo, nullptr, &timestampPools[i]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create timestamp query pool");
+        }
+
+        if (pipelineStatistics) {
+            VkQueryPoolCreateInfo statisticsInfo = {};
+            statisticsInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            statisticsInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            statisticsInfo.queryCount = 1;
+            statisticsInfo.pipelineStatistics = GRASS_STATISTICS;
+
+            if (vkCreateQueryPool(device->GetVkDevice(), &statisticsInfo, nullptr, &statisticsPools[i]) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create pipeline statistics query pool");
+            }
+        }
+    }
+}
+
+GpuProfiler::~GpuProfiler() {
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroyQueryPool(device->GetVkDevice(), timestampPools[i], nullptr);
+        if (statisticsPools[i] != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(device->GetVkDevice(), statisticsPools[i], nullptr);
+        }
+        if (readbackBuffers[i] != VK_NULL_HANDLE) {
+            BufferUtils::DestroyBuffer(device, readbackBuffers[i], readbackBufferMemories[i]);
+        }
+    }
+}
+
+void GpuProfiler::CmdResetCompute(VkCommandBuffer commandBuffer, uint32_t frame) {
+    // The two queues reset disjoint ranges of the same pool
+    vkCmdResetQueryPool(commandBuffer, timestampPools[frame], 0, FIRST_GRAPHICS_TIMESTAMP);
+}
+
+void GpuProfiler::CmdResetGraphics(VkCommandBuffer commandBuffer, uint32_t frame) {
+    vkCmdResetQueryPool(commandBuffer, timestampPools[frame], FIRST_GRAPHICS_TIMESTAMP, TIMESTAMP_COUNT - FIRST_GRAPHICS_TIMESTAMP);
+    if (pipelineStatistics) {
+        vkCmdResetQueryPool(commandBuffer, statisticsPools[frame], 0, 1);
+    }
+}
+
+void GpuProfiler::CmdTimestamp(VkCommandBuffer commandBuffer, uint32_t frame, GpuTimestamp point) {
+    uint32_t query = static_cast<uint32_t>(point);
+    if (query < FIRST_GRAPHICS_TIMESTAMP ? !computeTimestamps : !graphicsTimestamps) {
+        return;
+    }
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPools[frame], query);
+}
+
+void GpuProfiler::CmdBeginGrassStatistics(VkCommandBuffer commandBuffer, uint32_t frame) {
+    if (pipelineStatistics) {
+        vkCmdBeginQuery(commandBuffer, statisticsPools[frame], 0, 0);
+    }
+}
+
+void GpuProfiler::CmdEndGrassStatistics(VkCommandBuffer commandBuffer, uint32_t frame) {
+    if (pipelineStatistics) {
+        vkCmdEndQuery(commandBuffer, statisticsPools[frame], 0);
+    }
+}
+
+void GpuProfiler::CmdReadBladeCounts(VkCommandBuffer commandBuffer, uint32_t frame, const std::vector<Blades*>& pools) {
+    VkDeviceSize size = 0;
+    uint32_t tileCount = 0;
+    for (Blades* blades : pools) {
+        size += blades->GetNumBladesBufferSize();
+        tileCount += blades->GetTileCapacity();
+    }
+    readbackTileCounts[frame] = tileCount;
+    if (size == 0) {
+        return;
+    }
+
+    if (size > readbackSizes[frame]) {
+        if (readbackBuffers[frame] != VK_NULL_HANDLE) {
+            BufferUtils::DestroyBuffer(device, readbackBuffers[frame], readbackBufferMemories[frame]);
+        }
+        BufferUtils::CreateBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            readbackBuffers[frame], readbackBufferMemories[frame]);
+        readbackSizes[frame] = size;
+    }
+
+    // The draws only read the arguments, so the copy needs no barrier before it
+    VkDeviceSize offset = 0;
+    for (Blades* blades : pools) {
+        VkBufferCopy copyRegion = {};
+        copyRegion.srcOffset = 0;
+        copyRegion.dstOffset = offset;
+        copyRegion.size = blades->GetNumBladesBufferSize();
+        vkCmdCopyBuffer(commandBuffer, blades->GetNumBladesBuffer(frame), readbackBuffers[frame], 1, &copyRegion);
+        offset += copyRegion.size;
+    }
+
+    VkBufferMemoryBarrier hostBarrier = {};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.buffer = readbackBuffers[frame];
+    hostBarrier.offset = 0;
+    hostBarrier.size = size;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &hostBarrier, 0, nullptr);
+}
+
+void GpuProfiler::MarkSubmitted(uint32_t frame, uint64_t frameNumber) {
+    pending[frame] = true;
+    pendingFrameNumbers[frame] = frameNumber;
+}
+
+void GpuProfiler::Collect(uint32_t frame) {
+    if (!pending[frame]) {
+        return;
+    }
+    pending[frame] = false;
+
+    GpuFrameStats& stats = history[next];
+    stats = GpuFrameStats();
+    stats.frame = pendingFrameNumbers[frame];
+
+    // The fence was waited on, so everything is available; NOT_READY would mean a query was never written
+    std::array<uint64_t, TIMESTAMP_COUNT> timestamps;
+    if (vkGetQueryPoolResults(device->GetVkDevice(), timestampPools[frame], 0, TIMESTAMP_COUNT, sizeof(timestamps), timestamps.data(),
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        auto at = [&](GpuTimestamp point) { return timestamps[static_cast<uint32_t>(point)]; };
+        if (computeTimestamps) {
+            stats.trampleMs = ElapsedMs(at(GpuTimestamp::ComputeBegin), at(GpuTimestamp::TrampleEnd), computeTimestampMask);
+            stats.simulationMs = ElapsedMs(at(GpuTimestamp::TrampleEnd), at(GpuTimestamp::ComputeEnd), computeTimestampMask);
+        }
+        if (graphicsTimestamps) {
+            stats.terrainMs = ElapsedMs(at(GpuTimestamp::GraphicsBegin), at(GpuTimestamp::TerrainEnd), graphicsTimestampMask);
+            stats.grassMs = ElapsedMs(at(GpuTimestamp::TerrainEnd), at(GpuTimestamp::GrassEnd), graphicsTimestampMask);
+        }
+    }
+
+    if (pipelineStatistics) {
+        std::array<uint64_t, 2> statistics;
+        if (vkGetQueryPoolResults(device->GetVkDevice(), statisticsPools[frame], 0, 1, sizeof(statistics), statistics.data(),
+            sizeof(statistics), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            stats.tessEvaluationInvocations = statistics[0];
+            stats.fragmentInvocations = statistics[1];
+        }
+    }
+
+    if (readbackBuffers[frame] != VK_NULL_HANDLE) {
+        const BladeDrawIndirect* draws = static_cast<const BladeDrawIndirect*>(readbackBufferMemories[frame].mapped);
+        stats.visibleBladesPerTile.resize(readbackTileCounts[frame]);
+        for (uint32_t tile = 0; tile < readbackTileCounts[frame]; tile++) {
+            stats.visibleBladesPerTile[tile] = visibleCount(draws[tile]);
+            stats.visibleBlades += stats.visibleBladesPerTile[tile];
+        }
+    }
+
+    next = (next + 1) % history.size();
+    count = std::min(count + 1, history.size());
+}
+
+bool GpuProfiler::HasTimestamps() const {
+    return computeTimestamps || graphicsTimestamps;
+}
+
+bool GpuProfiler::HasPipelineStatistics() const {
+    return pipelineStatistics;
+}
+
+std::vector<GpuFrameStats> GpuProfiler::GetHistory() const {
+    std::vector<GpuFrameStats> frames;
+    frames.reserve(count);
+    size_t oldest = (next + history.size() - count) % history.size();
+    for (size_t i = 0; i < count; i++) {
+        frames.push_back(history[(oldest + i) % history.size()]);
+    }
+    return frames;
+}
+
+const GpuFrameStats* GpuProfiler::GetLatest() const {
+    return count == 0 ? nullptr : &history[(next + history.size() - 1) % history.size()];
+}
+
+bool GpuProfiler::WriteCsv(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Failed to write GPU profile " << path << std::endl;
+        return false;
+    }
+
+    file << "frame,trample_ms,simulation_ms,terrain_ms,grass_ms,tess_eval_invocations,fragment_invocations,visible_blades\n";
+    for (const GpuFrameStats& stats : GetHistory()) {
+        file << stats.frame << ',' << stats.trampleMs << ',' << stats.simulationMs << ',' << stats.terrainMs << ',' << stats.grassMs << ','
+            << stats.tessEvaluationInvocations << ',' << stats.fragmentInvocations << ',' << stats.visibleBlades << '\n';
+    }
+    return true;
+}
+
+bool GpuProfiler::WriteJson(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Failed to write GPU profile " << path << std::endl;
+        return false;
+    }
+
+    file << "{\n  \"timestampPeriodNs\": " << timestampPeriod << ",\n  \"frames\": [";
+    std::vector<GpuFrameStats> frames = GetHistory();
+    for (size_t i = 0; i < frames.size(); i++) {
+        const GpuFrameStats& stats = frames[i];
+        file << (i == 0 ? "\n" : ",\n")
+            << "    { \"frame\": " << stats.frame
+            << ", \"trampleMs\": " << stats.trampleMs
+            << ", \"simulationMs\": " << stats.simulationMs
+            << ", \"terrainMs\": " << stats.terrainMs
+            << ", \"grassMs\": " << stats.grassMs
+            << ", \"tessEvaluationInvocations\": " << stats.tessEvaluationInvocations
+            << ", \"fragmentInvocations\": " << stats.fragmentInvocations
+            << ", \"visibleBlades\": " << stats.visibleBlades
+            << ", \"visibleBladesPerTile\": [";
+        for (size_t tile = 0; tile < stats.visibleBladesPerTile.size(); tile++) {
+            file << (tile == 0 ? "" : ", ") << stats.visibleBladesPerTile[tile];
+        }
+        file << "] }";
+    }
+    file << "\n  ]\n}\n";
+    return true;
+}
+
+float GpuProfiler::ElapsedMs(uint64_t begin, uint64_t end, uint64_t mask) const {
+    // Masked, so a counter that wrapped between the two still gives the right difference
+    uint64_t ticks = ((end & mask) - (begin & mask)) & mask;
+    return static_cast<float>(static_cast<double>(ticks) * timestampPeriod * 1e-6);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <array>
+#include <string>
+#include <vector>
+#include "Device.h"
+#include "MemoryAllocator.h"
+#include "FramesInFlight.h"
+
+class Blades;
+
+// Frames of GpuFrameStats kept by default
+constexpr static size_t DEFAULT_PROFILER_HISTORY = 1024;
+
+// Points of a frame's command buffers that get a timestamp. The compute ones are written on the compute
+// queue and the graphics ones on the graphics queue; timestamps are only compared within a queue.
+enum class GpuTimestamp : uint32_t {
+    ComputeBegin,
+    TrampleEnd,
+    ComputeEnd,
+    GraphicsBegin,
+    TerrainEnd,
+    GrassEnd,
+    Count
+};
+
+// What the GPU did in one frame. Times are -1 where the queue has no timestamp support, invocation counts
+// 0 without the pipelineStatisticsQuery feature.
+struct GpuFrameStats {
+    uint64_t frame = 0;
+
+    // Compute queue: the trample pass, then cluster culling and simulation of every blade pool
+    float trampleMs = -1.0f;
+    float simulationMs = -1.0f;
+    // Graphics queue: the terrain draws, then the grass draws
+    float terrainMs = -1.0f;
+    float grassMs = -1.0f;
+
+    // Grass pass
+    uint64_t tessEvaluationInvocations = 0;
+    uint64_t fragmentInvocations = 0;
+
+    // Blades drawn, in total and per tile slot (every slot of the first pool, then of the next...)
+    uint32_t visibleBlades = 0;
+    std::vector<uint32_t> visibleBladesPerTile;
+};
+
+// GPU timings, pipeline statistics and visible blade counts of every frame, without stalling.
+//
+// Each frame in flight has its own queries and readback buffer, written by that slot's command buffers
+// and read back by Collect once the slot's fence has been waited on, so results arrive
+// MAX_FRAMES_IN_FLIGHT frames late and the GPU never waits for the CPU. Collected frames go into a ring
+// of the last historySize frames, which can be written out as CSV or JSON.
+class GpuProfiler {
+public:
+    GpuProfiler(Device* device, size_t historySize = DEFAULT_PROFILER_HISTORY);
+    ~GpuProfiler();
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+    // --- Recording, into the command buffers of frame slot `frame` ---
+    // Reset the slot's queries of one queue. Outside any render pass, before the queue's first timestamp.
+    void CmdResetCompute(VkCommandBuffer commandBuffer, uint32_t frame);
+    void CmdResetGraphics(VkCommandBuffer commandBuffer, uint32_t frame);
+    // Written once all previously recorded work has completed
+    void CmdTimestamp(VkCommandBuffer commandBuffer, uint32_t frame, GpuTimestamp point);
+    // Around the grass draws
+    void CmdBeginGrassStatistics(VkCommandBuffer commandBuffer, uint32_t frame);
+    void CmdEndGrassStatistics(VkCommandBuffer commandBuffer, uint32_t frame);
+    // Copies the indirect draw arguments of every pool to the host. After the grass draws, outside the
+    // render pass. May reallocate the slot's readback buffer, so the slot must not be pending.
+    void CmdReadBladeCounts(VkCommandBuffer commandBuffer, uint32_t frame, const std::vector<Blades*>& pools);
+
+    // --- Host ---
+    // The slot's command buffers were submitted as frame number frameNumber
+    void MarkSubmitted(uint32_t frame, uint64_t frameNumber);
+    // Reads back what the slot last submitted, if anything, into the history. Call after waiting on the
+    // slot's fence, before submitting it again.
+    void Collect(uint32_t frame);
+
+    bool HasTimestamps() const;
+    bool HasPipelineStatistics() const;
+
+    // Oldest first
+    std::vector<GpuFrameStats> GetHistory() const;
+    // nullptr until a frame was collected
+    const GpuFrameStats* GetLatest() const;
+
+    // One row / object per frame of the history. Return false if the file could not be written.
+    bool WriteCsv(const std::string& path) const;
+    bool WriteJson(const std::string& path) const;
+
+private:
+    Device* device;
+
+    bool computeTimestamps;
+    bool graphicsTimestamps;
+    bool pipelineStatistics;
+    // Nanoseconds per timestamp tick, and the bits of a timestamp that are valid on each queue
+    float timestampPeriod;
+    uint64_t computeTimestampMask;
+    uint64_t graphicsTimestampMask;
+
+    std::array<VkQueryPool, MAX_FRAMES_IN_FLIGHT> timestampPools = {};
+    std::array<VkQueryPool, MAX_FRAMES_IN_FLIGHT> statisticsPools = {};
+
+    // BladeDrawIndirect of every tile of every pool, as of the slot's last grass pass
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> readbackBuffers = {};
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> readbackBufferMemories = {};
+    std::array<VkDeviceSize, MAX_FRAMES_IN_FLIGHT> readbackSizes = {};
+    std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> readbackTileCounts = {};
+
+    std::array<bool, MAX_FRAMES_IN_FLIGHT> pending = {};
+    std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> pendingFrameNumbers = {};
+
+    // Ring of the last history.size() frames; next is the slot the next frame goes to
+    std::vector<GpuFrameStats> history;
+    size_t next = 0;
+    size_t count = 0;
+
+    float ElapsedMs(uint64_t begin, uint64_t end, uint64_t mask) const;
+};
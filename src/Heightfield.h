@@ -0,0 +1,130 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Ray queries against grids of height samples (terrain tiles, and the grid of tiles itself)
+namespace Heightfield {
+    // Walks the cells of a 2D grid that the ray origin + t * direction crosses for t in [tMin, tMax], in
+    // order (Amanatides & Woo). Cell c covers [c * cellSize, (c + 1) * cellSize) of the grid's frame, which
+    // has its origin at the grid's corner; there are cellCount cells per axis. visit(cell, tEnter, tExit)
+    // returns true to stop the walk, which then returns true as well.
+    template <typename Visit>
+    bool TraverseGrid(const glm::vec2& origin, const glm::vec2& direction, float tMin, float tMax,
+        float cellSize, const glm::ivec2& cellCount, Visit&& visit) {
+        // Clip the ray to the grid
+        glm::vec2 extent = glm::vec2(cellCount) * cellSize;
+        for (int axis = 0; axis < 2; axis++) {
+            if (direction[axis] == 0.0f) {
+                if (origin[axis] < 0.0f || origin[axis] > extent[axis]) {
+                    return false;
+                }
+                continue;
+            }
+            float t0 = -origin[axis] / direction[axis];
+            float t1 = (extent[axis] - origin[axis]) / direction[axis];
+            tMin = std::max(tMin, std::min(t0, t1));
+            tMax = std::min(tMax, std::max(t0, t1));
+        }
+        if (tMin > tMax) {
+            return false;
+        }
+
+        const float infinity = std::numeric_limits<float>::infinity();
+        glm::vec2 start = origin + direction * tMin;
+        glm::ivec2 cell = glm::clamp(glm::ivec2(glm::floor(start / cellSize)), glm::ivec2(0), cellCount - 1);
+
+        glm::ivec2 step;
+        glm::vec2 tNext, tDelta;
+        for (int axis = 0; axis < 2; axis++) {
+            if (direction[axis] == 0.0f) {
+                step[axis] = 0;
+                tNext[axis] = infinity;
+                tDelta[axis] = infinity;
+                continue;
+            }
+            step[axis] = direction[axis] > 0.0f ? 1 : -1;
+            float boundary = (cell[axis] + (step[axis] > 0 ? 1 : 0)) * cellSize;
+            tNext[axis] = (boundary - origin[axis]) / direction[axis];
+            tDelta[axis] = cellSize / std::abs(direction[axis]);
+        }
+
+        float t = tMin;
+        while (true) {
+            float tExit = std::min(std::min(tNext.x, tNext.y), tMax);
+            if (visit(cell, t, std::max(t, tExit))) {
+                return true;
+            }
+            if (tExit >= tMax) {
+                return false;
+            }
+
+            int axis = tNext.x < tNext.y ? 0 : 1;
+            cell[axis] += step[axis];
+            t = tNext[axis];
+            tNext[axis] += tDelta[axis];
+            if (cell[axis] < 0 || cell[axis] >= cellCount[axis]) {
+                return false;
+            }
+        }
+    }
+
+    // First t in [tEnter, tExit] where the ray goes below the bilinear patch through the corner heights
+    // h00 (u = 0, v = 0), h10, h01, h11. The ray is given in the patch's unit square at tEnter: (u, v) and
+    // height y, changing by (du, dv) and dy per unit of t. Exact: along the ray the height difference is a
+    // quadratic in t.
+    inline bool IntersectBilinearPatch(float h00, float h10, float h01, float h11,
+        float u, float v, float y, float du, float dv, float dy, float tEnter, float tExit, float& tHit) {
+        // h(u, v) = a + b u + c v + d u v
+        double a = h00;
+        double b = h10 - h00;
+        double c = h01 - h00;
+        double d = h00 - h10 - h01 + h11;
+
+        // y(s) - h(u(s), v(s)) = A s^2 + B s + C with s = t - tEnter
+        double A = -d * du * dv;
+        double B = dy - (b * du + c * dv + d * (static_cast<double>(u) * dv + static_cast<double>(v) * du));
+        double C = y - (a + b * u + c * v + d * u * v);
+        double length = static_cast<double>(tExit) - tEnter;
+
+        if (C <= 0.0) {
+            // Already below the surface where the ray enters the cell
+            tHit = tEnter;
+            return true;
+        }
+
+        double s = std::numeric_limits<double>::infinity();
+        if (std::abs(A) < 1e-12) {
+            if (B < 0.0) {
+                s = -C / B;
+            }
+        }
+        else {
+            double discriminant = B * B - 4.0 * A * C;
+            if (discriminant >= 0.0) {
+                // Numerically stable pair of roots
+                double q = -0.5 * (B + std::copysign(std::sqrt(discriminant), B));
+                double roots[2] = { q / A, q != 0.0 ? C / q : std::numeric_limits<double>::infinity() };
+                for (double root : roots) {
+                    if (root >= 0.0 && root < s) {
+                        s = root;
+                    }
+                }
+            }
+        }
+
+        if (s > length) {
+            // Rounding can lose a root right at the exit
+            double end = (A * length + B) * length + C;
+            if (end > 0.0) {
+                return false;
+            }
+            s = length;
+        }
+
+        tHit = static_cast<float>(tEnter + s);
+        return true;
+    }
+}
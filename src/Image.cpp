@@ -5,8 +5,9 @@
 #include "Device.h"
 #include "Instance.h"
 #include "BufferUtils.h"
+#include "UploadBatcher.h"
 
-void Image::Create(Device* device, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+void Image::Create(Device* device, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory) {
     // Create Vulkan image
     VkImageCreateInfo imageInfo = {};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -27,21 +28,19 @@ void Image::Create(Device* device, uint32_t width, uint32_t height, VkFormat for
         throw std::runtime_error("Failed to create image");
     }
 
-    // Allocate memory for the image
+    // Sub-allocate memory for the image; optimal images are kept apart from linear resources
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device->GetVkDevice(), image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = device->GetInstance()->GetMemoryTypeIndex(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device->GetVkDevice(), &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate image memory");
-    }
+    imageMemory = device->GetAllocator()->Allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR);
 
     // Bind the image
-    vkBindImageMemory(device->GetVkDevice(), image, imageMemory, 0);
+    vkBindImageMemory(device->GetVkDevice(), image, imageMemory.memory, imageMemory.offset);
+}
+
+void Image::Destroy(Device* device, VkImage image, MemoryAllocation& imageMemory) {
+    vkDestroyImage(device->GetVkDevice(), image, nullptr);
+    device->GetAllocator()->Free(imageMemory);
 }
 
 void Image::TransitionLayout(Device* device, VkCommandPool commandPool, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout) {
@@ -194,7 +193,7 @@ void Image::CopyFromBuffer(Device* device, VkCommandPool commandPool, VkBuffer b
     vkFreeCommandBuffers(device->GetVkDevice(), commandPool, 1, &commandBuffer);
 }
 
-void Image::FromFile(Device* device, VkCommandPool commandPool, const char* path, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+void Image::FromFile(Device* device, UploadBatcher* uploader, const char* path, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory) {
     int texWidth, texHeight, texChannels;
     stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
     VkDeviceSize imageSize = texWidth * texHeight * 4;
@@ -203,35 +202,13 @@ void Image::FromFile(Device* device, VkCommandPool commandPool, const char* path
         throw std::runtime_error("Failed to load texture image");
     }
 
-    // Create staging buffer
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    VkMemoryPropertyFlags stagingProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    BufferUtils::CreateBuffer(device, imageSize, stagingUsage, stagingProperties, stagingBuffer, stagingBufferMemory);
-
-    // Copy pixel values to the buffer
-    void* data;
-    vkMapMemory(device->GetVkDevice(), stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device->GetVkDevice(), stagingBufferMemory);
-
-    // Free pixel array
-    stbi_image_free(pixels);
-
     // Create Vulkan image
     Image::Create(device, texWidth, texHeight, format, tiling, VK_IMAGE_USAGE_TRANSFER_DST_BIT | usage, properties, image, imageMemory);
 
-    // Copy the staging buffer to the texture image
-    // --> First need to transition the texture image to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-    Image::TransitionLayout(device, commandPool, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    Image::CopyFromBuffer(device, commandPool, stagingBuffer, image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+    // Stage the pixels and record the layout transitions around the copy; the uploader copies the pixels
+    // into its staging memory, so the array can be freed right away
+    uploader->UploadImage(pixels, imageSize, image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), layout);
 
-    // Transition texture image for shader access
-    Image::TransitionLayout(device, commandPool, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout);
-
-    // No need for staging buffer anymore
-    vkDestroyBuffer(device->GetVkDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), stagingBufferMemory, nullptr);
+    // Free pixel array
+    stbi_image_free(pixels);
 }
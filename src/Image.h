@@ -2,12 +2,18 @@
 
 #include <vulkan/vulkan.h>
 #include "Device.h"
+#include "MemoryAllocator.h"
+
+class UploadBatcher;
 
 namespace Image {
 
-    void Create(Device* device, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+    // Creates the image and binds it to a range of the device's MemoryAllocator. Release with Destroy.
+    void Create(Device* device, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory);
+    void Destroy(Device* device, VkImage image, MemoryAllocation& imageMemory);
     void TransitionLayout(Device* device, VkCommandPool commandPool, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
     VkImageView CreateView(Device* device, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
     void CopyFromBuffer(Device* device, VkCommandPool commandPool, VkBuffer buffer, VkImage& image, uint32_t width, uint32_t height);
-    void FromFile(Device* device, VkCommandPool commandPool, const char* path, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+    // Queues the upload of the texels on the uploader; the image is in place after its next Flush
+    void FromFile(Device* device, UploadBatcher* uploader, const char* path, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageLayout layout, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory);
 }
@@ -215,6 +215,18 @@ namespace {
             i++;
         }
 
+        // Prefer a compute-only family when the device has one: its queue runs the grass simulation
+        // of the next frame alongside the graphics queue drawing the current one
+        if (requiredQueues[QueueFlags::Compute]) {
+            for (uint32_t family = 0; family < queueFamilyCount; ++family) {
+                const VkQueueFamilyProperties& properties = queueFamilies[family];
+                if (properties.queueCount > 0 && (properties.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(properties.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                    indices[QueueFlags::Compute] = static_cast<int>(family);
+                    break;
+                }
+            }
+        }
+
         return indices;
     }
 
@@ -357,7 +369,7 @@ Device* Instance::CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFea
         }
     }
 
-    return new Device(this, vkDevice, queues);
+    return new Device(this, vkDevice, queues, deviceFeatures);
 }
 
 Instance::~Instance() {
@@ -0,0 +1,248 @@
+#include "MemoryAllocator.h"
+#include "Device.h"
+#include "Instance.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    std::string describeProperties(VkMemoryPropertyFlags flags) {
+        std::string description;
+        auto add = [&](VkMemoryPropertyFlags bit, const char* name) {
+            if (flags & bit) {
+                description += description.empty() ? name : std::string("|") + name;
+            }
+        };
+        add(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "DEVICE_LOCAL");
+        add(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, "HOST_VISIBLE");
+        add(VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, "HOST_COHERENT");
+        add(VK_MEMORY_PROPERTY_HOST_CACHED_BIT, "HOST_CACHED");
+        return description.empty() ? "NONE" : description;
+    }
+}
+
+MemoryAllocator::MemoryAllocator(Device* device, VkDeviceSize blockSize)
+    : device(device), blockSize(blockSize) {
+    VkPhysicalDevice physicalDevice = device->GetInstance()->GetPhysicalDevice();
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    // Anything still allocated belongs to resources that were never destroyed; release the blocks anyway
+    for (Pool& pool : pools) {
+        for (Block& block : pool.blocks) {
+            if (block.memory != VK_NULL_HANDLE) {
+                vkFreeMemory(device->GetVkDevice(), block.memory, nullptr);
+            }
+        }
+    }
+}
+
+MemoryAllocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear) {
+    uint32_t memoryType = device->GetInstance()->GetMemoryTypeIndex(requirements.memoryTypeBits, properties);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t poolIndex;
+    Pool& pool = GetPool(memoryType, linear, poolIndex);
+
+    // Small heaps (e.g. a 256 MB device-local, host-visible window) get proportionally smaller blocks
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    VkDeviceSize poolBlockSize = std::min(blockSize, std::max<VkDeviceSize>(heapSize / 8, 1024 * 1024));
+
+    VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+    VkDeviceSize offset = 0;
+    uint32_t blockIndex = UINT32_MAX;
+
+    if (requirements.size > poolBlockSize / 2) {
+        // Dedicated block, sized to the resource
+        blockIndex = CreateBlock(pool, requirements.size);
+        AllocateFromBlock(pool.blocks[blockIndex], requirements.size, alignment, offset);
+    } else {
+        for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+            Block& block = pool.blocks[i];
+            if (block.memory != VK_NULL_HANDLE && block.size == poolBlockSize
+                && AllocateFromBlock(block, requirements.size, alignment, offset)) {
+                blockIndex = i;
+                break;
+            }
+        }
+
+        if (blockIndex == UINT32_MAX) {
+            blockIndex = CreateBlock(pool, poolBlockSize);
+            AllocateFromBlock(pool.blocks[blockIndex], requirements.size, alignment, offset);
+        }
+    }
+
+    Block& block = pool.blocks[blockIndex];
+    MemoryAllocation allocation;
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.size = requirements.size;
+    allocation.mapped = block.mapped != nullptr ? block.mapped + offset : nullptr;
+    allocation.pool = poolIndex;
+    allocation.block = blockIndex;
+    return allocation;
+}
+
+void MemoryAllocator::Free(MemoryAllocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Block& block = pools[allocation.pool].blocks[allocation.block];
+
+    // Insert the range and merge it with its neighbours
+    Range freed = { allocation.offset, allocation.size };
+    auto next = std::lower_bound(block.freeRanges.begin(), block.freeRanges.end(), freed.offset,
+        [](const Range& range, VkDeviceSize offset) { return range.offset < offset; });
+    if (next != block.freeRanges.end() && freed.offset + freed.size == next->offset) {
+        freed.size += next->size;
+        next = block.freeRanges.erase(next);
+    }
+    if (next != block.freeRanges.begin()) {
+        auto previous = next - 1;
+        if (previous->offset + previous->size == freed.offset) {
+            previous->size += freed.size;
+            freed.size = 0;
+        }
+    }
+    if (freed.size > 0) {
+        block.freeRanges.insert(next, freed);
+    }
+
+    block.used -= allocation.size;
+    block.allocationCount--;
+
+    if (block.allocationCount == 0) {
+        vkFreeMemory(device->GetVkDevice(), block.memory, nullptr);
+        block = Block();
+        deviceAllocationCount--;
+    }
+
+    allocation = MemoryAllocation();
+}
+
+void MemoryAllocator::DumpStats(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    out << "Device memory: " << deviceAllocationCount << " allocations (limit " << maxAllocationCount << ")" << std::endl;
+    for (const Pool& pool : pools) {
+        uint32_t blocks = 0;
+        uint32_t resources = 0;
+        size_t freeRanges = 0;
+        VkDeviceSize reserved = 0;
+        VkDeviceSize used = 0;
+        VkDeviceSize largestFree = 0;
+
+        for (const Block& block : pool.blocks) {
+            if (block.memory == VK_NULL_HANDLE) {
+                continue;
+            }
+            blocks++;
+            resources += block.allocationCount;
+            reserved += block.size;
+            used += block.used;
+            freeRanges += block.freeRanges.size();
+            for (const Range& range : block.freeRanges) {
+                largestFree = std::max(largestFree, range.size);
+            }
+        }
+        if (blocks == 0) {
+            continue;
+        }
+
+        // Share of the free space that is not in the largest free range (0 = one contiguous hole)
+        VkDeviceSize totalFree = reserved - used;
+        float fragmentation = totalFree > 0 ? 1.0f - static_cast<float>(largestFree) / totalFree : 0.0f;
+
+        out << "  type " << pool.memoryType << " " << describeProperties(memoryProperties.memoryTypes[pool.memoryType].propertyFlags)
+            << (pool.linear ? " linear" : " optimal")
+            << ": " << blocks << " blocks, " << resources << " resources, "
+            << used / 1024 << " / " << reserved / 1024 << " KiB used, "
+            << freeRanges << " free ranges (largest " << largestFree / 1024 << " KiB), "
+            << "fragmentation " << fragmentation * 100.0f << "%" << std::endl;
+    }
+}
+
+MemoryAllocator::Pool& MemoryAllocator::GetPool(uint32_t memoryType, bool linear, uint32_t& poolIndex) {
+    for (uint32_t i = 0; i < pools.size(); i++) {
+        if (pools[i].memoryType == memoryType && pools[i].linear == linear) {
+            poolIndex = i;
+            return pools[i];
+        }
+    }
+
+    poolIndex = static_cast<uint32_t>(pools.size());
+    pools.push_back({ memoryType, linear, {} });
+    return pools.back();
+}
+
+bool MemoryAllocator::AllocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+    for (size_t i = 0; i < block.freeRanges.size(); i++) {
+        Range range = block.freeRanges[i];
+        VkDeviceSize aligned = alignUp(range.offset, alignment);
+        if (aligned + size > range.offset + range.size) {
+            continue;
+        }
+
+        // The padding before the allocation and the tail after it stay free
+        Range before = { range.offset, aligned - range.offset };
+        Range after = { aligned + size, range.offset + range.size - (aligned + size) };
+        block.freeRanges.erase(block.freeRanges.begin() + i);
+        if (after.size > 0) {
+            block.freeRanges.insert(block.freeRanges.begin() + i, after);
+        }
+        if (before.size > 0) {
+            block.freeRanges.insert(block.freeRanges.begin() + i, before);
+        }
+
+        offset = aligned;
+        block.used += size;
+        block.allocationCount++;
+        return true;
+    }
+    return false;
+}
+
+uint32_t MemoryAllocator::CreateBlock(Pool& pool, VkDeviceSize size) {
+    if (deviceAllocationCount >= maxAllocationCount) {
+        throw std::runtime_error("Out of device memory allocations");
+    }
+
+    Block block;
+    block.size = size;
+    block.freeRanges.push_back({ 0, size });
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = pool.memoryType;
+
+    if (vkAllocateMemory(device->GetVkDevice(), &allocInfo, nullptr, &block.memory) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate device memory block");
+    }
+    deviceAllocationCount++;
+
+    if (memoryProperties.memoryTypes[pool.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vkMapMemory(device->GetVkDevice(), block.memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&block.mapped));
+    }
+
+    for (uint32_t i = 0; i < pool.blocks.size(); i++) {
+        if (pool.blocks[i].memory == VK_NULL_HANDLE) {
+            pool.blocks[i] = std::move(block);
+            return i;
+        }
+    }
+    pool.blocks.push_back(std::move(block));
+    return static_cast<uint32_t>(pool.blocks.size() - 1);
+}
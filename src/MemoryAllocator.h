@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+class Device;
+
+// A range of a device memory block handed out by MemoryAllocator. Resources bind to memory at offset;
+// mapped points at the range when the memory is host visible (blocks stay mapped for their lifetime).
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* mapped = nullptr;
+
+    uint32_t pool = 0;
+    uint32_t block = 0;
+};
+
+// Sub-allocates buffers and images out of large vkAllocateMemory blocks instead of one allocation per
+// resource, keeping well below maxMemoryAllocationCount and off the driver's allocation path.
+//
+// There is one pool per memory type and resource kind: linear resources (buffers, linear images) and
+// optimal images never share a block, so bufferImageGranularity does not have to be honoured between
+// neighbours. Each block keeps a sorted first-fit free list that merges ranges as they are freed; empty
+// blocks are returned to the driver. Requests larger than half a block get a block of their own.
+class MemoryAllocator {
+public:
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
+    MemoryAllocator(Device* device, VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+    ~MemoryAllocator();
+
+    MemoryAllocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+    void Free(MemoryAllocation& allocation);
+
+    // Blocks, bytes used and fragmentation of every pool
+    void DumpStats(std::ostream& out) const;
+
+private:
+    struct Range {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        VkDeviceSize used = 0;
+        char* mapped = nullptr;
+        uint32_t allocationCount = 0;
+        // Sorted by offset, never adjacent
+        std::vector<Range> freeRanges;
+    };
+
+    struct Pool {
+        uint32_t memoryType;
+        bool linear;
+        // Freed blocks leave a VK_NULL_HANDLE slot that the next new block reuses, so indices stay stable
+        std::vector<Block> blocks;
+    };
+
+    Device* device;
+    VkDeviceSize blockSize;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    uint32_t maxAllocationCount;
+
+    std::vector<Pool> pools;
+    uint32_t deviceAllocationCount = 0;
+    mutable std::mutex mutex;
+
+    Pool& GetPool(uint32_t memoryType, bool linear, uint32_t& poolIndex);
+    bool AllocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+    uint32_t CreateBlock(Pool& pool, VkDeviceSize size);
+};
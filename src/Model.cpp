@@ -2,40 +2,45 @@
 #include "BufferUtils.h"
 #include "Image.h"
 
-Model::Model(Device* device, VkCommandPool commandPool, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+Model::Model(Device* device, UploadBatcher* uploader, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
     : device(device), vertices(vertices), indices(indices){
 
     if (vertices.size() > 0) {
-        BufferUtils::CreateBufferFromData(device, commandPool, this->vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+        BufferUtils::CreateBufferFromData(device, uploader, this->vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
     }
 
+    indexCount = static_cast<uint32_t>(indices.size());
     if (indices.size() > 0) {
-        BufferUtils::CreateBufferFromData(device, commandPool, this->indices.data(), indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
+        BufferUtils::CreateBufferFromData(device, uploader, this->indices.data(), indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
     }
 
 
+    if (vertices.size() > 0) {
+        boundsMin = boundsMax = vertices[0].pos;
+        for (const Vertex& vertex : vertices) {
+            boundsMin = glm::min(boundsMin, vertex.pos);
+            boundsMax = glm::max(boundsMax, vertex.pos);
+        }
+    }
+
     modelBufferObject.modelMatrix = glm::mat4(1.0f);
     modelBufferObject.transform = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
 
     BufferUtils::CreateBuffer(device, sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, modelBuffer, modelBufferMemory);
-    vkMapMemory(device->GetVkDevice(), modelBufferMemory, 0, sizeof(ModelBufferObject), 0, &modelUBOData);
+    modelUBOData = modelBufferMemory.mapped;
     memcpy(modelUBOData, &modelBufferObject, sizeof(ModelBufferObject));
 }
 
 Model::~Model() {
     if (indices.size() > 0) {
-        vkDestroyBuffer(device->GetVkDevice(), indexBuffer, nullptr);
-        vkFreeMemory(device->GetVkDevice(), indexBufferMemory, nullptr);
+        BufferUtils::DestroyBuffer(device, indexBuffer, indexBufferMemory);
     }
 
     if (vertices.size() > 0) {
-        vkDestroyBuffer(device->GetVkDevice(), vertexBuffer, nullptr);
-        vkFreeMemory(device->GetVkDevice(), vertexBufferMemory, nullptr);
+        BufferUtils::DestroyBuffer(device, vertexBuffer, vertexBufferMemory);
     }
 
-    vkUnmapMemory(device->GetVkDevice(), modelBufferMemory);
-    vkDestroyBuffer(device->GetVkDevice(), modelBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), modelBufferMemory, nullptr);
+    BufferUtils::DestroyBuffer(device, modelBuffer, modelBufferMemory);
 
     if (textureView != VK_NULL_HANDLE) {
         vkDestroyImageView(device->GetVkDevice(), textureView, nullptr);
@@ -106,6 +111,14 @@ VkBuffer Model::getIndexBuffer() const {
     return indexBuffer;
 }
 
+VkIndexType Model::GetIndexType() const {
+    return indexType;
+}
+
+uint32_t Model::GetIndexCount() const {
+    return indexCount;
+}
+
 const ModelBufferObject& Model::getModelBufferObject() const {
     return modelBufferObject;
 }
@@ -122,30 +135,57 @@ VkSampler Model::GetTextureSampler() const {
     return textureSampler;
 }
 
+VkImageView Model::GetVertexTextureView() const {
+    return vertexTextureView;
+}
+
+VkSampler Model::GetVertexTextureSampler() const {
+    return vertexTextureSampler;
+}
+
 
 
 void Model::UpdateTransform(const glm::vec4& transform) {
     // Update local CPU-side copy
     modelBufferObject.transform = transform;
 
-    // Map the GPU memory for the uniform buffer
-    void* gpuMappedMemory = nullptr;
-    VkResult result = vkMapMemory(
-        device->GetVkDevice(),
-        modelBufferMemory,
-        0,
-        sizeof(ModelBufferObject),
-        0,
-        &gpuMappedMemory
-    );
-
-    if (result != VK_SUCCESS) {
-        throw std::runtime_error("Failed to map model uniform buffer memory!");
+    // The uniform buffer stays mapped
+    memcpy(modelUBOData, &modelBufferObject, sizeof(ModelBufferObject));
+}
+
+void Model::UpdateBuffer(uint32_t /*frame*/) {
+}
+
+ModelDraw Model::GetDraw(uint32_t /*frame*/) const {
+    ModelDraw draw;
+    draw.vertexBuffers[0] = vertexBuffer;
+    draw.indexBuffer = indexBuffer;
+    draw.indexType = indexType;
+    draw.indexCount = indexCount;
+    draw.boundsMin = boundsMin;
+    draw.boundsMax = boundsMax;
+    return draw;
+}
+
+void Model::RecordDraw(VkCommandBuffer commandBuffer, uint32_t frame) const {
+    GetDraw(frame).Record(commandBuffer);
+}
+
+void ModelDraw::Record(VkCommandBuffer commandBuffer) const {
+    vkCmdBindVertexBuffers(commandBuffer, 0, vertexBindingCount, vertexBuffers.data(), vertexOffsets.data());
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+    if (indirectBuffer != VK_NULL_HANDLE) {
+        vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else {
+        vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
     }
+}
 
-    // Copy updated transform data into mapped memory
-    memcpy(gpuMappedMemory, &modelBufferObject, sizeof(ModelBufferObject));
+void Model::SetVisible(bool visible) {
+    this->visible = visible;
+}
 
-    // Unmap after upload
-    vkUnmapMemory(device->GetVkDevice(), modelBufferMemory);
+bool Model::IsVisible() const {
+    return visible;
 }
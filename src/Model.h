@@ -2,30 +2,59 @@
 
 #include <vulkan/vulkan.h>
 #include <glm/glm.hpp>
+#include <array>
 #include <vector>
 
 #include "Vertex.h"
 #include "Device.h"
+#include "MemoryAllocator.h"
+
+class UploadBatcher;
 
 struct ModelBufferObject {
     glm::mat4 modelMatrix;
     glm::vec4 transform;
 };
 
+// Everything recording a model's draw needs, gathered once per scene version (see Renderer::BuildDrawList)
+// so recording reads a flat list instead of going through every model
+struct ModelDraw {
+    // Vertex bindings 0 and 1; the second is only bound if vertexBindingCount is 2
+    std::array<VkBuffer, 2> vertexBuffers = {};
+    std::array<VkDeviceSize, 2> vertexOffsets = {};
+    uint32_t vertexBindingCount = 1;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    uint32_t indexCount = 0;
+    // If set, the draw arguments are read from the start of this buffer instead of using indexCount
+    VkBuffer indirectBuffer = VK_NULL_HANDLE;
+    // Set 1 of the graphics pipeline, filled in by the renderer
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    // World space bounding box
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+
+    // Binds the buffers and draws. The caller binds the pipeline and the descriptor sets.
+    void Record(VkCommandBuffer commandBuffer) const;
+};
+
 class Model {
 protected:
     Device* device;
 
     std::vector<Vertex> vertices;
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    MemoryAllocation vertexBufferMemory;
 
     std::vector<uint32_t> indices;
     VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    MemoryAllocation indexBufferMemory;
+    // What the draw uses; models that bind buffers they do not own (see Terrain) set these themselves
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    uint32_t indexCount = 0;
 
     VkBuffer modelBuffer;
-    VkDeviceMemory modelBufferMemory;
+    MemoryAllocation modelBufferMemory;
 
     ModelBufferObject modelBufferObject;
 
@@ -33,11 +62,22 @@ protected:
     VkImageView textureView = VK_NULL_HANDLE;
     VkSampler textureSampler = VK_NULL_HANDLE;
 
+    // Sampled by the vertex stage (set 1, binding 2), owned by the subclass that sets it
+    VkImageView vertexTextureView = VK_NULL_HANDLE;
+    VkSampler vertexTextureSampler = VK_NULL_HANDLE;
+
     void* modelUBOData; //Uniform Buffer Object
 
+    // Bounding box of the vertices, under the model matrix
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+
+    // Hidden models are skipped when the renderer records its command buffers
+    bool visible = true;
+
 public:
     Model() = delete;
-    Model(Device* device, VkCommandPool commandPool, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
+    Model(Device* device, UploadBatcher* uploader, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
     virtual ~Model();
 
     void SetTexture(VkImage texture);
@@ -46,12 +86,29 @@ public:
     VkBuffer getVertexBuffer() const;
     const std::vector<uint32_t>& getIndices() const;
     VkBuffer getIndexBuffer() const;
+    VkIndexType GetIndexType() const;
+    uint32_t GetIndexCount() const;
 
     const ModelBufferObject& getModelBufferObject() const;
 
     VkBuffer GetModelBuffer() const;
     VkImageView GetTextureView() const;
     VkSampler GetTextureSampler() const;
+    VkImageView GetVertexTextureView() const;
+    VkSampler GetVertexTextureSampler() const;
 
     void UpdateTransform(const glm::vec4& transform);
+
+    // Copies per-frame state into the buffers of the given frame in flight, once the GPU is done with
+    // them; see Scene::UpdateBuffer
+    virtual void UpdateBuffer(uint32_t frame);
+    // What drawing the model in the given frame in flight takes; the buffers stay the same until the scene
+    // is marked dirty. The descriptor set is left empty.
+    virtual ModelDraw GetDraw(uint32_t frame) const;
+    // Records GetDraw(frame). The caller binds the pipeline and the descriptor sets.
+    virtual void RecordDraw(VkCommandBuffer commandBuffer, uint32_t frame) const;
+
+    // Only reaches the GPU once the renderer re-records, see Scene::MarkDirty
+    void SetVisible(bool visible);
+    bool IsVisible() const;
 };
@@ -0,0 +1,137 @@
+#include "NoiseUtils.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NOISE_SSE2 1
+#endif
+
+namespace {
+    // Samples per SIMD step
+    constexpr size_t LANES = 4;
+
+    // Hash(xi + zi * 57) of every lattice point the samples touch, when they are clustered enough for a
+    // table to be cheaper than four sin() per sample (e.g. the blades of one tile)
+    class HashLattice {
+    public:
+        HashLattice(const float* x, const float* z, size_t count) {
+            if (count == 0) {
+                return;
+            }
+
+            auto xRange = std::minmax_element(x, x + count);
+            auto zRange = std::minmax_element(z, z + count);
+            minX = static_cast<int>(floor(*xRange.first));
+            minZ = static_cast<int>(floor(*zRange.first));
+            width = static_cast<int>(floor(*xRange.second)) - minX + 2;
+            int depth = static_cast<int>(floor(*zRange.second)) - minZ + 2;
+
+            if (static_cast<size_t>(width) * depth > LANES * count) {
+                return;
+            }
+
+            values.resize(static_cast<size_t>(width) * depth);
+            for (int zi = 0; zi < depth; ++zi) {
+                for (int xi = 0; xi < width; ++xi) {
+                    values[zi * width + xi] = NoiseUtils::Hash(static_cast<float>(minX + xi + (minZ + zi) * 57));
+                }
+            }
+        }
+
+        float At(int xi, int zi) const {
+            if (values.empty()) {
+                return NoiseUtils::Hash(static_cast<float>(xi + zi * 57));
+            }
+            return values[(zi - minZ) * width + (xi - minX)];
+        }
+
+    private:
+        int minX = 0;
+        int minZ = 0;
+        int width = 0;
+        std::vector<float> values;
+    };
+
+#ifdef NOISE_SSE2
+    // floor() of four floats as integers and floats (truncation rounds negative values up)
+    void floor4(__m128 value, __m128i& integer, __m128& floored) {
+        integer = _mm_cvttps_epi32(value);
+        floored = _mm_cvtepi32_ps(integer);
+
+        __m128 roundedUp = _mm_cmpgt_ps(floored, value);
+        integer = _mm_add_epi32(integer, _mm_castps_si128(roundedUp));
+        floored = _mm_sub_ps(floored, _mm_and_ps(roundedUp, _mm_set1_ps(1.0f)));
+    }
+
+    // Same operation order as NoiseUtils::Noise
+    void noise4(const HashLattice& lattice, const float* x, const float* z, float* out) {
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 three = _mm_set1_ps(3.0f);
+
+        __m128 vx = _mm_loadu_ps(x);
+        __m128 vz = _mm_loadu_ps(z);
+
+        __m128i xi, zi;
+        __m128 fx, fz;
+        floor4(vx, xi, fx);
+        floor4(vz, zi, fz);
+
+        __m128 xf = _mm_sub_ps(vx, fx);
+        __m128 zf = _mm_sub_ps(vz, fz);
+
+        alignas(16) int xis[LANES];
+        alignas(16) int zis[LANES];
+        _mm_store_si128(reinterpret_cast<__m128i*>(xis), xi);
+        _mm_store_si128(reinterpret_cast<__m128i*>(zis), zi);
+
+        alignas(16) float topLeft[LANES], topRight[LANES], bottomLeft[LANES], bottomRight[LANES];
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            topLeft[lane] = lattice.At(xis[lane], zis[lane]);
+            topRight[lane] = lattice.At(xis[lane] + 1, zis[lane]);
+            bottomLeft[lane] = lattice.At(xis[lane], zis[lane] + 1);
+            bottomRight[lane] = lattice.At(xis[lane] + 1, zis[lane] + 1);
+        }
+
+        __m128 u = _mm_mul_ps(_mm_mul_ps(xf, xf), _mm_sub_ps(three, _mm_mul_ps(two, xf)));
+        __m128 v = _mm_mul_ps(_mm_mul_ps(zf, zf), _mm_sub_ps(three, _mm_mul_ps(two, zf)));
+        __m128 oneMinusU = _mm_sub_ps(one, u);
+        __m128 oneMinusV = _mm_sub_ps(one, v);
+
+        __m128 top = _mm_add_ps(_mm_mul_ps(_mm_load_ps(topLeft), oneMinusU), _mm_mul_ps(_mm_load_ps(topRight), u));
+        __m128 bottom = _mm_add_ps(_mm_mul_ps(_mm_load_ps(bottomLeft), oneMinusU), _mm_mul_ps(_mm_load_ps(bottomRight), u));
+
+        _mm_storeu_ps(out, _mm_add_ps(_mm_mul_ps(top, oneMinusV), _mm_mul_ps(bottom, v)));
+    }
+#else
+    void noise4(const HashLattice&, const float* x, const float* z, float* out) {
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            out[lane] = NoiseUtils::Noise(x[lane], z[lane]);
+        }
+    }
+#endif
+}
+
+void NoiseUtils::NoiseBatch(const float* x, const float* z, float* out, size_t count) {
+    HashLattice lattice(x, z, count);
+
+    size_t i = 0;
+    for (; i + LANES <= count; i += LANES) {
+        noise4(lattice, x + i, z + i, out + i);
+    }
+
+    // Pad the tail with its last sample so it takes the same path as every other sample
+    if (i < count) {
+        float tailX[LANES], tailZ[LANES], tailOut[LANES];
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            size_t source = std::min(i + lane, count - 1);
+            tailX[lane] = x[source];
+            tailZ[lane] = z[source];
+        }
+
+        noise4(lattice, tailX, tailZ, tailOut);
+        std::copy(tailOut, tailOut + (count - i), out + i);
+    }
+}
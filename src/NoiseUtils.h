@@ -2,6 +2,7 @@
 
 #include <glm/glm.hpp>
 #include <cmath>
+#include <cstddef>
 
 class NoiseUtils {
 public:
@@ -28,4 +29,9 @@ public:
 
         return top * (1 - v) + bottom * v;
     }
+
+    // out[i] = Noise(x[i], z[i]), four samples at a time with SSE2 where available. Lattice hashes
+    // shared by nearby samples are evaluated once. Every sample goes through the same arithmetic as
+    // Noise whatever the batch it is part of, so results do not depend on how callers split the work.
+    static void NoiseBatch(const float* x, const float* z, float* out, size_t count);
 };
@@ -0,0 +1,106 @@
+#include "PipelineCache.h"
+#include "Instance.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+    // VkPipelineCacheHeaderVersionOne: headerSize, headerVersion, vendorID, deviceID, pipelineCacheUUID
+    constexpr size_t HEADER_SIZE = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+
+    uint32_t readUint32(const char* data) {
+        // The header is little endian, like every platform this runs on
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+}
+
+PipelineCache::PipelineCache(Device* device, const std::string& path) : device(device), path(path) {
+    std::vector<char> data;
+    std::ifstream file(path, std::ios::binary);
+    if (file.is_open()) {
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    if (!data.empty() && !IsCompatible(data.data(), data.size())) {
+        std::cout << "Pipeline cache " << path << " was written by another device or driver, starting empty" << std::endl;
+        data.clear();
+    }
+
+    VkPipelineCacheCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = data.size();
+    createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+    if (vkCreatePipelineCache(device->GetVkDevice(), &createInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline cache");
+    }
+    loadedSize = data.size();
+}
+
+PipelineCache::~PipelineCache() {
+    Save();
+    vkDestroyPipelineCache(device->GetVkDevice(), pipelineCache, nullptr);
+}
+
+bool PipelineCache::Save() const {
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device->GetVkDevice(), pipelineCache, &size, nullptr) != VK_SUCCESS) {
+        return false;
+    }
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(device->GetVkDevice(), pipelineCache, &size, data.data()) != VK_SUCCESS) {
+        return false;
+    }
+
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open() || !file.write(data.data(), size)) {
+            std::cerr << "Failed to write pipeline cache " << temporaryPath << std::endl;
+            return false;
+        }
+    }
+
+    // rename does not replace an existing file everywhere
+    std::remove(path.c_str());
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to write pipeline cache " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+VkPipelineCache PipelineCache::GetVkPipelineCache() const {
+    return pipelineCache;
+}
+
+size_t PipelineCache::GetLoadedSize() const {
+    return loadedSize;
+}
+
+bool PipelineCache::IsCompatible(const char* data, size_t size) const {
+    if (size < HEADER_SIZE) {
+        return false;
+    }
+
+    uint32_t headerSize = readUint32(data);
+    uint32_t headerVersion = readUint32(data + 4);
+    uint32_t vendorID = readUint32(data + 8);
+    uint32_t deviceID = readUint32(data + 12);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device->GetInstance()->GetPhysicalDevice(), &properties);
+
+    return headerSize >= HEADER_SIZE && headerSize <= size
+        && headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && vendorID == properties.vendorID
+        && deviceID == properties.deviceID
+        && memcmp(data + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
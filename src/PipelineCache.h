@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <string>
+#include "Device.h"
+
+// VkPipelineCache persisted to a file between runs.
+//
+// The file holds exactly what vkGetPipelineCacheData returns. On load its header is checked against the
+// device (header version, vendor and device ids, pipelineCacheUUID); data written by another GPU or driver
+// version is dropped and the cache starts empty rather than being handed to the driver. The cache is
+// internally synchronized, so pipelines can be created through it from several threads at once.
+class PipelineCache {
+public:
+    PipelineCache(Device* device, const std::string& path);
+    // Saves the cache
+    ~PipelineCache();
+
+    PipelineCache(const PipelineCache&) = delete;
+    PipelineCache& operator=(const PipelineCache&) = delete;
+
+    // Writes the current contents to the file (through a temporary file, so a crash never leaves a
+    // truncated cache behind). Returns false if the file could not be written.
+    bool Save() const;
+
+    VkPipelineCache GetVkPipelineCache() const;
+    // Bytes of valid cache data found at construction, 0 if there was none or it was rejected
+    size_t GetLoadedSize() const;
+
+private:
+    Device* device;
+    std::string path;
+    VkPipelineCache pipelineCache;
+    size_t loadedSize = 0;
+
+    bool IsCompatible(const char* data, size_t size) const;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+// Counter-based random numbers: every value is a pure function of (key, counter), so any part of a
+// sequence can be generated on any thread and in any order with identical results.
+class CounterRng {
+public:
+    // Keyed by a seed and a stream, e.g. (world seed, tile)
+    CounterRng(uint64_t seed, uint64_t stream)
+        : key(Mix(seed ^ Mix(stream + GOLDEN_GAMMA))) {
+    }
+
+    uint32_t Next32(uint64_t counter) const {
+        return static_cast<uint32_t>(Mix(key + counter * GOLDEN_GAMMA) >> 32);
+    }
+
+    // Uniform in [0, 1), 24 bits of precision
+    float Uniform(uint64_t counter) const {
+        return (Next32(counter) >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // SplitMix64 finalizer
+    static uint64_t Mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+private:
+    static constexpr uint64_t GOLDEN_GAMMA = 0x9E3779B97F4A7C15ull;
+
+    uint64_t key;
+};
@@ -1,22 +1,122 @@
 ﻿#include "Renderer.h"
 #include "Instance.h"
 #include "ShaderModule.h"
-#include "Vertex.h"
+#include "TerrainGrid.h"
 #include "Blades.h"
 #include "Camera.h"
+#include "GpuProfiler.h"
 #include "Image.h"
-
+#include "PipelineCache.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <string>
+
+// Local size of shaders/cluster_cull.comp, one invocation per cluster
+static constexpr unsigned int CLUSTER_CULL_WORKGROUP_SIZE = 64;
+static_assert(CLUSTERS_PER_TILE % CLUSTER_CULL_WORKGROUP_SIZE == 0, "Cluster culling dispatch must cover every cluster of a tile");
+
+// Must match WORKGROUP_SIZE in shaders/trample.comp
+static constexpr unsigned int TRAMPLE_WORKGROUP_SIZE = 8;
+static_assert(TRAMPLE_RESOLUTION % TRAMPLE_WORKGROUP_SIZE == 0, "Trample dispatch must cover the whole field");
+
+// Specialization constants of shaders/compute.comp, in constant_id order. The grass vertex and
+// tessellation control stages take the distance LOD ones (same ids) from the same data.
+struct SimulationSpecialization {
+    uint32_t workgroupSize;
+    float gravityMagnitude;
+    float windMagnitude;
+    float windFreq;
+    float stiffnessCoefficient;
+    VkBool32 orientCull;
+    VkBool32 viewFrustumCull;
+    VkBool32 distCull;
+    float orientationThreshold;
+    float frustumTolerance;
+    float maxDist;
+    float lodNearDist;
+    float trampleBend;
+    float lodFadeBand;
+    float maxWidthScale;
+};
+
+// Every member is 4 bytes, constant_id i at offset 4 * i
+static_assert(sizeof(SimulationSpecialization) == 15 * 4, "SimulationSpecialization must be tightly packed");
+using SimulationSpecializationEntries = std::array<VkSpecializationMapEntry, sizeof(SimulationSpecialization) / 4>;
+
+static SimulationSpecialization makeSimulationSpecialization(const BladeSimulationParams& params, uint32_t workgroupSize) {
+    SimulationSpecialization specialization = {};
+    specialization.workgroupSize = workgroupSize;
+    specialization.gravityMagnitude = params.gravityMagnitude;
+    specialization.windMagnitude = params.windMagnitude;
+    specialization.windFreq = params.windFreq;
+    specialization.stiffnessCoefficient = params.stiffnessCoefficient;
+    specialization.orientCull = params.orientCull ? VK_TRUE : VK_FALSE;
+    specialization.viewFrustumCull = params.viewFrustumCull ? VK_TRUE : VK_FALSE;
+    specialization.distCull = params.distCull ? VK_TRUE : VK_FALSE;
+    specialization.orientationThreshold = params.orientationThreshold;
+    specialization.frustumTolerance = params.frustumTolerance;
+    specialization.maxDist = params.maxDist;
+    specialization.lodNearDist = params.lodNearDist;
+    specialization.trampleBend = params.trampleBend;
+    specialization.lodFadeBand = params.lodFadeBand;
+    specialization.maxWidthScale = params.maxWidthScale;
+    return specialization;
+}
+
+static SimulationSpecializationEntries makeSimulationSpecializationEntries() {
+    SimulationSpecializationEntries entries;
+    for (uint32_t i = 0; i < entries.size(); ++i) {
+        entries[i].constantID = i;
+        entries[i].offset = i * 4;
+        entries[i].size = 4;
+    }
+    return entries;
+}
 
-static constexpr unsigned int WORKGROUP_SIZE = 32;
+// Headless targets are read back / compared on the host, so use a plain RGBA layout
+static constexpr VkFormat OFFSCREEN_COLOR_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+static constexpr uint32_t OFFSCREEN_IMAGE_COUNT = MAX_FRAMES_IN_FLIGHT;
 
-Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera)
+// Relative to the working directory, like images/
+static constexpr const char* PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+// Fewer model draws than this are not worth handing to another recording thread
+static constexpr size_t MIN_DRAWS_PER_RECORD_BATCH = 16;
+
+Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera, const BladeSimulationParams& simulationParams,
+    ThreadPool* recordPool)
     : device(device),
     logicalDevice(device->GetVkDevice()),
     swapChain(swapChain),
     scene(scene),
-    camera(camera) {
+    camera(camera),
+    simulationParams(simulationParams),
+    recordPool(recordPool ? recordPool : &ThreadPool::Shared()) {
+    Initialize();
+}
 
+Renderer::Renderer(Device* device, VkExtent2D extent, Scene* scene, Camera* camera, const BladeSimulationParams& simulationParams,
+    ThreadPool* recordPool)
+    : device(device),
+    logicalDevice(device->GetVkDevice()),
+    swapChain(nullptr),
+    scene(scene),
+    camera(camera),
+    simulationParams(simulationParams),
+    recordPool(recordPool ? recordPool : &ThreadPool::Shared()),
+    offscreenExtent(extent) {
+    Initialize();
+}
+
+void Renderer::Initialize() {
+    CreateSyncObjects();
     CreateCommandPools();
     CreateRenderPass();
     CreateCameraDescriptorSetLayout();
@@ -24,29 +124,130 @@ Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* c
     CreateTimeDescriptorSetLayout();
     CreateComputeDescriptorSetLayout();
     CreateDescriptorPool();
-    CreateCameraDescriptorSet();
+    CreateCameraDescriptorSets();
     CreateModelDescriptorSets();
     CreateGrassDescriptorSets();
-    CreateTimeDescriptorSet();
+    CreateTimeDescriptorSets();
     CreateComputeDescriptorSets();
     CreateFrameResources();
-    CreateGraphicsPipeline();
-    CreateGrassPipeline();
-    CreateComputePipeline();
+    CreatePipelines();
+    profiler = new GpuProfiler(device);
     RecordCommandBuffers();
-    RecordComputeCommandBuffer();
+    RecordComputeCommandBuffers();
+    ClearTrampleField();
+}
+
+void Renderer::ClearTrampleField() {
+    // On the compute queue, which owns the field; submitted ahead of every frame's compute work
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = computeCommandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate command buffers");
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    scene->GetTrampleField()->RecordClear(commandBuffer);
+    vkEndCommandBuffer(commandBuffer);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+
+    VkQueue computeQueue = device->GetQueue(QueueFlags::Compute);
+    if (vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit the trample field clear");
+    }
+    vkQueueWaitIdle(computeQueue);
+    vkFreeCommandBuffers(logicalDevice, computeCommandPool, 1, &commandBuffer);
+}
+
+bool Renderer::IsHeadless() const {
+    return swapChain == nullptr;
+}
+
+VkExtent2D Renderer::GetExtent() const {
+    return IsHeadless() ? offscreenExtent : swapChain->GetVkExtent();
+}
+
+VkFormat Renderer::GetColorFormat() const {
+    return IsHeadless() ? OFFSCREEN_COLOR_FORMAT : swapChain->GetVkImageFormat();
+}
+
+uint32_t Renderer::ChooseSimulationWorkgroupSize() const {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device->GetInstance()->GetPhysicalDevice(), &properties);
+    uint32_t limit = std::min(properties.limits.maxComputeWorkGroupSize[0], properties.limits.maxComputeWorkGroupInvocations);
+
+    uint32_t size = simulationParams.workgroupSize;
+    if (size != 0) {
+        if ((size & (size - 1)) != 0 || CLUSTER_SIZE % size != 0 || size > limit) {
+            throw std::runtime_error("Simulation workgroup size " + std::to_string(size) + " must be a power of two dividing "
+                + std::to_string(CLUSTER_SIZE) + " and at most " + std::to_string(limit));
+        }
+        return size;
+    }
+
+    // Vulkan 1.0 cannot query the subgroup size, so go by vendor: one full wave on AMD (64 lanes on
+    // GCN), one warp / SIMD32 elsewhere
+    const uint32_t VENDOR_AMD = 0x1002;
+    uint32_t preferred = properties.vendorID == VENDOR_AMD ? 64 : 32;
+
+    size = 1;
+    while (size * 2 <= std::min(preferred, limit) && CLUSTER_SIZE % (size * 2) == 0) {
+        size *= 2;
+    }
+    return size;
+}
+
+uint32_t Renderer::GetImageCount() const {
+    return IsHeadless() ? OFFSCREEN_IMAGE_COUNT : swapChain->GetCount();
+}
+
+GpuProfiler* Renderer::GetProfiler() const {
+    return profiler;
+}
+
+uint32_t Renderer::GetCurrentFrame() const {
+    return currentFrame;
+}
+
+uint32_t Renderer::GetSimulationWorkgroupSize() const {
+    return simulationWorkgroupSize;
+}
+
+const std::vector<float>& Renderer::GetFrameTimes() const {
+    return frameTimes;
 }
 
 void Renderer::CreateCommandPools() {
     VkCommandPoolCreateInfo graphicsPoolInfo = {};
     graphicsPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     graphicsPoolInfo.queueFamilyIndex = device->GetInstance()->GetQueueFamilyIndices()[QueueFlags::Graphics];
-    graphicsPoolInfo.flags = 0;
+    // Command buffers are re-recorded one frame in flight at a time when the scene changes
+    graphicsPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     if (vkCreateCommandPool(logicalDevice, &graphicsPoolInfo, nullptr, &graphicsCommandPool) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create command pool");
     }
 
+    // Command pools are externally synchronized: one per thread recording draw batches
+    recordCommandPools.resize(recordPool->GetThreadCount());
+    for (VkCommandPool& pool : recordCommandPools) {
+        if (vkCreateCommandPool(logicalDevice, &graphicsPoolInfo, nullptr, &pool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create command pool");
+        }
+    }
+
     VkCommandPoolCreateInfo computePoolInfo = {};
     computePoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     computePoolInfo.queueFamilyIndex = device->GetInstance()->GetQueueFamilyIndices()[QueueFlags::Compute];
@@ -60,14 +261,15 @@ void Renderer::CreateCommandPools() {
 void Renderer::CreateRenderPass() {
     // Color buffer attachment represented by one of the images from the swap chain
     VkAttachmentDescription colorAttachment = {};
-    colorAttachment.format = swapChain->GetVkImageFormat();
+    colorAttachment.format = GetColorFormat();
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Offscreen targets are left ready to be copied out instead of presented
+    colorAttachment.finalLayout = IsHeadless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     // Create a color attachment reference to be used with subpass
     VkAttachmentReference colorAttachmentRef = {};
@@ -161,7 +363,15 @@ void Renderer::CreateModelDescriptorSetLayout() {
     samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
     samplerLayoutBinding.pImmutableSamplers = nullptr;
 
-    std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, samplerLayoutBinding };
+    // Terrain height map, see Terrain. Not written in the grass sets, whose shaders do not use it.
+    VkDescriptorSetLayoutBinding vertexSamplerLayoutBinding = {};
+    vertexSamplerLayoutBinding.binding = 2;
+    vertexSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    vertexSamplerLayoutBinding.descriptorCount = 1;
+    vertexSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    vertexSamplerLayoutBinding.pImmutableSamplers = nullptr;
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, samplerLayoutBinding, vertexSamplerLayoutBinding };
 
     // Create the descriptor set layout
     VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -209,7 +419,26 @@ void Renderer::CreateTimeDescriptorSetLayout() {
     uboLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
     uboLayoutBinding.pImmutableSamplers = nullptr;
 
-    std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding };
+    // Binding 1: Storage buffer for the scene's colliders and their spatial hash, shared by every blade pool
+    VkDescriptorSetLayoutBinding collidersBinding = uboLayoutBinding;
+    collidersBinding.binding = 1;
+    collidersBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+    // Binding 2: Uniform buffer for the trample field's window
+    VkDescriptorSetLayoutBinding trampleInfoBinding = uboLayoutBinding;
+    trampleInfoBinding.binding = 2;
+
+    // Binding 3: Storage image of the trample field, updated by the trample pass
+    VkDescriptorSetLayoutBinding trampleImageBinding = uboLayoutBinding;
+    trampleImageBinding.binding = 3;
+    trampleImageBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+    // Binding 4: The same image, sampled by the blade simulation
+    VkDescriptorSetLayoutBinding trampleSamplerBinding = uboLayoutBinding;
+    trampleSamplerBinding.binding = 4;
+    trampleSamplerBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, collidersBinding, trampleInfoBinding, trampleImageBinding, trampleSamplerBinding };
 
     // Create the descriptor set layout
     VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -244,7 +473,7 @@ void Renderer::CreateComputeDescriptorSetLayout() {
     culledBladesBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
     culledBladesBinding.pImmutableSamplers = nullptr;
 
-    // Binding 2: Storage buffer for number of visible blades (atomic counter or indirect draw args)
+    // Binding 2: Storage buffer for number of visible blades per tile (atomic counters in the indirect draw args)
     VkDescriptorSetLayoutBinding visibleBladeCountBinding{};
     visibleBladeCountBinding.binding = 2;
     visibleBladeCountBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
@@ -252,20 +481,49 @@ void Renderer::CreateComputeDescriptorSetLayout() {
     visibleBladeCountBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
     visibleBladeCountBinding.pImmutableSamplers = nullptr;
 
-    // Binding 3: Uniform buffer for model transform data (e.g. offset and scale)
-    VkDescriptorSetLayoutBinding transformUniformBinding{};
-    transformUniformBinding.binding = 3;
-    transformUniformBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    transformUniformBinding.descriptorCount = 1;
-    transformUniformBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-    transformUniformBinding.pImmutableSamplers = nullptr;
+    // Binding 3: Uniform buffer for the constants of the pool (BladePoolInfo)
+    VkDescriptorSetLayoutBinding poolInfoBinding{};
+    poolInfoBinding.binding = 3;
+    poolInfoBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolInfoBinding.descriptorCount = 1;
+    poolInfoBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    poolInfoBinding.pImmutableSamplers = nullptr;
+
+    // Binding 4: Storage buffer for the origin of every tile in the blade pool
+    VkDescriptorSetLayoutBinding tileBinding{};
+    tileBinding.binding = 4;
+    tileBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    tileBinding.descriptorCount = 1;
+    tileBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    tileBinding.pImmutableSamplers = nullptr;
+
+    // Binding 5: Storage buffer for the blades as the previous frame left them (same buffer as binding 0
+    // unless the simulation ping-pongs, see BLADE_STATE_COPIES)
+    VkDescriptorSetLayoutBinding previousBladesBinding{};
+    previousBladesBinding.binding = 5;
+    previousBladesBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    previousBladesBinding.descriptorCount = 1;
+    previousBladesBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    previousBladesBinding.pImmutableSamplers = nullptr;
+
+    // Binding 6: Storage buffer for the bounds of every tile and blade cluster
+    VkDescriptorSetLayoutBinding boundsBinding = previousBladesBinding;
+    boundsBinding.binding = 6;
+
+    // Binding 7: Storage buffer for the clusters that survive cluster culling, and the indirect dispatch over them
+    VkDescriptorSetLayoutBinding visibleClustersBinding = previousBladesBinding;
+    visibleClustersBinding.binding = 7;
 
     // Aggregate all bindings into a list
     std::vector<VkDescriptorSetLayoutBinding> computeBindings = {
         allBladesBinding,
         culledBladesBinding,
         visibleBladeCountBinding,
-        transformUniformBinding
+        poolInfoBinding,
+        tileBinding,
+        previousBladesBinding,
+        boundsBinding,
+        visibleClustersBinding
     };
 
     // Create descriptor set layout from bindings
@@ -286,31 +544,41 @@ void Renderer::CreateComputeDescriptorSetLayout() {
 void Renderer::CreateDescriptorPool() {
     // Describe which descriptor types that the descriptor sets will contain
     std::vector<VkDescriptorPoolSize> poolSizes = {
-        // Camera
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1},
+        // Camera, one per frame in flight
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , MAX_FRAMES_IN_FLIGHT },
 
-        // Models + Blades
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , static_cast<uint32_t>(scene->GetModels().size() + scene->GetBlades().size()) },
+        // Models (texture and height map) + Blades, whose sets also use the model layout
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , static_cast<uint32_t>(2 * (scene->GetModels().size() + scene->GetBlades().size())) },
 
         // Models + Blades
         { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , static_cast<uint32_t>(scene->GetModels().size() + scene->GetBlades().size()) },
 
-        // Time (compute)
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
+        // Time (compute), one per frame in flight
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , MAX_FRAMES_IN_FLIGHT },
+
+        // Colliders (compute, in the time set), one per frame in flight
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , MAX_FRAMES_IN_FLIGHT },
+
+        // Trample field window, image and sampler (compute, in the time set), one each per frame in flight
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , MAX_FRAMES_IN_FLIGHT },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE , MAX_FRAMES_IN_FLIGHT },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , MAX_FRAMES_IN_FLIGHT },
 
         // Reserve space in the descriptor pool for storage buffers :
-        // Each grass blade group (e.g., a patch) requires 3 storage buffers:
+        // Each blade pool requires 7 storage buffers per frame in flight:
         // 1) All blades buffer
         // 2) Culled blades buffer
-        // 3) Visible blade count or draw arguments buffer
-        // So we allocate 3 � bladeGroupCount storage buffer descriptors.
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , static_cast<uint32_t>(3 * scene->GetBlades().size()) },
-
-        // Reserve space for 1 uniform buffer descriptor:
-        // This buffer provides collision-related data to the compute shader,
-        // such as bounding volumes, collision planes, or interaction regions
-        // used for culling, simulation, or animation of grass blades.
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
+        // 3) Per-tile draw arguments buffer
+        // 4) Tile origins buffer
+        // 5) Previous frame's blades buffer
+        // 6) Tile and cluster bounds buffer
+        // 7) Visible clusters buffer
+        // So we allocate 7 x bladePoolCount x MAX_FRAMES_IN_FLIGHT storage buffer descriptors.
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , static_cast<uint32_t>(7 * scene->GetBlades().size() * MAX_FRAMES_IN_FLIGHT) },
+
+        // Reserve space for 1 uniform buffer descriptor per blade pool and frame in flight:
+        // the pool's constants (BladePoolInfo), read by both compute passes
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , static_cast<uint32_t>(scene->GetBlades().size() * MAX_FRAMES_IN_FLIGHT) },
     };
 
     VkDescriptorPoolCreateInfo poolInfo = {};
@@ -321,13 +589,13 @@ void Renderer::CreateDescriptorPool() {
 
     size_t numModels = scene->GetModels().size();
     size_t numBlades = scene->GetBlades().size();
-    uint32_t totalSets = 1             // camera
+    uint32_t totalSets = MAX_FRAMES_IN_FLIGHT  // camera
         + numModels     // model descriptor sets
         + numBlades     // grass descriptor sets
-        + 1             // time buffer
-        + numBlades     // compute descriptor sets
+        + MAX_FRAMES_IN_FLIGHT  // time buffer
+        + numBlades * MAX_FRAMES_IN_FLIGHT  // compute descriptor sets
         ;
-    poolInfo.maxSets = totalSets; // 3 static sets + 1/model + 1/blade
+    poolInfo.maxSets = totalSets; // 2 sets per frame in flight + 1/model + 1/blade pool + 1/blade pool per frame in flight
 
     if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create descriptor pool");
@@ -336,39 +604,41 @@ void Renderer::CreateDescriptorPool() {
 
 
 
-void Renderer::CreateCameraDescriptorSet() {
-    // Describe the desciptor set
-    VkDescriptorSetLayout layouts[] = { cameraDescriptorSetLayout };
+void Renderer::CreateCameraDescriptorSets() {
+    // Describe the desciptor sets, one per frame in flight, each pointing at that frame's copy of the uniform buffer
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, cameraDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = layouts;
+    allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+    allocInfo.pSetLayouts = layouts.data();
 
     // Allocate descriptor sets
-    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &cameraDescriptorSet) != VK_SUCCESS) {
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, cameraDescriptorSets.data()) != VK_SUCCESS) {
         throw std::runtime_error("Failed to allocate descriptor set");
     }
 
-    // Configure the descriptors to refer to buffers
-    VkDescriptorBufferInfo cameraBufferInfo = {};
-    cameraBufferInfo.buffer = camera->GetBuffer();
-    cameraBufferInfo.offset = 0;
-    cameraBufferInfo.range = sizeof(CameraBufferObject);
-
-    std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
-    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstSet = cameraDescriptorSet;
-    descriptorWrites[0].dstBinding = 0;
-    descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrites[0].descriptorCount = 1;
-    descriptorWrites[0].pBufferInfo = &cameraBufferInfo;
-    descriptorWrites[0].pImageInfo = nullptr;
-    descriptorWrites[0].pTexelBufferView = nullptr;
-
-    // Update descriptor sets
-    vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        // Configure the descriptors to refer to buffers
+        VkDescriptorBufferInfo cameraBufferInfo = {};
+        cameraBufferInfo.buffer = camera->GetBuffer(frame);
+        cameraBufferInfo.offset = 0;
+        cameraBufferInfo.range = sizeof(CameraBufferObject);
+
+        std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = cameraDescriptorSets[frame];
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].dstArrayElement = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pBufferInfo = &cameraBufferInfo;
+        descriptorWrites[0].pImageInfo = nullptr;
+        descriptorWrites[0].pTexelBufferView = nullptr;
+
+        // Update descriptor sets
+        vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
 }
 
 void Renderer::CreateModelDescriptorSets() {
@@ -390,37 +660,54 @@ void Renderer::CreateModelDescriptorSets() {
         throw std::runtime_error("Failed to allocate descriptor set");
     }
 
-    std::vector<VkWriteDescriptorSet> descriptorWrites(2 * modelDescriptorSets.size());
+    std::vector<VkWriteDescriptorSet> descriptorWrites(3 * modelDescriptorSets.size());
+    // Every model's own infos, alive until the update below
+    std::vector<VkDescriptorBufferInfo> modelBufferInfos(scene->GetModels().size());
+    std::vector<VkDescriptorImageInfo> imageInfos(scene->GetModels().size());
+    std::vector<VkDescriptorImageInfo> heightMapInfos(scene->GetModels().size());
 
     for (uint32_t i = 0; i < scene->GetModels().size(); ++i) {
-        VkDescriptorBufferInfo modelBufferInfo = {};
+        VkDescriptorBufferInfo& modelBufferInfo = modelBufferInfos[i];
         modelBufferInfo.buffer = scene->GetModels()[i]->GetModelBuffer();
         modelBufferInfo.offset = 0;
         modelBufferInfo.range = sizeof(ModelBufferObject);
 
         // Bind image and sampler resources to the descriptor
-        VkDescriptorImageInfo imageInfo = {};
+        VkDescriptorImageInfo& imageInfo = imageInfos[i];
         imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
         imageInfo.imageView = scene->GetModels()[i]->GetTextureView();
         imageInfo.sampler = scene->GetModels()[i]->GetTextureSampler();
 
-        descriptorWrites[2 * i + 0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[2 * i + 0].dstSet = modelDescriptorSets[i];
-        descriptorWrites[2 * i + 0].dstBinding = 0;
-        descriptorWrites[2 * i + 0].dstArrayElement = 0;
-        descriptorWrites[2 * i + 0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[2 * i + 0].descriptorCount = 1;
-        descriptorWrites[2 * i + 0].pBufferInfo = &modelBufferInfo;
-        descriptorWrites[2 * i + 0].pImageInfo = nullptr;
-        descriptorWrites[2 * i + 0].pTexelBufferView = nullptr;
-
-        descriptorWrites[2 * i + 1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[2 * i + 1].dstSet = modelDescriptorSets[i];
-        descriptorWrites[2 * i + 1].dstBinding = 1;
-        descriptorWrites[2 * i + 1].dstArrayElement = 0;
-        descriptorWrites[2 * i + 1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[2 * i + 1].descriptorCount = 1;
-        descriptorWrites[2 * i + 1].pImageInfo = &imageInfo;
+        VkDescriptorImageInfo& heightMapInfo = heightMapInfos[i];
+        heightMapInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        heightMapInfo.imageView = scene->GetModels()[i]->GetVertexTextureView();
+        heightMapInfo.sampler = scene->GetModels()[i]->GetVertexTextureSampler();
+
+        descriptorWrites[3 * i + 0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[3 * i + 0].dstSet = modelDescriptorSets[i];
+        descriptorWrites[3 * i + 0].dstBinding = 0;
+        descriptorWrites[3 * i + 0].dstArrayElement = 0;
+        descriptorWrites[3 * i + 0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[3 * i + 0].descriptorCount = 1;
+        descriptorWrites[3 * i + 0].pBufferInfo = &modelBufferInfo;
+        descriptorWrites[3 * i + 0].pImageInfo = nullptr;
+        descriptorWrites[3 * i + 0].pTexelBufferView = nullptr;
+
+        descriptorWrites[3 * i + 1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[3 * i + 1].dstSet = modelDescriptorSets[i];
+        descriptorWrites[3 * i + 1].dstBinding = 1;
+        descriptorWrites[3 * i + 1].dstArrayElement = 0;
+        descriptorWrites[3 * i + 1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[3 * i + 1].descriptorCount = 1;
+        descriptorWrites[3 * i + 1].pImageInfo = &imageInfo;
+
+        descriptorWrites[3 * i + 2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[3 * i + 2].dstSet = modelDescriptorSets[i];
+        descriptorWrites[3 * i + 2].dstBinding = 2;
+        descriptorWrites[3 * i + 2].dstArrayElement = 0;
+        descriptorWrites[3 * i + 2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[3 * i + 2].descriptorCount = 1;
+        descriptorWrites[3 * i + 2].pImageInfo = &heightMapInfo;
     }
 
     for (size_t i = 0; i < descriptorWrites.size(); ++i) {
@@ -465,11 +752,9 @@ void Renderer::CreateGrassDescriptorSets() {
 
 
     for (uint32_t i = 0; i < scene->GetBlades().size(); ++i) {
-        bufferInfos[i].buffer = scene->GetBlades()[i]->GetTransformationBuffer();
         bufferInfos[i].buffer = scene->GetBlades()[i]->GetModelBuffer();
         //bufferInfos[i].offset = 0;
         bufferInfos[i].range = sizeof(ModelBufferObject);
-        //bufferInfos[i].range = sizeof(TransformationInfo);
 
 
         descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -488,39 +773,79 @@ void Renderer::CreateGrassDescriptorSets() {
 
 
 
-void Renderer::CreateTimeDescriptorSet() {
-    // Describe the desciptor set
-    VkDescriptorSetLayout layouts[] = { timeDescriptorSetLayout };
+void Renderer::CreateTimeDescriptorSets() {
+    // Describe the desciptor sets, one per frame in flight, each pointing at that frame's copy of the uniform buffer
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, timeDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = layouts;
+    allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+    allocInfo.pSetLayouts = layouts.data();
 
     // Allocate descriptor sets
-    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &timeDescriptorSet) != VK_SUCCESS) {
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, timeDescriptorSets.data()) != VK_SUCCESS) {
         throw std::runtime_error("Failed to allocate descriptor set");
     }
 
-    // Configure the descriptors to refer to buffers
-    VkDescriptorBufferInfo timeBufferInfo = {};
-    timeBufferInfo.buffer = scene->GetTimeBuffer();
-    timeBufferInfo.offset = 0;
-    timeBufferInfo.range = sizeof(Time);
-
-    std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
-    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstSet = timeDescriptorSet;
-    descriptorWrites[0].dstBinding = 0;
-    descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrites[0].descriptorCount = 1;
-    descriptorWrites[0].pBufferInfo = &timeBufferInfo;
-    descriptorWrites[0].pImageInfo = nullptr;
-    descriptorWrites[0].pTexelBufferView = nullptr;
-
-    // Update descriptor sets
-    vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        // Configure the descriptors to refer to buffers
+        VkDescriptorBufferInfo timeBufferInfo = {};
+        timeBufferInfo.buffer = scene->GetTimeBuffer(frame);
+        timeBufferInfo.offset = 0;
+        timeBufferInfo.range = sizeof(Time);
+
+        VkDescriptorBufferInfo collidersBufferInfo = {};
+        collidersBufferInfo.buffer = scene->GetColliders()->GetBuffer(frame);
+        collidersBufferInfo.offset = 0;
+        collidersBufferInfo.range = scene->GetColliders()->GetBufferSize();
+
+        VkDescriptorBufferInfo trampleInfoBufferInfo = {};
+        trampleInfoBufferInfo.buffer = scene->GetTrampleField()->GetInfoBuffer(frame);
+        trampleInfoBufferInfo.offset = 0;
+        trampleInfoBufferInfo.range = sizeof(TrampleInfo);
+
+        VkDescriptorImageInfo trampleImageInfo = {};
+        trampleImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        trampleImageInfo.imageView = scene->GetTrampleField()->GetView();
+        trampleImageInfo.sampler = VK_NULL_HANDLE;
+
+        VkDescriptorImageInfo trampleSamplerInfo = trampleImageInfo;
+        trampleSamplerInfo.sampler = scene->GetTrampleField()->GetSampler();
+
+        std::array<VkWriteDescriptorSet, 5> descriptorWrites = {};
+        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[0].dstSet = timeDescriptorSets[frame];
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].dstArrayElement = 0;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorCount = 1;
+        descriptorWrites[0].pBufferInfo = &timeBufferInfo;
+        descriptorWrites[0].pImageInfo = nullptr;
+        descriptorWrites[0].pTexelBufferView = nullptr;
+
+        descriptorWrites[1] = descriptorWrites[0];
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[1].pBufferInfo = &collidersBufferInfo;
+
+        descriptorWrites[2] = descriptorWrites[0];
+        descriptorWrites[2].dstBinding = 2;
+        descriptorWrites[2].pBufferInfo = &trampleInfoBufferInfo;
+
+        descriptorWrites[3] = descriptorWrites[0];
+        descriptorWrites[3].dstBinding = 3;
+        descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descriptorWrites[3].pBufferInfo = nullptr;
+        descriptorWrites[3].pImageInfo = &trampleImageInfo;
+
+        descriptorWrites[4] = descriptorWrites[3];
+        descriptorWrites[4].dstBinding = 4;
+        descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[4].pImageInfo = &trampleSamplerInfo;
+
+        // Update descriptor sets
+        vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
 }
 
 
@@ -528,14 +853,15 @@ void Renderer::CreateTimeDescriptorSet() {
 
 
 void Renderer::CreateComputeDescriptorSets() {
+    // One set per blade pool and frame in flight, indexed [pool * MAX_FRAMES_IN_FLIGHT + frame]
     const auto& bladesList = scene->GetBlades();
-    computeDescriptorSets.resize(bladesList.size());
+    computeDescriptorSets.resize(bladesList.size() * MAX_FRAMES_IN_FLIGHT);
 
-    std::vector<VkDescriptorSetLayout> layouts(bladesList.size(), computeDescriptorSetLayout);
+    std::vector<VkDescriptorSetLayout> layouts(computeDescriptorSets.size(), computeDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(bladesList.size());
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(computeDescriptorSets.size());
     allocInfo.pSetLayouts = layouts.data();
 
     if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, computeDescriptorSets.data()) != VK_SUCCESS) {
@@ -543,67 +869,115 @@ void Renderer::CreateComputeDescriptorSets() {
     }
 
     std::vector<VkWriteDescriptorSet> descriptorWrites;
-    descriptorWrites.reserve(bladesList.size() * 4);
+    descriptorWrites.reserve(computeDescriptorSets.size() * 8);
 
     std::vector<VkDescriptorBufferInfo> bufferInfos;
-    bufferInfos.reserve(bladesList.size() * 4);
+    bufferInfos.reserve(computeDescriptorSets.size() * 8);
 
     for (size_t i = 0; i < bladesList.size(); ++i) {
-        VkDescriptorBufferInfo bladesBufferInfo = {};
-        bladesBufferInfo.buffer = bladesList[i]->GetBladesBuffer();
-        bladesBufferInfo.offset = 0;
-        bladesBufferInfo.range = NUM_BLADES * sizeof(Blade);
-
-        VkDescriptorBufferInfo culledBladesBufferInfo = {};
-        culledBladesBufferInfo.buffer = bladesList[i]->GetCulledBladesBuffer();
-        culledBladesBufferInfo.offset = 0;
-        culledBladesBufferInfo.range = NUM_BLADES * sizeof(Blade);
-
-        VkDescriptorBufferInfo numBladesBufferInfo = {};
-        numBladesBufferInfo.buffer = bladesList[i]->GetNumBladesBuffer();
-        numBladesBufferInfo.offset = 0;
-        numBladesBufferInfo.range = sizeof(BladeDrawIndirect);
-
-        VkDescriptorBufferInfo objectTransBufferInfo = {};
-        objectTransBufferInfo.buffer = bladesList[i]->GetTransformationBuffer();
-        objectTransBufferInfo.offset = 0;
-        objectTransBufferInfo.range = sizeof(TransformationInfo);
-
-
-        // Write blade buffer
-        bufferInfos.push_back(bladesBufferInfo);
-        VkWriteDescriptorSet write0 = {};
-        write0.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write0.dstSet = computeDescriptorSets[i];
-        write0.dstBinding = 0;
-        write0.dstArrayElement = 0;
-        write0.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        write0.descriptorCount = 1;
-        write0.pBufferInfo = &bufferInfos.back();
-        descriptorWrites.push_back(write0);
-
-        // Write culled blade buffer
-        bufferInfos.push_back(culledBladesBufferInfo);
-        VkWriteDescriptorSet write1 = write0;
-        write1.dstBinding = 1;
-        write1.pBufferInfo = &bufferInfos.back();
-        descriptorWrites.push_back(write1);
-
-        // Write numBlades buffer
-        bufferInfos.push_back(numBladesBufferInfo);
-        VkWriteDescriptorSet write2 = write0;
-        write2.dstBinding = 2;
-        write2.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        write2.pBufferInfo = &bufferInfos.back();
-        descriptorWrites.push_back(write2);
-
-        // Write objectTrans buffer
-        bufferInfos.push_back(objectTransBufferInfo);
-        VkWriteDescriptorSet write3 = write0;
-        write3.dstBinding = 3;
-        write3.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        write3.pBufferInfo = &bufferInfos.back();
-        descriptorWrites.push_back(write3);
+        for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+            VkDescriptorBufferInfo bladesBufferInfo = {};
+            bladesBufferInfo.buffer = bladesList[i]->GetBladesBuffer(frame);
+            bladesBufferInfo.offset = 0;
+            bladesBufferInfo.range = bladesList[i]->GetBladesBufferSize();
+
+            VkDescriptorBufferInfo culledBladesBufferInfo = {};
+            culledBladesBufferInfo.buffer = bladesList[i]->GetCulledBladesBuffer(frame);
+            culledBladesBufferInfo.offset = 0;
+            culledBladesBufferInfo.range = bladesList[i]->GetCulledBladesBufferSize();
+
+            VkDescriptorBufferInfo numBladesBufferInfo = {};
+            numBladesBufferInfo.buffer = bladesList[i]->GetNumBladesBuffer(frame);
+            numBladesBufferInfo.offset = 0;
+            numBladesBufferInfo.range = bladesList[i]->GetNumBladesBufferSize();
+
+            VkDescriptorBufferInfo poolInfoBufferInfo = {};
+            poolInfoBufferInfo.buffer = bladesList[i]->GetPoolInfoBuffer();
+            poolInfoBufferInfo.offset = 0;
+            poolInfoBufferInfo.range = sizeof(BladePoolInfo);
+
+            VkDescriptorBufferInfo tileBufferInfo = {};
+            tileBufferInfo.buffer = bladesList[i]->GetTileBuffer();
+            tileBufferInfo.offset = 0;
+            tileBufferInfo.range = bladesList[i]->GetTileBufferSize();
+
+            VkDescriptorBufferInfo previousBladesBufferInfo = bladesBufferInfo;
+            previousBladesBufferInfo.buffer = bladesList[i]->GetPreviousBladesBuffer(frame);
+
+            VkDescriptorBufferInfo boundsBufferInfo = {};
+            boundsBufferInfo.buffer = bladesList[i]->GetBoundsBuffer();
+            boundsBufferInfo.offset = 0;
+            boundsBufferInfo.range = bladesList[i]->GetBoundsBufferSize();
+
+            VkDescriptorBufferInfo clusterBufferInfo = {};
+            clusterBufferInfo.buffer = bladesList[i]->GetClusterBuffer();
+            clusterBufferInfo.offset = 0;
+            clusterBufferInfo.range = bladesList[i]->GetClusterBufferSize();
+
+
+            // Write blade buffer
+            bufferInfos.push_back(bladesBufferInfo);
+            VkWriteDescriptorSet write0 = {};
+            write0.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write0.dstSet = computeDescriptorSets[i * MAX_FRAMES_IN_FLIGHT + frame];
+            write0.dstBinding = 0;
+            write0.dstArrayElement = 0;
+            write0.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write0.descriptorCount = 1;
+            write0.pBufferInfo = &bufferInfos.back();
+            descriptorWrites.push_back(write0);
+
+            // Write culled blade buffer
+            bufferInfos.push_back(culledBladesBufferInfo);
+            VkWriteDescriptorSet write1 = write0;
+            write1.dstBinding = 1;
+            write1.pBufferInfo = &bufferInfos.back();
+            descriptorWrites.push_back(write1);
+
+            // Write numBlades buffer
+            bufferInfos.push_back(numBladesBufferInfo);
+            VkWriteDescriptorSet write2 = write0;
+            write2.dstBinding = 2;
+            write2.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write2.pBufferInfo = &bufferInfos.back();
+            descriptorWrites.push_back(write2);
+
+            // Write pool info buffer
+            bufferInfos.push_back(poolInfoBufferInfo);
+            VkWriteDescriptorSet write3 = write0;
+            write3.dstBinding = 3;
+            write3.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            write3.pBufferInfo = &bufferInfos.back();
+            descriptorWrites.push_back(write3);
+
+            // Write tile origins buffer
+            bufferInfos.push_back(tileBufferInfo);
+            VkWriteDescriptorSet write4 = write0;
+            write4.dstBinding = 4;
+            write4.pBufferInfo = &bufferInfos.back();
+            descriptorWrites.push_back(write4);
+
+            // Write previous frame's blade buffer
+            bufferInfos.push_back(previousBladesBufferInfo);
+            VkWriteDescriptorSet write5 = write0;
+            write5.dstBinding = 5;
+            write5.pBufferInfo = &bufferInfos.back();
+            descriptorWrites.push_back(write5);
+
+            // Write bounds buffer
+            bufferInfos.push_back(boundsBufferInfo);
+            VkWriteDescriptorSet write6 = write0;
+            write6.dstBinding = 6;
+            write6.pBufferInfo = &bufferInfos.back();
+            descriptorWrites.push_back(write6);
+
+            // Write visible clusters buffer
+            bufferInfos.push_back(clusterBufferInfo);
+            VkWriteDescriptorSet write7 = write0;
+            write7.dstBinding = 7;
+            write7.pBufferInfo = &bufferInfos.back();
+            descriptorWrites.push_back(write7);
+        }
     }
 
     vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
@@ -611,9 +985,44 @@ void Renderer::CreateComputeDescriptorSets() {
 
 
 
+void Renderer::CreatePipelines() {
+    auto start = std::chrono::high_resolution_clock::now();
+    pipelineCache = new PipelineCache(device, PIPELINE_CACHE_PATH);
+
+    // Pipelines are independent, and compiling them (the tessellation pipeline above all) dominates
+    // startup on a cold cache. The cache is internally synchronized, so they all go through it at once.
+    ThreadPool& pool = ThreadPool::Shared();
+    std::vector<std::future<void>> pending;
+    pending.push_back(pool.Submit([this]() { CreateGraphicsPipeline(); }));
+    pending.push_back(pool.Submit([this]() { CreateGrassPipeline(); }));
+
+    std::exception_ptr error;
+    try {
+        CreateComputePipeline();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    // Wait for every task before rethrowing, they write into this object
+    for (std::future<void>& task : pending) {
+        try {
+            task.get();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    float elapsedMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Created pipelines in " << elapsedMs << " ms (" << pipelineCache->GetLoadedSize() << " bytes of cached pipeline data)" << std::endl;
+}
+
 void Renderer::CreateGraphicsPipeline() {
-    VkShaderModule vertShaderModule = ShaderModule::Create("shaders/graphics.vert.spv", logicalDevice);
-    VkShaderModule fragShaderModule = ShaderModule::Create("shaders/graphics.frag.spv", logicalDevice);
+    VkShaderModule vertShaderModule = ShaderModule::Create("graphics.vert", logicalDevice);
+    VkShaderModule fragShaderModule = ShaderModule::Create("graphics.frag", logicalDevice);
 
     // Assign each shader module to the appropriate stage in the pipeline
     VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
@@ -636,11 +1045,21 @@ void Renderer::CreateGraphicsPipeline() {
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    // Terrain tiles draw instances of the shared patch, see TerrainGrid
+    VkVertexInputBindingDescription bindingDescriptions[] = {
+        TerrainGridVertex::getBindingDescription(),
+        TerrainPatchInstance::getBindingDescription()
+    };
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+    for (const auto& attribute : TerrainGridVertex::getAttributeDescriptions()) {
+        attributeDescriptions.push_back(attribute);
+    }
+    for (const auto& attribute : TerrainPatchInstance::getAttributeDescriptions()) {
+        attributeDescriptions.push_back(attribute);
+    }
 
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexBindingDescriptionCount = 2;
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions;
     vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
@@ -650,25 +1069,20 @@ void Renderer::CreateGraphicsPipeline() {
     inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    // Viewports and Scissors (rectangles that define in which regions pixels are stored)
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = static_cast<float>(swapChain->GetVkExtent().width);
-    viewport.height = static_cast<float>(swapChain->GetVkExtent().height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    VkRect2D scissor = {};
-    scissor.offset = { 0, 0 };
-    scissor.extent = swapChain->GetVkExtent();
-
+    // Viewports and Scissors (rectangles that define in which regions pixels are stored). Both are
+    // dynamic and set when recording, so the pipeline does not depend on the extent.
     VkPipelineViewportStateCreateInfo viewportState = {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
+    viewportState.pViewports = nullptr;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+    viewportState.pScissors = nullptr;
+
+    VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
 
     // Rasterizer
     VkPipelineRasterizationStateCreateInfo rasterizer = {};
@@ -755,14 +1169,14 @@ void Renderer::CreateGraphicsPipeline() {
     pipelineInfo.pMultisampleState = &multisampling;
     pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = nullptr;
+    pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = graphicsPipelineLayout;
     pipelineInfo.renderPass = renderPass;
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineInfo.basePipelineIndex = -1;
 
-    if (vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+    if (vkCreateGraphicsPipelines(logicalDevice, pipelineCache->GetVkPipelineCache(), 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create graphics pipeline");
     }
 
@@ -774,10 +1188,10 @@ void Renderer::CreateGraphicsPipeline() {
 
 void Renderer::CreateGrassPipeline() {
     // --- Set up programmable shaders ---
-    VkShaderModule vertShaderModule = ShaderModule::Create("shaders/grass.vert.spv", logicalDevice);
-    VkShaderModule tescShaderModule = ShaderModule::Create("shaders/grass.tesc.spv", logicalDevice);
-    VkShaderModule teseShaderModule = ShaderModule::Create("shaders/grass.tese.spv", logicalDevice);
-    VkShaderModule fragShaderModule = ShaderModule::Create("shaders/grass.frag.spv", logicalDevice);
+    VkShaderModule vertShaderModule = ShaderModule::Create("grass.vert", logicalDevice);
+    VkShaderModule tescShaderModule = ShaderModule::Create("grass.tesc", logicalDevice);
+    VkShaderModule teseShaderModule = ShaderModule::Create("grass.tese", logicalDevice);
+    VkShaderModule fragShaderModule = ShaderModule::Create("grass.frag", logicalDevice);
 
     // Assign each shader module to the appropriate stage in the pipeline
     VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
@@ -798,6 +1212,19 @@ void Renderer::CreateGrassPipeline() {
     teseShaderStageInfo.module = teseShaderModule;
     teseShaderStageInfo.pName = "main";
 
+    // The vertex stage (culled indices only) and the tessellation control stage apply the distance LOD.
+    // Neither has a workgroup size; entries for constants a stage does not declare are ignored.
+    SimulationSpecialization specialization = makeSimulationSpecialization(simulationParams, 0);
+    SimulationSpecializationEntries specializationEntries = makeSimulationSpecializationEntries();
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+    specializationInfo.pMapEntries = specializationEntries.data();
+    specializationInfo.dataSize = sizeof(SimulationSpecialization);
+    specializationInfo.pData = &specialization;
+    vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
+    tescShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
     VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
     fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -812,11 +1239,11 @@ void Renderer::CreateGrassPipeline() {
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-    auto bindingDescription = Blade::getBindingDescription();
-    auto attributeDescriptions = Blade::getAttributeDescriptions();
+    auto bindingDescriptions = Blades::GetVertexBindingDescriptions();
+    auto attributeDescriptions = Blades::GetVertexAttributeDescriptions();
 
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
     vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
@@ -826,25 +1253,20 @@ void Renderer::CreateGrassPipeline() {
     inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    // Viewports and Scissors (rectangles that define in which regions pixels are stored)
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = static_cast<float>(swapChain->GetVkExtent().width);
-    viewport.height = static_cast<float>(swapChain->GetVkExtent().height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    VkRect2D scissor = {};
-    scissor.offset = { 0, 0 };
-    scissor.extent = swapChain->GetVkExtent();
-
+    // Viewports and Scissors (rectangles that define in which regions pixels are stored). Both are
+    // dynamic and set when recording, so the pipeline does not depend on the extent.
     VkPipelineViewportStateCreateInfo viewportState = {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
+    viewportState.pViewports = nullptr;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+    viewportState.pScissors = nullptr;
+
+    VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
 
     // Rasterizer
     VkPipelineRasterizationStateCreateInfo rasterizer = {};
@@ -939,14 +1361,14 @@ void Renderer::CreateGrassPipeline() {
     pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pTessellationState = &tessellationInfo;
-    pipelineInfo.pDynamicState = nullptr;
+    pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = grassPipelineLayout;
     pipelineInfo.renderPass = renderPass;
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineInfo.basePipelineIndex = -1;
 
-    if (vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &grassPipeline) != VK_SUCCESS) {
+    if (vkCreateGraphicsPipelines(logicalDevice, pipelineCache->GetVkPipelineCache(), 1, &pipelineInfo, nullptr, &grassPipeline) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create graphics pipeline");
     }
 
@@ -961,7 +1383,9 @@ void Renderer::CreateGrassPipeline() {
 
 void Renderer::CreateComputePipeline() {
     // Set up programmable shaders
-    VkShaderModule computeShaderModule = ShaderModule::Create("shaders/compute.comp.spv", logicalDevice);
+    VkShaderModule computeShaderModule = ShaderModule::Create("compute.comp", logicalDevice);
+    VkShaderModule clusterCullShaderModule = ShaderModule::Create("cluster_cull.comp", logicalDevice);
+    VkShaderModule trampleShaderModule = ShaderModule::Create("trample.comp", logicalDevice);
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -969,6 +1393,32 @@ void Renderer::CreateComputePipeline() {
     computeShaderStageInfo.module = computeShaderModule;
     computeShaderStageInfo.pName = "main";
 
+    simulationWorkgroupSize = ChooseSimulationWorkgroupSize();
+    std::cout << "Simulation workgroup size: " << simulationWorkgroupSize << std::endl;
+
+    SimulationSpecialization specialization = makeSimulationSpecialization(simulationParams, simulationWorkgroupSize);
+    SimulationSpecializationEntries specializationEntries = makeSimulationSpecializationEntries();
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+    specializationInfo.pMapEntries = specializationEntries.data();
+    specializationInfo.dataSize = sizeof(SimulationSpecialization);
+    specializationInfo.pData = &specialization;
+    computeShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
+    // Cluster culling needs the workgroup size, to size the indirect dispatch of the simulation, and the
+    // distance culling range, to drop clusters none of whose blades would be kept
+    std::array<VkSpecializationMapEntry, 3> clusterCullEntries = {
+        specializationEntries[0],
+        specializationEntries[offsetof(SimulationSpecialization, distCull) / 4],
+        specializationEntries[offsetof(SimulationSpecialization, maxDist) / 4],
+    };
+    VkSpecializationInfo clusterCullSpecializationInfo = {};
+    clusterCullSpecializationInfo.mapEntryCount = static_cast<uint32_t>(clusterCullEntries.size());
+    clusterCullSpecializationInfo.pMapEntries = clusterCullEntries.data();
+    clusterCullSpecializationInfo.dataSize = sizeof(SimulationSpecialization);
+    clusterCullSpecializationInfo.pData = &specialization;
+
     // TODO: Add the compute dsecriptor set layout you create to this list
     std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, timeDescriptorSetLayout, computeDescriptorSetLayout };
 
@@ -994,26 +1444,61 @@ void Renderer::CreateComputePipeline() {
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineInfo.basePipelineIndex = -1;
 
-    if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
+    if (vkCreateComputePipelines(logicalDevice, pipelineCache->GetVkPipelineCache(), 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create compute pipeline");
     }
 
+    // Cluster culling shares the layout, so the descriptor sets bound for it stay bound for the simulation
+    pipelineInfo.stage.module = clusterCullShaderModule;
+    pipelineInfo.stage.pSpecializationInfo = &clusterCullSpecializationInfo;
+    if (vkCreateComputePipelines(logicalDevice, pipelineCache->GetVkPipelineCache(), 1, &pipelineInfo, nullptr, &clusterCullPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create cluster culling pipeline");
+    }
+
+    // So does the trample pass, which only uses the time set
+    pipelineInfo.stage.module = trampleShaderModule;
+    pipelineInfo.stage.pSpecializationInfo = nullptr;
+    if (vkCreateComputePipelines(logicalDevice, pipelineCache->GetVkPipelineCache(), 1, &pipelineInfo, nullptr, &tramplePipeline) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create trample pipeline");
+    }
+
     // No need for shader modules anymore
     vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
+    vkDestroyShaderModule(logicalDevice, clusterCullShaderModule, nullptr);
+    vkDestroyShaderModule(logicalDevice, trampleShaderModule, nullptr);
 }
 
 void Renderer::CreateFrameResources() {
-    imageViews.resize(swapChain->GetCount());
+    if (IsHeadless()) {
+        // --- Create the offscreen color images that stand in for the swap chain ---
+        offscreenImages.resize(OFFSCREEN_IMAGE_COUNT);
+        offscreenImageMemories.resize(OFFSCREEN_IMAGE_COUNT);
+
+        for (uint32_t i = 0; i < OFFSCREEN_IMAGE_COUNT; i++) {
+            Image::Create(device,
+                offscreenExtent.width,
+                offscreenExtent.height,
+                OFFSCREEN_COLOR_FORMAT,
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                offscreenImages[i],
+                offscreenImageMemories[i]
+            );
+        }
+    }
 
-    for (uint32_t i = 0; i < swapChain->GetCount(); i++) {
+    imageViews.resize(GetImageCount());
+
+    for (uint32_t i = 0; i < GetImageCount(); i++) {
         // --- Create an image view for each swap chain image ---
         VkImageViewCreateInfo createInfo = {};
         createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        createInfo.image = swapChain->GetVkImage(i);
+        createInfo.image = IsHeadless() ? offscreenImages[i] : swapChain->GetVkImage(i);
 
         // Specify how the image data should be interpreted
         createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        createInfo.format = swapChain->GetVkImageFormat();
+        createInfo.format = GetColorFormat();
 
         // Specify color channel mappings (can be used for swizzling)
         createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -1037,8 +1522,8 @@ void Renderer::CreateFrameResources() {
     VkFormat depthFormat = device->GetInstance()->GetSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
     // CREATE DEPTH IMAGE
     Image::Create(device,
-        swapChain->GetVkExtent().width,
-        swapChain->GetVkExtent().height,
+        GetExtent().width,
+        GetExtent().height,
         depthFormat,
         VK_IMAGE_TILING_OPTIMAL,
         VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
@@ -1054,8 +1539,8 @@ void Renderer::CreateFrameResources() {
 
 
     // CREATE FRAMEBUFFERS
-    framebuffers.resize(swapChain->GetCount());
-    for (size_t i = 0; i < swapChain->GetCount(); i++) {
+    framebuffers.resize(GetImageCount());
+    for (size_t i = 0; i < GetImageCount(); i++) {
         std::vector<VkImageView> attachments = {
             imageViews[i],
             depthImageView
@@ -1066,8 +1551,8 @@ void Renderer::CreateFrameResources() {
         framebufferInfo.renderPass = renderPass;
         framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
         framebufferInfo.pAttachments = attachments.data();
-        framebufferInfo.width = swapChain->GetVkExtent().width;
-        framebufferInfo.height = swapChain->GetVkExtent().height;
+        framebufferInfo.width = GetExtent().width;
+        framebufferInfo.height = GetExtent().height;
         framebufferInfo.layers = 1;
 
         if (vkCreateFramebuffer(logicalDevice, &framebufferInfo, nullptr, &framebuffers[i]) != VK_SUCCESS) {
@@ -1083,104 +1568,191 @@ void Renderer::DestroyFrameResources() {
     }
 
     vkDestroyImageView(logicalDevice, depthImageView, nullptr);
-    vkFreeMemory(logicalDevice, depthImageMemory, nullptr);
-    vkDestroyImage(logicalDevice, depthImage, nullptr);
+    Image::Destroy(device, depthImage, depthImageMemory);
 
     for (size_t i = 0; i < framebuffers.size(); i++) {
         vkDestroyFramebuffer(logicalDevice, framebuffers[i], nullptr);
     }
+
+    for (size_t i = 0; i < offscreenImages.size(); i++) {
+        Image::Destroy(device, offscreenImages[i], offscreenImageMemories[i]);
+    }
+    offscreenImages.clear();
+    offscreenImageMemories.clear();
 }
 
 void Renderer::RecreateFrameResources() {
-    vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
-    vkDestroyPipeline(logicalDevice, grassPipeline, nullptr);
-    vkDestroyPipelineLayout(logicalDevice, graphicsPipelineLayout, nullptr);
-    vkDestroyPipelineLayout(logicalDevice, grassPipelineLayout, nullptr);
-    vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+    // Command buffers of every frame in flight are about to be freed and re-recorded
+    vkDeviceWaitIdle(logicalDevice);
+
+    // The pipelines take the viewport and scissor as dynamic state and survive a resize
+    FreeGraphicsCommandBuffers();
 
     DestroyFrameResources();
     CreateFrameResources();
-    CreateGraphicsPipeline();
-    CreateGrassPipeline();
     RecordCommandBuffers();
 }
 
-void Renderer::RecordComputeCommandBuffer() {
+void Renderer::RecordComputeCommandBuffers() {
+    computeCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+
     // Specify the command pool and number of buffers to allocate
     VkCommandBufferAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.commandPool = computeCommandPool;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = 1;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(computeCommandBuffers.size());
 
-    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &computeCommandBuffer) != VK_SUCCESS) {
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, computeCommandBuffers.data()) != VK_SUCCESS) {
         throw std::runtime_error("Failed to allocate command buffers");
     }
 
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-    beginInfo.pInheritanceInfo = nullptr;
-
-    // ~ Start recording ~
-    if (vkBeginCommandBuffer(computeCommandBuffer, &beginInfo) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to begin recording compute command buffer");
-    }
-
-    // Bind to the compute pipeline
-    vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+    // One command buffer per frame in flight, each bound to that frame's camera and time uniforms
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        VkCommandBuffer computeCommandBuffer = computeCommandBuffers[frame];
 
-    // Bind camera descriptor set
-    vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
-
-    // Bind descriptor set for time uniforms
-    vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 1, 1, &timeDescriptorSet, 0, nullptr);
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        beginInfo.pInheritanceInfo = nullptr;
 
+        // ~ Start recording ~
+        if (vkBeginCommandBuffer(computeCommandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to begin recording compute command buffer");
+        }
 
-    // Iterate over each grass blade group (patch) in the scene
-    for (uint32_t i = 0; i < scene->GetBlades().size(); ++i) {
-        // Bind the descriptor set for the current blade group
-        // Each descriptor set contains:
-        // - Input: Full blade data
-        // - Output: Culled blade buffer
-        // - Output: Visible blade count
-        // - Uniform: Object transform (offset/scale)
-        //
-        // Binding to set index 2 assumes set 0 and 1 are used for shared/global resources
-        vkCmdBindDescriptorSets(
-            computeCommandBuffer,
-            VK_PIPELINE_BIND_POINT_COMPUTE,
-            computePipelineLayout,
-            /* firstSet = */ 2,
-            /* descriptorSetCount = */ 1,
-            &computeDescriptorSets[i],
-            0, nullptr
-        );
-
-        // Dispatch the compute shader for this blade group
-        // The compute shader will:
-        // - Cull blades based on camera/visibility rules
-        // - Optionally simulate interaction (e.g., collision or wind)
-        //
-        // NUM_BLADES is the total number of blades per patch,
-        // WORKGROUP_SIZE is the number of threads per workgroup (e.g., 32/64)
-        vkCmdDispatch(
-            computeCommandBuffer,
-            /* x = */ (NUM_BLADES / WORKGROUP_SIZE),
-            /* y = */ 1,
-            /* z = */ 1
-        );
-    }
+        profiler->CmdResetCompute(computeCommandBuffer, frame);
+        profiler->CmdTimestamp(computeCommandBuffer, frame, GpuTimestamp::ComputeBegin);
+
+        // Bind camera descriptor set
+        vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &cameraDescriptorSets[frame], 0, nullptr);
+
+        // Bind descriptor set for time uniforms
+        vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 1, 1, &timeDescriptorSets[frame], 0, nullptr);
+
+        // The previous frame's dispatch, submitted earlier to this queue, wrote the blades this one reads
+        // and still read the cluster list the reset below overwrites
+        VkMemoryBarrier simulationBarrier = {};
+        simulationBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        simulationBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        simulationBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(computeCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &simulationBarrier, 0, nullptr, 0, nullptr);
+
+        // Fade, scroll and splat the trample field once for all blade pools (the barrier above also orders
+        // it after the previous frame's simulation, which sampled the field)
+        vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, tramplePipeline);
+        vkCmdDispatch(computeCommandBuffer, TRAMPLE_RESOLUTION / TRAMPLE_WORKGROUP_SIZE, TRAMPLE_RESOLUTION / TRAMPLE_WORKGROUP_SIZE, 1);
+
+        VkImageMemoryBarrier trampleBarrier = {};
+        trampleBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        trampleBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        trampleBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        trampleBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        trampleBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        trampleBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        trampleBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        trampleBarrier.image = scene->GetTrampleField()->GetImage();
+        trampleBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+        vkCmdPipelineBarrier(computeCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &trampleBarrier);
+        profiler->CmdTimestamp(computeCommandBuffer, frame, GpuTimestamp::TrampleEnd);
+
+        // Iterate over each blade pool in the scene (one per terrain, covering all of its tiles)
+        for (uint32_t i = 0; i < scene->GetBlades().size(); ++i) {
+            Blades* blades = scene->GetBlades()[i];
+
+            // Zero every tile's visible count and the visible cluster list before the dispatches append to them
+            blades->RecordResetDrawArguments(computeCommandBuffer, frame);
+
+            std::array<VkBufferMemoryBarrier, 2> resetBarriers = {};
+            resetBarriers[0].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            resetBarriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            resetBarriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            resetBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            resetBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            resetBarriers[0].buffer = blades->GetNumBladesBuffer(frame);
+            resetBarriers[0].offset = 0;
+            resetBarriers[0].size = blades->GetNumBladesBufferSize();
+
+            resetBarriers[1] = resetBarriers[0];
+            resetBarriers[1].buffer = blades->GetClusterBuffer();
+            resetBarriers[1].size = blades->GetClusterBufferSize();
+
+            vkCmdPipelineBarrier(computeCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                static_cast<uint32_t>(resetBarriers.size()), resetBarriers.data(), 0, nullptr);
+
+            // Bind the descriptor set for the current blade pool and frame
+            // Each descriptor set contains:
+            // - Input/Output: Full blade data of every tile (read from the previous frame's copy)
+            // - Output: Culled blade buffer (one range per tile)
+            // - Output: Visible blade count (draw arguments per tile)
+            // - Uniform: Pool size
+            // - Input: Tile origins
+            // - Input: Tile and cluster bounds
+            // - Output: Visible clusters and the indirect dispatch over them
+            //
+            // Binding to set index 2 assumes set 0 and 1 are used for shared/global resources
+            vkCmdBindDescriptorSets(
+                computeCommandBuffer,
+                VK_PIPELINE_BIND_POINT_COMPUTE,
+                computePipelineLayout,
+                /* firstSet = */ 2,
+                /* descriptorSetCount = */ 1,
+                &computeDescriptorSets[i * MAX_FRAMES_IN_FLIGHT + frame],
+                0, nullptr
+            );
+
+            // First pass: test every tile's and cluster's bounds against the view and list the
+            // clusters that survive. x walks the clusters of a tile, y selects the tile slot (empty
+            // slots exit straight away, so the dispatch does not change as tiles stream in and out)
+            vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, clusterCullPipeline);
+            vkCmdDispatch(
+                computeCommandBuffer,
+                /* x = */ (CLUSTERS_PER_TILE / CLUSTER_CULL_WORKGROUP_SIZE),
+                /* y = */ blades->GetTileCapacity(),
+                /* z = */ 1
+            );
+
+            // The cluster list is read by the simulation and its header is the indirect dispatch
+            VkBufferMemoryBarrier clusterBarrier = {};
+            clusterBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            clusterBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            clusterBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+            clusterBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            clusterBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            clusterBarrier.buffer = blades->GetClusterBuffer();
+            clusterBarrier.offset = 0;
+            clusterBarrier.size = blades->GetClusterBufferSize();
+
+            vkCmdPipelineBarrier(computeCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0, 0, nullptr, 1, &clusterBarrier, 0, nullptr);
+
+            // Second pass, only over the visible clusters. The compute shader will:
+            // - Cull blades based on camera/visibility rules
+            // - Optionally simulate interaction (e.g., collision or wind)
+            //
+            // The dispatch size (CLUSTER_SIZE / simulationWorkgroupSize workgroups per visible cluster)
+            // is written by the first pass
+            vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+            vkCmdDispatchIndirect(computeCommandBuffer, blades->GetClusterBuffer(), 0);
+        }
 
+        profiler->CmdTimestamp(computeCommandBuffer, frame, GpuTimestamp::ComputeEnd);
 
-    // ~ End recording ~
-    if (vkEndCommandBuffer(computeCommandBuffer) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to record compute command buffer");
+        // ~ End recording ~
+        if (vkEndCommandBuffer(computeCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to record compute command buffer");
+        }
     }
 }
 
 void Renderer::RecordCommandBuffers() {
-    commandBuffers.resize(swapChain->GetCount());
+    // One command buffer per (frame in flight, swap chain image) pair, see GetCommandBuffer
+    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT * GetImageCount());
+    grassCommandBuffers.resize(commandBuffers.size());
 
     // Specify the command pool and number of buffers to allocate
     VkCommandBufferAllocateInfo allocInfo = {};
@@ -1193,154 +1765,393 @@ void Renderer::RecordCommandBuffers() {
         throw std::runtime_error("Failed to allocate command buffers");
     }
 
-    // Start command buffer recording
+    // The grass pass is recorded on the calling thread, from the same pool as the primaries
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, grassCommandBuffers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate command buffers");
+    }
+
+    // Draw batch b of every (frame in flight, image) pair comes from the pool of the thread recording batch b
+    size_t batchesPerBuffer = recordCommandPools.size();
+    drawBatchCommandBuffers.resize(commandBuffers.size() * batchesPerBuffer);
+    allocInfo.commandBufferCount = 1;
     for (size_t i = 0; i < commandBuffers.size(); i++) {
-        VkCommandBufferBeginInfo beginInfo = {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-        beginInfo.pInheritanceInfo = nullptr;
+        for (size_t batch = 0; batch < batchesPerBuffer; batch++) {
+            allocInfo.commandPool = recordCommandPools[batch];
+            if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &drawBatchCommandBuffers[i * batchesPerBuffer + batch]) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to allocate command buffers");
+            }
+        }
+    }
 
-        // ~ Start recording ~
-        if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to begin recording command buffer");
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        RecordFrame(frame);
+    }
+}
+
+void Renderer::FreeGraphicsCommandBuffers() {
+    size_t batchesPerBuffer = recordCommandPools.size();
+    for (size_t i = 0; i < commandBuffers.size(); i++) {
+        for (size_t batch = 0; batch < batchesPerBuffer; batch++) {
+            vkFreeCommandBuffers(logicalDevice, recordCommandPools[batch], 1, &drawBatchCommandBuffers[i * batchesPerBuffer + batch]);
         }
+    }
+    vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, static_cast<uint32_t>(grassCommandBuffers.size()), grassCommandBuffers.data());
+    vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+    drawBatchCommandBuffers.clear();
+    grassCommandBuffers.clear();
+    commandBuffers.clear();
+}
 
-        // Begin the render pass
-        VkRenderPassBeginInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = framebuffers[i];
-        renderPassInfo.renderArea.offset = { 0, 0 };
-        renderPassInfo.renderArea.extent = swapChain->GetVkExtent();
-
-        std::array<VkClearValue, 2> clearValues = {};
-        clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-        clearValues[1].depthStencil = { 1.0f, 0 };
-        renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-        renderPassInfo.pClearValues = clearValues.data();
-
-        std::vector<VkBufferMemoryBarrier> barriers(scene->GetBlades().size());
-        for (uint32_t j = 0; j < barriers.size(); ++j) {
-            barriers[j].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-            barriers[j].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-            barriers[j].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-            barriers[j].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-            barriers[j].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-            barriers[j].buffer = scene->GetBlades()[j]->GetNumBladesBuffer();
-            barriers[j].offset = 0;
-            barriers[j].size = sizeof(BladeDrawIndirect);
+void Renderer::RerecordCommandBuffers() {
+    vkDeviceWaitIdle(logicalDevice);
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        RecordFrame(frame);
+    }
+}
+
+void Renderer::BuildDrawList(uint32_t frame) {
+    std::vector<ModelDraw>& draws = modelDraws[frame];
+    draws.clear();
+
+    const std::vector<Model*>& models = scene->GetModels();
+    for (size_t j = 0; j < models.size(); ++j) {
+        if (!models[j]->IsVisible()) {
+            continue;
         }
+        draws.push_back(models[j]->GetDraw(frame));
+        draws.back().descriptorSet = modelDescriptorSets[j];
+    }
 
-        vkCmdPipelineBarrier(commandBuffers[i], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, barriers.size(), barriers.data(), 0, nullptr);
+    // Row by row over the ground, so each draw batch is a compact range of tiles rather than whatever
+    // slots the tiles were streamed into
+    std::sort(draws.begin(), draws.end(), [](const ModelDraw& a, const ModelDraw& b) {
+        if (a.boundsMin.z != b.boundsMin.z) {
+            return a.boundsMin.z < b.boundsMin.z;
+        }
+        return a.boundsMin.x < b.boundsMin.x;
+    });
+}
 
-        // Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+void Renderer::RecordFrame(uint32_t frame) {
+    BuildDrawList(frame);
+
+    // Split the draws into at most one batch per recording thread, none smaller than
+    // MIN_DRAWS_PER_RECORD_BATCH unless there is only one
+    size_t drawCount = modelDraws[frame].size();
+    size_t batchCount = std::min(recordCommandPools.size(), (drawCount + MIN_DRAWS_PER_RECORD_BATCH - 1) / MIN_DRAWS_PER_RECORD_BATCH);
+    size_t batchSize = batchCount > 0 ? (drawCount + batchCount - 1) / batchCount : 0;
+    batchCount = batchSize > 0 ? (drawCount + batchSize - 1) / batchSize : 0;
+    drawBatchCounts[frame] = static_cast<uint32_t>(batchCount);
+
+    // Thread b records batch b of every image with command pool b; the calling thread takes batch 0
+    recordPool->ParallelFor(batchCount, [&](size_t beginBatch, size_t endBatch, size_t) {
+        for (size_t batch = beginBatch; batch < endBatch; batch++) {
+            size_t begin = batch * batchSize;
+            size_t end = std::min(drawCount, begin + batchSize);
+            for (uint32_t image = 0; image < GetImageCount(); image++) {
+                RecordDrawBatch(frame, image, static_cast<uint32_t>(batch), begin, end);
+            }
+        }
+    }, batchCount);
 
-        vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    for (uint32_t image = 0; image < GetImageCount(); image++) {
+        RecordGrassCommandBuffer(frame, image);
+        RecordCommandBuffer(frame, image);
+    }
+    recordedSceneVersions[frame] = scene->GetVersion();
+}
 
-        // Bind the graphics pipeline
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+void Renderer::BeginSecondaryCommandBuffer(VkCommandBuffer commandBuffer, uint32_t image) {
+    VkCommandBufferInheritanceInfo inheritanceInfo = {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = framebuffers[image];
 
-        for (uint32_t j = 0; j < scene->GetModels().size(); ++j) {
-            // Bind the vertex and index buffers
-            VkBuffer vertexBuffers[] = { scene->GetModels()[j]->getVertexBuffer() };
-            VkDeviceSize offsets[] = { 0 };
-            vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+    // Executed inside the render pass, by primaries that may be pending more than once
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
 
-            vkCmdBindIndexBuffer(commandBuffers[i], scene->GetModels()[j]->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording secondary command buffer");
+    }
 
-            // Bind the descriptor set for each model
-            vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 1, 1, &modelDescriptorSets[j], 0, nullptr);
+    // Secondary command buffers inherit no state from the primary: dynamic state of both graphics pipelines
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(GetExtent().width);
+    viewport.height = static_cast<float>(GetExtent().height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-            // Draw
-            std::vector<uint32_t> indices = scene->GetModels()[j]->getIndices();
-            vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
-        }
+    VkRect2D scissor = {};
+    scissor.offset = { 0, 0 };
+    scissor.extent = GetExtent();
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
 
-        // Bind the grass pipeline
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipeline);
+void Renderer::RecordDrawBatch(uint32_t frame, uint32_t image, uint32_t batch, size_t begin, size_t end) {
+    VkCommandBuffer commandBuffer = GetDrawBatchCommandBuffer(frame, image, batch);
+    BeginSecondaryCommandBuffer(commandBuffer, image);
 
-        for (uint32_t j = 0; j < scene->GetBlades().size(); ++j) {
-            VkBuffer vertexBuffers[] = { scene->GetBlades()[j]->GetCulledBladesBuffer() };
-            VkDeviceSize offsets[] = { 0 };
-            vkCmdBindVertexBuffers(commandBuffers[i], 1, 1, vertexBuffers, offsets);
+    // Bind the camera descriptor set and the graphics pipeline
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &cameraDescriptorSets[frame], 0, nullptr);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
-            // Bind the descriptor set for each grass blades model
-            vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 1, 1, &grassDescriptorSets[j], 0, nullptr);
+    const std::vector<ModelDraw>& draws = modelDraws[frame];
+    for (size_t j = begin; j < end; ++j) {
+        // Bind the descriptor set for each model
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 1, 1, &draws[j].descriptorSet, 0, nullptr);
 
-            // Draw
-            vkCmdDrawIndirect(commandBuffers[i], scene->GetBlades()[j]->GetNumBladesBuffer(), 0, 1, sizeof(BladeDrawIndirect));
-        }
+        // Draw; terrain tiles draw the patches of their LOD selection from this frame's buffers
+        draws[j].Record(commandBuffer);
+    }
 
-        // End render pass
-        vkCmdEndRenderPass(commandBuffers[i]);
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record secondary command buffer");
+    }
+}
 
-        // ~ End recording ~
-        if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to record command buffer");
-        }
+void Renderer::RecordGrassCommandBuffer(uint32_t frame, uint32_t image) {
+    VkCommandBuffer commandBuffer = grassCommandBuffers[frame * GetImageCount() + image];
+    BeginSecondaryCommandBuffer(commandBuffer, image);
+
+    // Executed after every draw batch
+    profiler->CmdTimestamp(commandBuffer, frame, GpuTimestamp::TerrainEnd);
+    profiler->CmdBeginGrassStatistics(commandBuffer, frame);
+
+    // Bind the camera descriptor set and the grass pipeline
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 0, 1, &cameraDescriptorSets[frame], 0, nullptr);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipeline);
+
+    for (uint32_t j = 0; j < scene->GetBlades().size(); ++j) {
+        // Bind the descriptor set for each grass blade pool
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 1, 1, &grassDescriptorSets[j], 0, nullptr);
+
+        // Draw every tile of the pool (a single multi-draw-indirect where supported)
+        scene->GetBlades()[j]->RecordDraw(commandBuffer, frame);
+    }
+
+    profiler->CmdEndGrassStatistics(commandBuffer, frame);
+    profiler->CmdTimestamp(commandBuffer, frame, GpuTimestamp::GrassEnd);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record secondary command buffer");
+    }
+}
+
+void Renderer::RecordCommandBuffer(uint32_t frame, uint32_t image) {
+    VkCommandBuffer commandBuffer = GetCommandBuffer(frame, image);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    beginInfo.pInheritanceInfo = nullptr;
+
+    // ~ Start recording ~ (implicitly resets a previously recorded buffer)
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording command buffer");
+    }
+
+    // Begin the render pass
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer = framebuffers[image];
+    renderPassInfo.renderArea.offset = { 0, 0 };
+    renderPassInfo.renderArea.extent = GetExtent();
+
+    std::array<VkClearValue, 2> clearValues = {};
+    clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+    clearValues[1].depthStencil = { 1.0f, 0 };
+    renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassInfo.pClearValues = clearValues.data();
+
+    // No barrier on the compute results here: Frame() makes this submission wait on the frame's
+    // computeFinished semaphore, which may be signaled from a different queue
+
+    profiler->CmdResetGraphics(commandBuffer, frame);
+    // The render pass only executes secondary command buffers, so this is taken right before it
+    profiler->CmdTimestamp(commandBuffer, frame, GpuTimestamp::GraphicsBegin);
+
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    // The draw batches of the models, then the grass
+    if (drawBatchCounts[frame] > 0) {
+        vkCmdExecuteCommands(commandBuffer, drawBatchCounts[frame], &drawBatchCommandBuffers[(frame * GetImageCount() + image) * recordCommandPools.size()]);
+    }
+    vkCmdExecuteCommands(commandBuffer, 1, &grassCommandBuffers[frame * GetImageCount() + image]);
+
+    // End render pass
+    vkCmdEndRenderPass(commandBuffer);
+
+    // Visible blade counts, for the profiler
+    profiler->CmdReadBladeCounts(commandBuffer, frame, scene->GetBlades());
+
+    // ~ End recording ~
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record command buffer");
     }
 }
 
 
 
+VkCommandBuffer Renderer::GetCommandBuffer(uint32_t frame, uint32_t image) const {
+    return commandBuffers[frame * GetImageCount() + image];
+}
+
+VkCommandBuffer Renderer::GetDrawBatchCommandBuffer(uint32_t frame, uint32_t image, uint32_t batch) const {
+    return drawBatchCommandBuffers[(frame * GetImageCount() + image) * recordCommandPools.size() + batch];
+}
+
 void Renderer::Frame() {
+    auto frameStart = std::chrono::high_resolution_clock::now();
+    uint32_t frame = currentFrame;
+
+    // Wait until the GPU is done with everything this frame slot last submitted, so its command
+    // buffers, uniform buffers and blade outputs can be reused
+    vkWaitForFences(logicalDevice, 1, &inFlightFences[frame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+    profiler->Collect(frame);
+
+    uint32_t imageIndex;
+    if (IsHeadless()) {
+        // No swap chain: every frame slot renders into its own offscreen target
+        imageIndex = frame;
+    }
+    else {
+        if (!swapChain->Acquire(imageAvailableSemaphores[frame])) {
+            RecreateFrameResources();
+            return;
+        }
+        imageIndex = swapChain->GetIndex();
+    }
+
+    vkResetFences(logicalDevice, 1, &inFlightFences[frame]);
+
+    // The scene changed since this slot's command buffers were recorded. None of them is pending any more,
+    // so only this slot is re-recorded; the other one catches up when its turn comes.
+    if (recordedSceneVersions[frame] != scene->GetVersion()) {
+        RecordFrame(frame);
+    }
 
+    camera->UpdateBuffer(frame);
+    // The trample field's window follows the camera
+    scene->GetTrampleField()->Follow(camera->GetPosition());
+    scene->UpdateBuffer(frame);
+
+    // The simulation only touches this slot's outputs (and the blades of the previous frame, ordered by
+    // the compute queue itself), so it does not wait for the previous frame's draw and overlaps it
     VkSubmitInfo computeSubmitInfo = {};
     computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
     computeSubmitInfo.commandBufferCount = 1;
-    computeSubmitInfo.pCommandBuffers = &computeCommandBuffer;
+    computeSubmitInfo.pCommandBuffers = &computeCommandBuffers[frame];
+    computeSubmitInfo.signalSemaphoreCount = 1;
+    computeSubmitInfo.pSignalSemaphores = &computeFinishedSemaphores[frame];
 
     if (vkQueueSubmit(device->GetQueue(QueueFlags::Compute), 1, &computeSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to submit draw command buffer");
-    }
-
-    if (!swapChain->Acquire()) {
-        RecreateFrameResources();
-        return;
+        throw std::runtime_error("Failed to submit compute command buffer");
     }
 
     // Submit the command buffer
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = { swapChain->GetImageAvailableVkSemaphore() };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
+    std::vector<VkSemaphore> waitSemaphores = { computeFinishedSemaphores[frame] };
+    std::vector<VkPipelineStageFlags> waitStages = { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT };
+    std::vector<VkSemaphore> signalSemaphores;
+    if (!IsHeadless()) {
+        waitSemaphores.push_back(imageAvailableSemaphores[frame]);
+        waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+        signalSemaphores.push_back(renderFinishedSemaphores[frame]);
+    }
+
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
 
+    VkCommandBuffer commandBuffer = GetCommandBuffer(frame, imageIndex);
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[swapChain->GetIndex()];
+    submitInfo.pCommandBuffers = &commandBuffer;
 
-    VkSemaphore signalSemaphores[] = { swapChain->GetRenderFinishedVkSemaphore() };
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signalSemaphores;
+    submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+    submitInfo.pSignalSemaphores = signalSemaphores.data();
 
-    if (vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    if (vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, inFlightFences[frame]) != VK_SUCCESS) {
         throw std::runtime_error("Failed to submit draw command buffer");
     }
+    profiler->MarkSubmitted(frame, frameNumber++);
+
+    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 
-    if (!swapChain->Present()) {
+    if (IsHeadless()) {
+        auto frameEnd = std::chrono::high_resolution_clock::now();
+        frameTimes.push_back(std::chrono::duration<float, std::milli>(frameEnd - frameStart).count());
+        return;
+    }
+
+    if (!swapChain->Present(renderFinishedSemaphores[frame])) {
         RecreateFrameResources();
     }
 }
 
+void Renderer::CreateSyncObjects() {
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    // Start signaled so the first wait on every frame slot returns immediately
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
+            vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
+            vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &computeFinishedSemaphores[i]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create semaphores");
+        }
+
+        if (vkCreateFence(logicalDevice, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create frame fence");
+        }
+    }
+}
+
+void Renderer::DestroySyncObjects() {
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroySemaphore(logicalDevice, imageAvailableSemaphores[i], nullptr);
+        vkDestroySemaphore(logicalDevice, renderFinishedSemaphores[i], nullptr);
+        vkDestroySemaphore(logicalDevice, computeFinishedSemaphores[i], nullptr);
+        vkDestroyFence(logicalDevice, inFlightFences[i], nullptr);
+    }
+}
+
 Renderer::~Renderer() {
     vkDeviceWaitIdle(logicalDevice);
 
-    vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-    vkFreeCommandBuffers(logicalDevice, computeCommandPool, 1, &computeCommandBuffer);
+    DestroySyncObjects();
+
+    FreeGraphicsCommandBuffers();
+    vkFreeCommandBuffers(logicalDevice, computeCommandPool, static_cast<uint32_t>(computeCommandBuffers.size()), computeCommandBuffers.data());
 
     vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
     vkDestroyPipeline(logicalDevice, grassPipeline, nullptr);
     vkDestroyPipeline(logicalDevice, computePipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, clusterCullPipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, tramplePipeline, nullptr);
 
     vkDestroyPipelineLayout(logicalDevice, graphicsPipelineLayout, nullptr);
     vkDestroyPipelineLayout(logicalDevice, grassPipelineLayout, nullptr);
     vkDestroyPipelineLayout(logicalDevice, computePipelineLayout, nullptr);
 
+    // Writes the pipelines compiled this run back to disk
+    delete pipelineCache;
+    delete profiler;
+
     vkDestroyDescriptorSetLayout(logicalDevice, cameraDescriptorSetLayout, nullptr);
     vkDestroyDescriptorSetLayout(logicalDevice, modelDescriptorSetLayout, nullptr);
     vkDestroyDescriptorSetLayout(logicalDevice, timeDescriptorSetLayout, nullptr);
@@ -1352,4 +2163,7 @@ Renderer::~Renderer() {
     DestroyFrameResources();
     vkDestroyCommandPool(logicalDevice, computeCommandPool, nullptr);
     vkDestroyCommandPool(logicalDevice, graphicsCommandPool, nullptr);
+    for (VkCommandPool pool : recordCommandPools) {
+        vkDestroyCommandPool(logicalDevice, pool, nullptr);
+    }
 }
\ No newline at end of file
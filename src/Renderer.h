@@ -1,16 +1,33 @@
 #pragma once
 
 #include "Device.h"
+#include "MemoryAllocator.h"
 #include "SwapChain.h"
 #include "Scene.h"
 #include "Camera.h"
+#include "FramesInFlight.h"
+#include "BladeSimulationParams.h"
+
+#include <array>
+
+class GpuProfiler;
+class PipelineCache;
+class ThreadPool;
 
 class Renderer {
 public:
     Renderer() = delete;
-    Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera);
+    // simulationParams are baked into the simulation pipeline as specialization constants. The model draws
+    // are recorded over recordPool (the shared one if null), which must outlive the renderer.
+    Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera, const BladeSimulationParams& simulationParams = BladeSimulationParams(),
+        ThreadPool* recordPool = nullptr);
+    // Headless: render into offscreen color/depth targets instead of a swap chain
+    Renderer(Device* device, VkExtent2D extent, Scene* scene, Camera* camera, const BladeSimulationParams& simulationParams = BladeSimulationParams(),
+        ThreadPool* recordPool = nullptr);
     ~Renderer();
 
+    void Initialize();
+
     void CreateCommandPools();
 
     void CreateRenderPass();
@@ -23,13 +40,15 @@ public:
 
     void CreateDescriptorPool();
 
-    void CreateCameraDescriptorSet();
+    void CreateCameraDescriptorSets();
     void CreateModelDescriptorSets();
     void CreateGrassDescriptorSets();
-    void CreateTimeDescriptorSet();
+    void CreateTimeDescriptorSets();
     void CreateComputeDescriptorSets();
 
 
+    // Creates every pipeline below in parallel, through the pipeline cache persisted on disk
+    void CreatePipelines();
     void CreateGraphicsPipeline();
     void CreateGrassPipeline();
     void CreateComputePipeline();
@@ -39,20 +58,70 @@ public:
     void RecreateFrameResources();
 
     void RecordCommandBuffers();
-    void RecordComputeCommandBuffer();
+    void RecordComputeCommandBuffers();
+    // Records every frame in flight's command buffers again once the device is idle, as after a resize
+    // but without recreating the frame resources; for benchmarks
+    void RerecordCommandBuffers();
 
     void Frame();
 
+    bool IsHeadless() const;
+    VkExtent2D GetExtent() const;
+    VkFormat GetColorFormat() const;
+    uint32_t GetImageCount() const;
+
+    // CPU time (ms) of every headless Frame() call, including the wait for a free frame slot.
+    // Once the pipeline is full this converges on the GPU frame time.
+    const std::vector<float>& GetFrameTimes() const;
+    // GPU timings, pipeline statistics and visible blade counts of the last frames
+    GpuProfiler* GetProfiler() const;
+    // Frame in flight the next Frame() call simulates and draws
+    uint32_t GetCurrentFrame() const;
+    // Local size compute.comp was specialized with; the cluster list counts CLUSTER_SIZE / size workgroups per cluster
+    uint32_t GetSimulationWorkgroupSize() const;
+
 private:
+    void CreateSyncObjects();
+    void DestroySyncObjects();
+    // Records and submits the trample field's initial clear on the compute queue, and waits for it
+    void ClearTrampleField();
+
+    // simulationParams.workgroupSize if set (and valid for the device), otherwise one for the device
+    uint32_t ChooseSimulationWorkgroupSize() const;
+
+    VkCommandBuffer GetCommandBuffer(uint32_t frame, uint32_t image) const;
+    VkCommandBuffer GetDrawBatchCommandBuffer(uint32_t frame, uint32_t image, uint32_t batch) const;
+    void FreeGraphicsCommandBuffers();
+    // Gathers the draws of the scene's visible models for the frame in flight into modelDraws[frame],
+    // sorted by position
+    void BuildDrawList(uint32_t frame);
+    // Rebuilds the frame in flight's draw list and records its command buffers for every image: the draw
+    // batches in parallel over recordPool, then the grass and the primaries on the calling thread
+    void RecordFrame(uint32_t frame);
+    // Begins a secondary command buffer continuing the render pass on the image and sets the dynamic state
+    void BeginSecondaryCommandBuffer(VkCommandBuffer commandBuffer, uint32_t image);
+    // Draws [begin, end) of modelDraws[frame]; safe on any thread as long as no other one records the batch
+    void RecordDrawBatch(uint32_t frame, uint32_t image, uint32_t batch, size_t begin, size_t end);
+    void RecordGrassCommandBuffer(uint32_t frame, uint32_t image);
+    // The render pass, executing the secondary command buffers
+    void RecordCommandBuffer(uint32_t frame, uint32_t image);
+
     Device* device;
     VkDevice logicalDevice;
     SwapChain* swapChain;
     Scene* scene;
     Camera* camera;
 
+    BladeSimulationParams simulationParams;
+    uint32_t simulationWorkgroupSize = 0;
+
     VkCommandPool graphicsCommandPool;
     VkCommandPool computeCommandPool;
 
+    ThreadPool* recordPool;
+    // One per thread of recordPool; batch b is always recorded from pool b
+    std::vector<VkCommandPool> recordCommandPools;
+
     VkRenderPass renderPass;
 
     VkDescriptorSetLayout cameraDescriptorSetLayout;
@@ -63,12 +132,16 @@ private:
     
     VkDescriptorPool descriptorPool;
 
-    VkDescriptorSet cameraDescriptorSet;
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> cameraDescriptorSets;
     std::vector<VkDescriptorSet> modelDescriptorSets;
-    VkDescriptorSet timeDescriptorSet;
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> timeDescriptorSets;
     std::vector<VkDescriptorSet> grassDescriptorSets;
+    // Indexed [pool * MAX_FRAMES_IN_FLIGHT + frame]
     std::vector<VkDescriptorSet> computeDescriptorSets;
 
+    PipelineCache* pipelineCache = nullptr;
+    GpuProfiler* profiler = nullptr;
+
     VkPipelineLayout graphicsPipelineLayout;
     VkPipelineLayout grassPipelineLayout;
     VkPipelineLayout computePipelineLayout;
@@ -76,13 +149,45 @@ private:
     VkPipeline graphicsPipeline;
     VkPipeline grassPipeline;
     VkPipeline computePipeline;
+    VkPipeline clusterCullPipeline;
+    VkPipeline tramplePipeline;
+
+    // Offscreen color targets used in place of swap chain images when headless
+    VkExtent2D offscreenExtent = {};
+    std::vector<VkImage> offscreenImages;
+    std::vector<MemoryAllocation> offscreenImageMemories;
+    std::vector<float> frameTimes;
+
+    // Per frame in flight synchronization. The fence guards reuse of the slot's command buffers, uniform
+    // buffers and blade outputs; computeFinished hands the slot's blade outputs from the compute queue
+    // to the graphics queue.
+    std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> imageAvailableSemaphores;
+    std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> renderFinishedSemaphores;
+    std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> computeFinishedSemaphores;
+    std::array<VkFence, MAX_FRAMES_IN_FLIGHT> inFlightFences;
+    uint32_t currentFrame = 0;
+    // Frames submitted so far
+    uint64_t frameNumber = 0;
 
     std::vector<VkImageView> imageViews;
     VkImage depthImage;
-    VkDeviceMemory depthImageMemory;
+    MemoryAllocation depthImageMemory;
     VkImageView depthImageView;
     std::vector<VkFramebuffer> framebuffers;
 
+    // Indexed [frame * imageCount + image], see GetCommandBuffer
     std::vector<VkCommandBuffer> commandBuffers;
-    VkCommandBuffer computeCommandBuffer;
+    // Secondary command buffers of the render pass: the model draws in up to one batch per recording
+    // thread, indexed [(frame * imageCount + image) * recordCommandPools.size() + batch], and the grass,
+    // indexed like commandBuffers
+    std::vector<VkCommandBuffer> drawBatchCommandBuffers;
+    std::vector<VkCommandBuffer> grassCommandBuffers;
+    // Draw batches each frame in flight's command buffers execute
+    std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> drawBatchCounts = {};
+    // Draws of the visible models, per frame in flight, as of recordedSceneVersions. Rebuilt in place, so
+    // after the first recording neither building nor recording allocates.
+    std::array<std::vector<ModelDraw>, MAX_FRAMES_IN_FLIGHT> modelDraws;
+    // Scene::GetVersion() each frame in flight's command buffers were last recorded at
+    std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> recordedSceneVersions = {};
+    std::vector<VkCommandBuffer> computeCommandBuffers;
 };
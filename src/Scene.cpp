@@ -2,9 +2,14 @@
 #include "BufferUtils.h"
 
 Scene::Scene(Device* device) : device(device) {
-    BufferUtils::CreateBuffer(device, sizeof(Time), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, timeBuffer, timeBufferMemory);
-    vkMapMemory(device->GetVkDevice(), timeBufferMemory, 0, sizeof(Time), 0, &mappedData);
-    memcpy(mappedData, &time, sizeof(Time));
+    colliders = new Colliders(device);
+    trampleField = new TrampleField(device);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::CreateBuffer(device, sizeof(Time), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, timeBuffers[i], timeBufferMemories[i]);
+        mappedData[i] = timeBufferMemories[i].mapped;
+        memcpy(mappedData[i], &time, sizeof(Time));
+    }
 }
 
 
@@ -17,6 +22,14 @@ const std::vector<Blades*>& Scene::GetBlades() const {
   return blades;
 }
 
+Colliders* Scene::GetColliders() const {
+    return colliders;
+}
+
+TrampleField* Scene::GetTrampleField() const {
+    return trampleField;
+}
+
 void Scene::AddModel(Model* model) {
     models.push_back(model);
 }
@@ -25,6 +38,14 @@ void Scene::AddBlades(Blades* blades) {
   this->blades.push_back(blades);
 }
 
+void Scene::MarkDirty() {
+    version++;
+}
+
+uint64_t Scene::GetVersion() const {
+    return version;
+}
+
 
 
 float Scene::GetFPS() const { return fps; }
@@ -40,8 +61,6 @@ void Scene::UpdateTime() {
     time.deltaTime = nextDeltaTime.count();
     time.totalTime += time.deltaTime;
 
-    memcpy(mappedData, &time, sizeof(Time));
-
 
     // FPS calculation
     frameCounter++;
@@ -54,12 +73,23 @@ void Scene::UpdateTime() {
     }
 }
 
-VkBuffer Scene::GetTimeBuffer() const {
-    return timeBuffer;
+void Scene::UpdateBuffer(uint32_t frame) {
+    memcpy(mappedData[frame], &time, sizeof(Time));
+    colliders->UpdateBuffer(frame);
+    trampleField->UpdateBuffer(frame);
+    for (Model* model : models) {
+        model->UpdateBuffer(frame);
+    }
+}
+
+VkBuffer Scene::GetTimeBuffer(uint32_t frame) const {
+    return timeBuffers[frame];
 }
 
 Scene::~Scene() {
-    vkUnmapMemory(device->GetVkDevice(), timeBufferMemory);
-    vkDestroyBuffer(device->GetVkDevice(), timeBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), timeBufferMemory, nullptr);
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::DestroyBuffer(device, timeBuffers[i], timeBufferMemories[i]);
+    }
+    delete colliders;
+    delete trampleField;
 }
@@ -1,10 +1,14 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <array>
 #include <chrono>
 
 #include "Model.h"
 #include "Blades.h"
+#include "Colliders.h"
+#include "TrampleField.h"
+#include "FramesInFlight.h"
 
 using namespace std::chrono;
 
@@ -17,14 +21,19 @@ class Scene {
 private:
     Device* device;
     
-    VkBuffer timeBuffer;
-    VkDeviceMemory timeBufferMemory;
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> timeBuffers;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> timeBufferMemories;
     Time time;
     
-    void* mappedData;
+    std::array<void*, MAX_FRAMES_IN_FLIGHT> mappedData;
 
     std::vector<Model*> models;
     std::vector<Blades*> blades;
+    Colliders* colliders;
+    TrampleField* trampleField;
+
+    // Bumped whenever what the recorded command buffers draw changes
+    uint64_t version = 0;
 
     float fps = 0.0f;
     int frameCounter = 0;
@@ -40,13 +49,25 @@ public:
 
     const std::vector<Model*>& GetModels() const;
     const std::vector<Blades*>& GetBlades() const;
+    // Colliders pushing the grass of every blade pool
+    Colliders* GetColliders() const;
+    // Where the colliders have flattened the grass recently
+    TrampleField* GetTrampleField() const;
     
     void AddModel(Model* model);
     void AddBlades(Blades* blades);
 
-    VkBuffer GetTimeBuffer() const;
+    // Makes the renderer re-record each frame in flight's command buffers before it is next submitted,
+    // e.g. after models were shown or hidden
+    void MarkDirty();
+    uint64_t GetVersion() const;
+
+    VkBuffer GetTimeBuffer(uint32_t frame) const;
 
     void UpdateTime();
+    // Copies the current time, the binned colliders, the trample window and the models' per-frame state
+    // into the buffers of the given frame in flight
+    void UpdateBuffer(uint32_t frame);
 
     float GetFPS() const;
     const Time& GetTime() const;
@@ -1,31 +1,13 @@
-#include <fstream>
+#include <stdexcept>
 #include "ShaderModule.h"
-
-namespace {
-    std::vector<char> readFile(const std::string& filename) {
-        std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-        if (!file.is_open()) {
-            throw std::runtime_error("Failed to open file");
-        }
-
-        size_t fileSize = (size_t)file.tellg();
-        std::vector<char> buffer(fileSize);
-
-        file.seekg(0);
-        file.read(buffer.data(), fileSize);
-
-        file.close();
-        return buffer;
-    }
-}
+#include "EmbeddedShaders.h"
 
 // Wrap the shaders in shader modules
-VkShaderModule ShaderModule::Create(const std::vector<char>& code, VkDevice logicalDevice) {
+VkShaderModule ShaderModule::Create(const uint32_t* code, size_t size, VkDevice logicalDevice) {
     VkShaderModuleCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = code.size();
-    createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+    createInfo.codeSize = size;
+    createInfo.pCode = code;
 
     VkShaderModule shaderModule;
     if (vkCreateShaderModule(logicalDevice, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
@@ -35,6 +17,15 @@ VkShaderModule ShaderModule::Create(const std::vector<char>& code, VkDevice logi
     return shaderModule;
 }
 
-VkShaderModule ShaderModule::Create(const std::string& filename, VkDevice logicalDevice) {
-    return ShaderModule::Create(readFile(filename), logicalDevice);
+VkShaderModule ShaderModule::Create(const std::vector<char>& code, VkDevice logicalDevice) {
+    return ShaderModule::Create(reinterpret_cast<const uint32_t*>(code.data()), code.size(), logicalDevice);
+}
+
+VkShaderModule ShaderModule::Create(const std::string& name, VkDevice logicalDevice) {
+    for (const EmbeddedShaders::Entry& shader : EmbeddedShaders::entries) {
+        if (name == shader.name) {
+            return ShaderModule::Create(shader.code, shader.size, logicalDevice);
+        }
+    }
+    throw std::runtime_error("No embedded shader named " + name);
 }
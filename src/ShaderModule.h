@@ -6,5 +6,7 @@
 
 namespace ShaderModule {
     VkShaderModule Create(const std::vector<char>& code, VkDevice logicalDevice);
-    VkShaderModule Create(const std::string& filename, VkDevice logicalDevice);
+    VkShaderModule Create(const uint32_t* code, size_t size, VkDevice logicalDevice);
+    // One of the shaders compiled into the executable at build time, by source file name (e.g. "grass.vert")
+    VkShaderModule Create(const std::string& name, VkDevice logicalDevice);
 }
@@ -1,3 +1,4 @@
+#include <limits>
 #include <vector>
 #include "SwapChain.h"
 #include "Instance.h"
@@ -64,14 +65,6 @@ SwapChain::SwapChain(Device* device, VkSurfaceKHR vkSurface, unsigned int numBuf
   : device(device), vkSurface(vkSurface), numBuffers(numBuffers) {
     
     Create();
-
-    VkSemaphoreCreateInfo semaphoreInfo = {};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-
-    if (vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS ||
-        vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create semaphores");
-    }
 }
 
 void SwapChain::Create(int w, int h) {
@@ -184,21 +177,12 @@ VkImage SwapChain::GetVkImage(uint32_t index) const {
     return vkSwapChainImages[index];
 }
 
-VkSemaphore SwapChain::GetImageAvailableVkSemaphore() const {
-    return imageAvailableSemaphore;
-
-}
-
-VkSemaphore SwapChain::GetRenderFinishedVkSemaphore() const {
-    return renderFinishedSemaphore;
-}
-
 void SwapChain::Recreate(int w, int h) {
     Destroy();
     Create(w, h);
 }
 
-bool SwapChain::Acquire() {
+bool SwapChain::Acquire(VkSemaphore imageAvailableSemaphore) {
     if (ENABLE_VALIDATION) {
         // the validation layer implementation expects the application to explicitly synchronize with the GPU
         vkQueueWaitIdle(device->GetQueue(QueueFlags::Present));
@@ -219,7 +203,7 @@ bool SwapChain::Acquire() {
     return true;
 }
 
-bool SwapChain::Present() {
+bool SwapChain::Present(VkSemaphore renderFinishedSemaphore) {
     VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
 
     // Submit result back to swap chain for presentation
@@ -249,7 +233,5 @@ bool SwapChain::Present() {
 }
 
 SwapChain::~SwapChain() {
-    vkDestroySemaphore(device->GetVkDevice(), imageAvailableSemaphore, nullptr);
-    vkDestroySemaphore(device->GetVkDevice(), renderFinishedSemaphore, nullptr);
     Destroy();
 }
@@ -14,14 +14,14 @@ public:
     uint32_t GetIndex() const;
     uint32_t GetCount() const;
     VkImage GetVkImage(uint32_t index) const;
-    VkSemaphore GetImageAvailableVkSemaphore() const;
-    VkSemaphore GetRenderFinishedVkSemaphore() const;
     
     void Recreate(int w = 0, int h = 0);
     int width;
     int height;
-    bool Acquire();
-    bool Present();
+    // The renderer owns one semaphore pair per frame in flight and passes the current frame's semaphores
+    // to Acquire and Present
+    bool Acquire(VkSemaphore imageAvailableSemaphore);
+    bool Present(VkSemaphore renderFinishedSemaphore);
     ~SwapChain();
 
 private:
@@ -37,7 +37,4 @@ private:
     VkFormat vkSwapChainImageFormat;
     VkExtent2D vkSwapChainExtent;
     uint32_t imageIndex = 0;
-
-    VkSemaphore imageAvailableSemaphore;
-    VkSemaphore renderFinishedSemaphore;
 };
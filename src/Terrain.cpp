@@ -1,5 +1,15 @@
 #include "Terrain.h"
 #include "BufferUtils.h"
+#include "Heightfield.h"
+#include "Image.h"
+#include "UploadBatcher.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 
 
 float Terrain::GetHeightAt(float x, float z) const {
@@ -7,13 +17,13 @@ float Terrain::GetHeightAt(float x, float z) const {
     float gridSpacing = terrainSize / terrainResolution;
 
     // Clamp to terrain bounds
-    if (x < -halfSize || x > halfSize || z < -halfSize || z > halfSize) {
+    if (!Contains(x, z)) {
         return 0.0f; // Or some default/fallback value
     }
 
     // Transform world x/z to grid space
-    float localX = (x + halfSize) / gridSpacing;
-    float localZ = (z + halfSize) / gridSpacing;
+    float localX = (x - offsetX + halfSize) / gridSpacing;
+    float localZ = (z - offsetZ + halfSize) / gridSpacing;
 
     int x0 = static_cast<int>(floor(localX));
     int z0 = static_cast<int>(floor(localZ));
@@ -30,16 +40,10 @@ float Terrain::GetHeightAt(float x, float z) const {
     float tx = localX - x0;
     float tz = localZ - z0;
 
-    // Get indices into the flattened vertex array
-    int index00 = z0 * (terrainResolution + 1) + x0;
-    int index10 = z0 * (terrainResolution + 1) + x1;
-    int index01 = z1 * (terrainResolution + 1) + x0;
-    int index11 = z1 * (terrainResolution + 1) + x1;
-
-    float h00 = vertices[index00].pos.y;
-    float h10 = vertices[index10].pos.y;
-    float h01 = vertices[index01].pos.y;
-    float h11 = vertices[index11].pos.y;
+    float h00 = GetVertexHeight(x0, z0);
+    float h10 = GetVertexHeight(x1, z0);
+    float h01 = GetVertexHeight(x0, z1);
+    float h11 = GetVertexHeight(x1, z1);
 
     // Bilinear interpolation
     float h0 = glm::mix(h00, h10, tx);
@@ -50,6 +54,220 @@ float Terrain::GetHeightAt(float x, float z) const {
 }
 
 
+bool Terrain::Raycast(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax, float& tHit) const {
+    auto lowestAlongRay = [&](float t0, float t1) {
+        return std::min(origin.y + direction.y * t0, origin.y + direction.y * t1);
+    };
+    if (tMin > tMax || lowestAlongRay(tMin, tMax) > maxHeight) {
+        return false;
+    }
+
+    // Grid frame: origin at the tile's corner, one unit per world unit
+    float halfSize = terrainSize / 2.0f;
+    float gridSpacing = terrainSize / terrainResolution;
+    glm::vec2 gridOrigin(origin.x - offsetX + halfSize, origin.z - offsetZ + halfSize);
+    glm::vec2 gridDirection(direction.x, direction.z);
+
+    auto visitCell = [&](const glm::ivec2& cell, float tEnter, float tExit) {
+        // Ray in the cell's unit square at tEnter
+        glm::vec2 entry = (gridOrigin + gridDirection * tEnter) / gridSpacing - glm::vec2(cell);
+        return Heightfield::IntersectBilinearPatch(
+            GetVertexHeight(cell.x, cell.y), GetVertexHeight(cell.x + 1, cell.y),
+            GetVertexHeight(cell.x, cell.y + 1), GetVertexHeight(cell.x + 1, cell.y + 1),
+            entry.x, entry.y, origin.y + direction.y * tEnter,
+            direction.x / gridSpacing, direction.z / gridSpacing, direction.y,
+            tEnter, tExit, tHit);
+    };
+
+    // Coarse walk over the blocks, fine walk over the cells of the blocks the ray gets low enough in
+    return Heightfield::TraverseGrid(gridOrigin, gridDirection, tMin, tMax, gridSpacing * HEIGHT_BLOCK, glm::ivec2(blockCount),
+        [&](const glm::ivec2& block, float tEnter, float tExit) {
+            if (lowestAlongRay(tEnter, tExit) > blockMaxHeights[block.y * blockCount + block.x]) {
+                return false;
+            }
+            return Heightfield::TraverseGrid(gridOrigin, gridDirection, tEnter, tExit, gridSpacing, glm::ivec2(terrainResolution), visitCell);
+        });
+}
+
+void Terrain::UpdateHeightBounds() {
+    blockCount = (terrainResolution + HEIGHT_BLOCK - 1) / HEIGHT_BLOCK;
+    blockMaxHeights.assign(static_cast<size_t>(blockCount) * blockCount, -std::numeric_limits<float>::max());
+    maxHeight = -std::numeric_limits<float>::max();
+
+    // A vertex on a block border belongs to the cells on both sides
+    for (int z = 0; z <= terrainResolution; z++) {
+        for (int x = 0; x <= terrainResolution; x++) {
+            float height = GetVertexHeight(x, z);
+            maxHeight = std::max(maxHeight, height);
+
+            int bx0 = std::min(std::max(x - 1, 0) / HEIGHT_BLOCK, blockCount - 1);
+            int bx1 = std::min(x / HEIGHT_BLOCK, blockCount - 1);
+            int bz0 = std::min(std::max(z - 1, 0) / HEIGHT_BLOCK, blockCount - 1);
+            int bz1 = std::min(z / HEIGHT_BLOCK, blockCount - 1);
+            for (int bz = bz0; bz <= bz1; bz++) {
+                for (int bx = bx0; bx <= bx1; bx++) {
+                    float& blockMax = blockMaxHeights[bz * blockCount + bx];
+                    blockMax = std::max(blockMax, height);
+                }
+            }
+        }
+    }
+
+    // Quadtree nodes: level 0 from the vertices (a vertex on a node border belongs to both nodes), every
+    // coarser level from its four children
+    nodeLevelOffsets.resize(grid->GetLodCount());
+    size_t nodeCount = 0;
+    for (int level = 0; level < grid->GetLodCount(); level++) {
+        nodeLevelOffsets[level] = nodeCount;
+        nodeCount += static_cast<size_t>(GetNodesPerSide(level)) * GetNodesPerSide(level);
+    }
+    nodeHeightRanges.assign(nodeCount, glm::vec2(std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()));
+
+    int leafCells = 2 * grid->GetPatchSize();
+    int leavesPerSide = GetNodesPerSide(0);
+    for (int nz = 0; nz < leavesPerSide; nz++) {
+        for (int nx = 0; nx < leavesPerSide; nx++) {
+            glm::vec2& range = nodeHeightRanges[nz * leavesPerSide + nx];
+            for (int z = nz * leafCells; z <= (nz + 1) * leafCells; z++) {
+                for (int x = nx * leafCells; x <= (nx + 1) * leafCells; x++) {
+                    float height = GetVertexHeight(x, z);
+                    range.x = std::min(range.x, height);
+                    range.y = std::max(range.y, height);
+                }
+            }
+        }
+    }
+
+    for (int level = 1; level < grid->GetLodCount(); level++) {
+        int side = GetNodesPerSide(level);
+        int childSide = GetNodesPerSide(level - 1);
+        for (int nz = 0; nz < side; nz++) {
+            for (int nx = 0; nx < side; nx++) {
+                glm::vec2& range = nodeHeightRanges[nodeLevelOffsets[level] + nz * side + nx];
+                for (int child = 0; child < 4; child++) {
+                    int cx = 2 * nx + (child & 1);
+                    int cz = 2 * nz + (child >> 1);
+                    const glm::vec2& childRange = nodeHeightRanges[nodeLevelOffsets[level - 1] + cz * childSide + cx];
+                    range.x = std::min(range.x, childRange.x);
+                    range.y = std::max(range.y, childRange.y);
+                }
+            }
+        }
+    }
+}
+
+float Terrain::GetVertexHeight(int x, int z) const {
+    return heights[z * (terrainResolution + 1) + x];
+}
+
+int Terrain::GetNodesPerSide(int level) const {
+    return 1 << (grid->GetLodCount() - 1 - level);
+}
+
+float Terrain::GetNodeDistance(int level, int x, int z, const glm::vec3& position) const {
+    float halfSize = terrainSize / 2.0f;
+    float nodeSize = terrainSize / GetNodesPerSide(level);
+    const glm::vec2& heightRange = nodeHeightRanges[nodeLevelOffsets[level] + z * GetNodesPerSide(level) + x];
+
+    glm::vec3 boxMin(offsetX - halfSize + x * nodeSize, heightRange.x, offsetZ - halfSize + z * nodeSize);
+    glm::vec3 boxMax(boxMin.x + nodeSize, heightRange.y, boxMin.z + nodeSize);
+    return glm::length(position - glm::clamp(position, boxMin, boxMax));
+}
+
+float Terrain::GetLodRange(int level) const {
+    return LOD_RANGE_SCALE * terrainSize / GetNodesPerSide(level);
+}
+
+glm::vec2 Terrain::GetMorphRange(int level) const {
+    if (level == grid->GetLodCount() - 1) {
+        // The coarsest level has no range and never morphs
+        return glm::vec2(std::numeric_limits<float>::max() / 2.0f, std::numeric_limits<float>::max());
+    }
+
+    float previousRange = level > 0 ? GetLodRange(level - 1) : 0.0f;
+    float band = GetLodRange(level) - previousRange;
+    return glm::vec2(previousRange + band * MORPH_START, previousRange + band * MORPH_END);
+}
+
+void Terrain::SelectLod(const glm::vec3& cameraPosition) {
+    patches.clear();
+    SelectNode(grid->GetLodCount() - 1, 0, 0, cameraPosition);
+}
+
+bool Terrain::SelectNode(int level, int x, int z, const glm::vec3& cameraPosition) {
+    float distance = GetNodeDistance(level, x, z, cameraPosition);
+    bool coarsest = level == grid->GetLodCount() - 1;
+    if (!coarsest && distance > GetLodRange(level)) {
+        return false;
+    }
+
+    if (level == 0 || distance > GetLodRange(level - 1)) {
+        for (int quadrant = 0; quadrant < 4; quadrant++) {
+            AddPatch(level, x, z, quadrant & 1, quadrant >> 1, cameraPosition);
+        }
+        return true;
+    }
+
+    // Children out of their range are drawn at this level
+    for (int quadrant = 0; quadrant < 4; quadrant++) {
+        if (!SelectNode(level - 1, 2 * x + (quadrant & 1), 2 * z + (quadrant >> 1), cameraPosition)) {
+            AddPatch(level, x, z, quadrant & 1, quadrant >> 1, cameraPosition);
+        }
+    }
+    return true;
+}
+
+void Terrain::AddPatch(int level, int x, int z, int quadrantX, int quadrantZ, const glm::vec3& cameraPosition) {
+    int patchSize = grid->GetPatchSize();
+    int step = 1 << level;
+
+    TerrainPatchInstance patch;
+    patch.patch = glm::vec4(
+        static_cast<float>((2 * x + quadrantX) * patchSize * step),
+        static_cast<float>((2 * z + quadrantZ) * patchSize * step),
+        static_cast<float>(step), 0.0f);
+    patch.morphRange = GetMorphRange(level);
+    patch.lodCenter = cameraPosition;
+    patches.push_back(patch);
+}
+
+uint32_t Terrain::GetTriangleCount() const {
+    return static_cast<uint32_t>(patches.size()) * (indexCount / 3);
+}
+
+void Terrain::UpdateBuffer(uint32_t frame) {
+    char* mapped = static_cast<char*>(drawBufferMemories[frame].mapped);
+
+    VkDrawIndexedIndirectCommand draw = {};
+    draw.indexCount = indexCount;
+    draw.instanceCount = shown ? static_cast<uint32_t>(patches.size()) : 0;
+    memcpy(mapped, &draw, sizeof(draw));
+    memcpy(mapped + sizeof(draw), patches.data(), draw.instanceCount * sizeof(TerrainPatchInstance));
+}
+
+void Terrain::SetShown(bool shown) {
+    this->shown = shown;
+}
+
+ModelDraw Terrain::GetDraw(uint32_t frame) const {
+    ModelDraw draw;
+    // The patch, and the instances behind the draw arguments
+    draw.vertexBuffers = { vertexBuffer, drawBuffers[frame] };
+    draw.vertexOffsets = { 0, sizeof(VkDrawIndexedIndirectCommand) };
+    draw.vertexBindingCount = 2;
+    draw.indexBuffer = indexBuffer;
+    draw.indexType = indexType;
+    draw.indexCount = indexCount;
+    draw.indirectBuffer = drawBuffers[frame];
+
+    // The root node's height range is the tile's
+    float halfSize = terrainSize / 2.0f;
+    const glm::vec2& heightRange = nodeHeightRanges.back();
+    draw.boundsMin = glm::vec3(offsetX - halfSize, heightRange.x, offsetZ - halfSize);
+    draw.boundsMax = glm::vec3(offsetX + halfSize, heightRange.y, offsetZ + halfSize);
+    return draw;
+}
+
 bool Terrain::Contains(float x, float z) const {
     float halfSize = terrainSize / 2.0f;
 
@@ -61,11 +279,23 @@ bool Terrain::Contains(float x, float z) const {
 
 
 
-Terrain::Terrain(Device* device, VkCommandPool commandPool, float size, int resolution, float offsetX, float offsetZ)
-    : Model(device, commandPool, {}, {}), offsetX(offsetX), offsetZ(offsetZ)
-{
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
+void Terrain::UpdateModelMatrix() {
+    // Grid vertex (x, z) lands at the tile's corner plus (x, z) grid steps; heights pass through
+    float halfSize = terrainSize / 2.0f;
+    float step = terrainSize / terrainResolution;
+    modelBufferObject.modelMatrix = glm::scale(
+        glm::translate(glm::mat4(1.0f), glm::vec3(offsetX - halfSize, 0.0f, offsetZ - halfSize)),
+        glm::vec3(step, 1.0f, step));
+
+    // Like Load, only written while no frame in flight draws the tile
+    memcpy(modelUBOData, &modelBufferObject, sizeof(ModelBufferObject));
+}
+
+
+
+std::vector<float> Terrain::GenerateHeights(float size, int resolution, float offsetX, float offsetZ) {
+    std::vector<float> heights;
+    heights.reserve(static_cast<size_t>(resolution + 1) * (resolution + 1));
 
     float halfSize = size / 2.0f;
     float step = size / resolution;
@@ -74,35 +304,83 @@ Terrain::Terrain(Device* device, VkCommandPool commandPool, float size, int reso
         for (int x = 0; x <= resolution; x++) {
             float xpos = -halfSize + x * step + offsetX;
             float zpos = -halfSize + z * step + offsetZ;
-            float ypos = NoiseUtils::Noise(xpos * 0.5f, zpos * 0.5f) * 2.0f;
-            //float ypos = 0.0;
-
-            vertices.push_back({
-                glm::vec3(xpos, ypos, zpos),
-                glm::vec3(0, 1, 0),
-                glm::vec2(x / (float)resolution, z / (float)resolution)
-                });
+            heights.push_back(NoiseUtils::Noise(xpos * 0.5f, zpos * 0.5f) * 2.0f);
         }
     }
 
-    for (int z = 0; z < resolution; z++) {
-        for (int x = 0; x < resolution; x++) {
-            uint32_t topLeft = z * (resolution + 1) + x;
-            uint32_t topRight = topLeft + 1;
-            uint32_t bottomLeft = (z + 1) * (resolution + 1) + x;
-            uint32_t bottomRight = bottomLeft + 1;
+    return heights;
+}
 
-            indices.insert(indices.end(), {
-                topLeft, bottomLeft, topRight,
-                topRight, bottomLeft, bottomRight
-                });
-        }
+Terrain::Terrain(Device* device, UploadBatcher* uploader, const TerrainGrid* grid, float size, float offsetX, float offsetZ)
+    : Terrain(device, uploader, grid, size, GenerateHeights(size, grid->GetResolution(), offsetX, offsetZ), offsetX, offsetZ) {
+}
+
+Terrain::Terrain(Device* device, UploadBatcher* uploader, const TerrainGrid* grid, float size, std::vector<float> heights,
+    float offsetX, float offsetZ)
+    : Model(device, uploader, {}, {}), grid(grid), terrainSize(size), terrainResolution(grid->GetResolution()), offsetX(offsetX), offsetZ(offsetZ)
+{
+    if (heights.size() != grid->GetVertexCount()) {
+        throw std::runtime_error("Terrain tile data does not match its resolution");
+    }
+
+    // The grid's buffers; Model only destroys buffers of its own vertices and indices, and this has none
+    vertexBuffer = grid->GetVertexBuffer();
+    indexBuffer = grid->GetIndexBuffer();
+    indexType = grid->GetIndexType();
+    indexCount = grid->GetIndexCount();
+
+    uint32_t side = static_cast<uint32_t>(terrainResolution + 1);
+    Image::Create(device, side, side, TERRAIN_HEIGHT_FORMAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        heightMap, heightMapMemory);
+    vertexTextureView = Image::CreateView(device, heightMap, TERRAIN_HEIGHT_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT);
+    vertexTextureSampler = grid->GetHeightSampler();
+
+    // Room for every leaf node, the finest possible selection
+    size_t maxPatches = 4 * static_cast<size_t>(GetNodesPerSide(0)) * GetNodesPerSide(0);
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::CreateBuffer(device, sizeof(VkDrawIndexedIndirectCommand) + maxPatches * sizeof(TerrainPatchInstance),
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            drawBuffers[i], drawBufferMemories[i]);
+    }
+
+    this->heights = std::move(heights);
+    UpdateHeightBounds();
+    UpdateModelMatrix();
+    uploader->UploadImage(this->heights.data(), this->heights.size() * sizeof(float), heightMap, side, side,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    // The whole tile at the coarsest level until the first SelectLod
+    for (int quadrant = 0; quadrant < 4; quadrant++) {
+        AddPatch(grid->GetLodCount() - 1, 0, 0, quadrant & 1, quadrant >> 1, glm::vec3(0.0f));
+    }
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        UpdateBuffer(i);
+    }
+}
+
+Terrain::~Terrain() {
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::DestroyBuffer(device, drawBuffers[i], drawBufferMemories[i]);
+    }
+    vkDestroyImageView(device->GetVkDevice(), vertexTextureView, nullptr);
+    Image::Destroy(device, heightMap, heightMapMemory);
+}
+
+void Terrain::Load(UploadBatcher* uploader, std::vector<float> heights, float offsetX, float offsetZ) {
+    if (heights.size() != this->heights.size()) {
+        throw std::runtime_error("Terrain tile reloaded with a different resolution");
     }
 
-    this->vertices = vertices;
-    this->indices = indices;
+    // The grid is the same for every tile of this resolution
+    this->heights = std::move(heights);
+    this->offsetX = offsetX;
+    this->offsetZ = offsetZ;
+    UpdateHeightBounds();
+    UpdateModelMatrix();
 
-    BufferUtils::CreateVertexIndexBuffers(device, commandPool, vertices, indices,
-        vertexBuffer, vertexBufferMemory,
-        indexBuffer, indexBufferMemory);
+    uint32_t side = static_cast<uint32_t>(terrainResolution + 1);
+    uploader->UploadImage(this->heights.data(), this->heights.size() * sizeof(float), heightMap, side, side,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 }
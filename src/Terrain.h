@@ -1,21 +1,111 @@
 #pragma once
 
+#include <array>
+#include "FramesInFlight.h"
 #include "Model.h"
 #include "NoiseUtils.h"
-#include "Vertex.h"
+#include "TerrainGrid.h"
 
+// Square heightfield tile. Draws the patch of its TerrainGrid; all the tile owns on the GPU is its height
+// map (one TERRAIN_HEIGHT_FORMAT texel per grid vertex), a model matrix placing the grid in the world and
+// the patch instances of its LOD selection.
+//
+// LOD is CDLOD: the tile is a quadtree of the grid's LOD levels, and SelectLod walks it from the root,
+// splitting every node whose bounding box is within the range of the next finer level. Level l reaches
+// LOD_RANGE_SCALE node sizes of level l from the camera, so ranges double from level to level and the
+// number of patches drawn grows with the log of the view distance, not with the area. Quadrants of a
+// split node that are out of their own range are drawn by the node. Over the outer part of its range
+// (MORPH_START to MORPH_END) a level's odd vertices slide onto the even ones, so by the end of the range
+// the patch matches the next coarser level exactly: adjacent nodes, in the same tile or not, are at most
+// one level apart and meet without cracks, and levels do not pop.
 class Terrain : public Model {
 private: 
+    const TerrainGrid* grid;
     float terrainSize;
     int terrainResolution;
-    std::vector<Vertex> vertices;
 
     float offsetX, offsetZ;
 
+    // Height of every grid vertex, row by row: what the height map holds, kept for height queries
+    std::vector<float> heights;
+    VkImage heightMap;
+    MemoryAllocation heightMapMemory;
+
+    // Highest vertex of every HEIGHT_BLOCK x HEIGHT_BLOCK block of cells and of the whole tile, so rays
+    // skip the parts of the tile they pass over
+    std::vector<float> blockMaxHeights;
+    int blockCount;
+    float maxHeight;
+
+    // Lowest and highest vertex of every quadtree node, level by level from the finest, row-major within
+    // a level
+    std::vector<glm::vec2> nodeHeightRanges;
+    std::vector<size_t> nodeLevelOffsets;
+
+    // Patches of the last SelectLod, and the draw arguments and instances of every frame in flight
+    std::vector<TerrainPatchInstance> patches;
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> drawBuffers;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> drawBufferMemories;
+    // A hidden tile keeps its draw, with no instances
+    bool shown = true;
+
+    void UpdateHeightBounds();
+    void UpdateModelMatrix();
+    float GetVertexHeight(int x, int z) const;
+
+    int GetNodesPerSide(int level) const;
+    float GetNodeDistance(int level, int x, int z, const glm::vec3& position) const;
+    float GetLodRange(int level) const;
+    glm::vec2 GetMorphRange(int level) const;
+    // Returns false, adding nothing, if the node is out of its level's range
+    bool SelectNode(int level, int x, int z, const glm::vec3& cameraPosition);
+    void AddPatch(int level, int x, int z, int quadrantX, int quadrantZ, const glm::vec3& cameraPosition);
+
 public:
-    Terrain(Device* device, VkCommandPool commandPool, float size, int resolution, float offsetX = 0.0f, float offsetZ = 0.0f);
+    static constexpr int HEIGHT_BLOCK = 8;
+    // Range of a LOD level, in node sizes of that level. Keeping the patches crack-free needs a node's
+    // diagonal (heights included) to stay under MORPH_START of its range.
+    static constexpr float LOD_RANGE_SCALE = 4.0f;
+    // Where a level starts and finishes morphing, as fractions of the way from the previous level's range
+    // to its own
+    static constexpr float MORPH_START = 0.7f;
+    static constexpr float MORPH_END = 0.95f;
+
+    // The grid must outlive the tile
+    Terrain(Device* device, UploadBatcher* uploader, const TerrainGrid* grid, float size, float offsetX = 0.0f, float offsetZ = 0.0f);
+    // Tile of already generated (or cached) heights, see GenerateHeights
+    Terrain(Device* device, UploadBatcher* uploader, const TerrainGrid* grid, float size, std::vector<float> heights,
+        float offsetX, float offsetZ);
+    ~Terrain();
+
+    // Heights of the grid vertices of the tile centered at (offsetX, offsetZ), row by row. Pure CPU work,
+    // safe on any thread.
+    static std::vector<float> GenerateHeights(float size, int resolution, float offsetX, float offsetZ);
+
+    // Moves the tile: queues the upload of heights from GenerateHeights (same size and resolution) over
+    // the height map. The map must not be read by any frame in flight until the upload has landed.
+    void Load(UploadBatcher* uploader, std::vector<float> heights, float offsetX, float offsetZ);
+
+    // Picks the patches to draw for a camera at cameraPosition. Until the first call the whole tile is
+    // drawn at the coarsest level. Reaches the GPU with the next UpdateBuffer.
+    void SelectLod(const glm::vec3& cameraPosition);
+    // Triangles of the current selection
+    uint32_t GetTriangleCount() const;
+
+    // Shows or hides the tile. Unlike SetVisible it stays in the recorded draws, drawing nothing while
+    // hidden, so no re-recording is needed. Reaches the GPU with the next UpdateBuffer.
+    void SetShown(bool shown);
+
+    void UpdateBuffer(uint32_t frame) override;
+    // One indexed indirect draw of the selected patches, bounded by the tile's footprint and height range
+    ModelDraw GetDraw(uint32_t frame) const override;
+
     float GetHeightAt(float x, float z) const;
 
+    // First hit of origin + t * direction with the bilinearly interpolated surface (the one GetHeightAt
+    // samples) for t in [tMin, tMax]
+    bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax, float& tHit) const;
+
     bool Contains(float x, float z) const;
 
     glm::vec2 GetOffset() const { return glm::vec2(offsetX, offsetZ); }
@@ -0,0 +1,130 @@
+#include "TerrainGrid.h"
+#include "BufferUtils.h"
+
+#include <limits>
+#include <stdexcept>
+
+TerrainGrid::TerrainGrid(Device* device, UploadBatcher* uploader, int resolution)
+    : device(device), resolution(resolution) {
+    if (resolution <= 0 || resolution >= std::numeric_limits<uint16_t>::max() || resolution % 2 != 0) {
+        throw std::runtime_error("Terrain resolution must be even and below 65535");
+    }
+
+    // Level 0 nodes must split into quadrants of an even number of cells, so every patch starts on a
+    // vertex of the next coarser level
+    patchSize = resolution / 2;
+    lodCount = 1;
+    while (patchSize % 4 == 0 && patchSize / 2 >= TERRAIN_MIN_PATCH_SIZE) {
+        patchSize /= 2;
+        lodCount++;
+    }
+
+    std::vector<TerrainGridVertex> vertices;
+    vertices.reserve(static_cast<size_t>(patchSize + 1) * (patchSize + 1));
+    for (int z = 0; z <= patchSize; z++) {
+        for (int x = 0; x <= patchSize; x++) {
+            vertices.push_back({ static_cast<uint16_t>(x), static_cast<uint16_t>(z) });
+        }
+    }
+    BufferUtils::CreateBufferFromData(device, uploader, vertices.data(), vertices.size() * sizeof(TerrainGridVertex),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+
+    std::vector<uint32_t> indices = GenerateIndices(patchSize);
+    indexCount = static_cast<uint32_t>(indices.size());
+    if (vertices.size() <= 65536) {
+        std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+        indexType = VK_INDEX_TYPE_UINT16;
+        BufferUtils::CreateBufferFromData(device, uploader, shortIndices.data(), shortIndices.size() * sizeof(uint16_t),
+            VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
+    }
+    else {
+        indexType = VK_INDEX_TYPE_UINT32;
+        BufferUtils::CreateBufferFromData(device, uploader, indices.data(), indices.size() * sizeof(uint32_t),
+            VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
+    }
+
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.mipLodBias = 0.0f;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = 0.0f;
+
+    if (vkCreateSampler(device->GetVkDevice(), &samplerInfo, nullptr, &heightSampler) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create terrain height sampler");
+    }
+}
+
+TerrainGrid::~TerrainGrid() {
+    vkDestroySampler(device->GetVkDevice(), heightSampler, nullptr);
+    BufferUtils::DestroyBuffer(device, indexBuffer, indexBufferMemory);
+    BufferUtils::DestroyBuffer(device, vertexBuffer, vertexBufferMemory);
+}
+
+std::vector<uint32_t> TerrainGrid::GenerateIndices(int resolution) {
+    std::vector<uint32_t> indices;
+    indices.reserve(static_cast<size_t>(resolution) * resolution * 6);
+
+    for (int z = 0; z < resolution; z++) {
+        for (int x = 0; x < resolution; x++) {
+            uint32_t topLeft = z * (resolution + 1) + x;
+            uint32_t topRight = topLeft + 1;
+            uint32_t bottomLeft = (z + 1) * (resolution + 1) + x;
+            uint32_t bottomRight = bottomLeft + 1;
+
+            indices.insert(indices.end(), {
+                topLeft, bottomLeft, topRight,
+                topRight, bottomLeft, bottomRight
+                });
+        }
+    }
+
+    return indices;
+}
+
+int TerrainGrid::GetResolution() const {
+    return resolution;
+}
+
+uint32_t TerrainGrid::GetVertexCount() const {
+    return static_cast<uint32_t>((resolution + 1) * (resolution + 1));
+}
+
+int TerrainGrid::GetPatchSize() const {
+    return patchSize;
+}
+
+int TerrainGrid::GetLodCount() const {
+    return lodCount;
+}
+
+VkBuffer TerrainGrid::GetVertexBuffer() const {
+    return vertexBuffer;
+}
+
+VkBuffer TerrainGrid::GetIndexBuffer() const {
+    return indexBuffer;
+}
+
+VkIndexType TerrainGrid::GetIndexType() const {
+    return indexType;
+}
+
+uint32_t TerrainGrid::GetIndexCount() const {
+    return indexCount;
+}
+
+VkSampler TerrainGrid::GetHeightSampler() const {
+    return heightSampler;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+#include <array>
+#include <vector>
+#include "Device.h"
+#include "MemoryAllocator.h"
+
+class UploadBatcher;
+
+// Vertex of the shared terrain patch: its integer coordinates, x and z in [0, patch size]. Everything else
+// comes from the tile and the patch instance, see shaders/graphics.vert.
+struct TerrainGridVertex {
+    uint16_t x;
+    uint16_t z;
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(TerrainGridVertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 1> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 1> attributeDescriptions = {};
+
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R16G16_UINT;
+        attributeDescriptions[0].offset = offsetof(TerrainGridVertex, x);
+
+        return attributeDescriptions;
+    }
+};
+
+// One patch of a tile's LOD selection, drawn as an instance of the shared patch (vertex binding 1)
+struct TerrainPatchInstance {
+    // xy: grid vertex of the tile the patch starts at, z: grid cells per patch cell, w: unused
+    glm::vec4 patch;
+    // Distances from lodCenter over which the patch morphs into the next coarser level
+    glm::vec2 morphRange;
+    // Camera position the selection was made for. The vertex shader morphs by the distance to this rather
+    // than to the camera it renders with, so morphing always agrees with the selection.
+    glm::vec3 lodCenter;
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 1;
+        bindingDescription.stride = sizeof(TerrainPatchInstance);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+
+        attributeDescriptions[0].binding = 1;
+        attributeDescriptions[0].location = 1;
+        attributeDescriptions[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributeDescriptions[0].offset = offsetof(TerrainPatchInstance, patch);
+
+        attributeDescriptions[1].binding = 1;
+        attributeDescriptions[1].location = 2;
+        attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(TerrainPatchInstance, morphRange);
+
+        attributeDescriptions[2].binding = 1;
+        attributeDescriptions[2].location = 3;
+        attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[2].offset = offsetof(TerrainPatchInstance, lodCenter);
+
+        return attributeDescriptions;
+    }
+};
+
+// Smallest patch the LOD levels are halved down to, in cells per side
+constexpr static int TERRAIN_MIN_PATCH_SIZE = 8;
+
+// Heights of a tile's grid vertices, row by row, sampled by the vertex stage
+constexpr static VkFormat TERRAIN_HEIGHT_FORMAT = VK_FORMAT_R32_SFLOAT;
+
+// Geometry shared by every terrain tile of one resolution: a square patch of patch size x patch size cells
+// and its triangle list. Tiles only differ in their height map and model matrix, so a tile costs the GPU
+// one small R32F image instead of a vertex and index buffer of its own.
+//
+// A tile is a quadtree of LOD levels (see Terrain::SelectLod). A node of level l covers 2 * patch size
+// cells with 2^l cells per patch cell and is drawn as four patch instances, one per quadrant; level 0 is
+// the full resolution, level GetLodCount() - 1 is the whole tile. The patch size is the resolution
+// halved as long as it stays even and at least TERRAIN_MIN_PATCH_SIZE, so resolution 128 has 4 levels
+// of 8-cell patches and resolution 100 has a single one. Indices are 16-bit while the patch has at most
+// 65536 vertices.
+class TerrainGrid {
+public:
+    // The buffers are in place after the uploader's next Flush. Throws if the resolution is not even.
+    TerrainGrid(Device* device, UploadBatcher* uploader, int resolution);
+    ~TerrainGrid();
+
+    TerrainGrid(const TerrainGrid&) = delete;
+    TerrainGrid& operator=(const TerrainGrid&) = delete;
+
+    // Triangle list over a grid of resolution x resolution cells, (resolution + 1) vertices per row
+    static std::vector<uint32_t> GenerateIndices(int resolution);
+
+    int GetResolution() const;
+    // Grid vertices of a tile, (resolution + 1)^2; the size of a height map
+    uint32_t GetVertexCount() const;
+    int GetPatchSize() const;
+    int GetLodCount() const;
+
+    VkBuffer GetVertexBuffer() const;
+    VkBuffer GetIndexBuffer() const;
+    VkIndexType GetIndexType() const;
+    uint32_t GetIndexCount() const;
+
+    // Nearest, clamped; height maps are read with texelFetch
+    VkSampler GetHeightSampler() const;
+
+private:
+    Device* device;
+    int resolution;
+    int patchSize;
+    int lodCount;
+
+    VkBuffer vertexBuffer;
+    MemoryAllocation vertexBufferMemory;
+    VkBuffer indexBuffer;
+    MemoryAllocation indexBufferMemory;
+    VkIndexType indexType;
+    uint32_t indexCount;
+
+    VkSampler heightSampler;
+};
@@ -1,47 +1,350 @@
 #include "TerrainManager.h"
+#include "Heightfield.h"
 #include "Image.h"
+#include "UploadBatcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+
+namespace {
+    // How far (in tiles) past the edge of its center tile the camera may go before the window follows,
+    // so moving back and forth over a tile border does not stream the same tiles in and out
+    constexpr float WINDOW_HYSTERESIS = 0.25f;
+
+    // Update calls a hidden slot waits before its buffers are overwritten: every frame in flight may
+    // still draw it, and the next frame's simulation may already be queued on the compute queue
+    constexpr uint64_t RETIRE_DELAY = MAX_FRAMES_IN_FLIGHT + 1;
+}
 
 float TerrainManager::GetHeightAt(float x, float z) const {
-    for (Terrain* tile : terrainTiles) {
-        if (tile->Contains(x, z)) {
-            return tile->GetHeightAt(x, z);
-        }
+    // Tile k covers [(k - 0.5) * tileSize, (k + 0.5) * tileSize]
+    glm::ivec2 key(static_cast<int>(std::floor(x / tileSize + 0.5f)), static_cast<int>(std::floor(z / tileSize + 0.5f)));
+    const Terrain* tile = FindTile(key);
+    return tile != nullptr ? tile->GetHeightAt(x, z) : 0.0f;
+}
+
+bool TerrainManager::Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, glm::vec3& hit) const {
+    // Tile grid frame: origin at the window's corner
+    glm::vec2 windowCorner = (glm::vec2(windowOrigin) - 0.5f) * tileSize;
+    glm::vec2 gridOrigin = glm::vec2(origin.x, origin.z) - windowCorner;
+
+    float tHit = 0.0f;
+    bool found = Heightfield::TraverseGrid(gridOrigin, glm::vec2(direction.x, direction.z), 0.0f, maxDistance, tileSize, glm::ivec2(gridWidth, gridHeight),
+        [&](const glm::ivec2& cell, float tEnter, float tExit) {
+            int32_t slot = tileIndex[cell.y * gridWidth + cell.x];
+            return slot >= 0 && slots[slot].terrain->Raycast(origin, direction, tEnter, tExit, tHit);
+        });
+
+    if (found) {
+        hit = origin + direction * tHit;
     }
-    return 0.0f;
+    return found;
 }
 
 
-TerrainManager::TerrainManager(Device* device, VkCommandPool commandPool, Scene* scene,
-    VkImage texture, float tileSize, int resolution, int gridWidth, int gridHeight)
-    : tileSize(tileSize), resolution(resolution)
+TerrainManager::TerrainManager(Device* device, UploadBatcher* uploader, Scene* scene,
+    VkImage texture, float tileSize, int resolution, int gridWidth, int gridHeight, const StreamingConfig& config)
+    : device(device), scene(scene), config(config), tileSize(tileSize), resolution(resolution), gridWidth(gridWidth), gridHeight(gridHeight)
 {
-    float startX = -0.5f * gridWidth * tileSize;
-    float startZ = -0.5f * gridHeight * tileSize;
+    grid = new TerrainGrid(device, uploader, resolution);
+    blades = new Blades(device, uploader, static_cast<uint32_t>(gridWidth * gridHeight));
+    windowOrigin = WindowOriginFor(glm::vec3(0.0f));
+    if (!config.tileCachePath.empty()) {
+        OpenTileCache(config.tileCachePath);
+    }
 
+    // One slot per tile of the window, filled with the window around the origin
+    slots.resize(gridWidth * gridHeight);
     for (int j = 0; j < gridHeight; ++j) {
         for (int i = 0; i < gridWidth; ++i) {
-            float worldX = startX + i * tileSize;
-            float worldZ = startZ + j * tileSize;
+            uint32_t index = static_cast<uint32_t>(j * gridWidth + i);
+            Slot& slot = slots[index];
+            slot.key = windowOrigin + glm::ivec2(i, j);
 
-            Terrain * tile = new Terrain(device, commandPool, tileSize, resolution, worldX, worldZ);
+            float worldX = slot.key.x * tileSize;
+            float worldZ = slot.key.y * tileSize;
+
+            PreparedTile prepared = PrepareTile(slot.key);
+            Terrain * tile = new Terrain(device, uploader, grid, tileSize, std::move(prepared.heights), worldX, worldZ);
             tile->SetTexture(texture); //Important!
 
             scene->AddModel(tile);
             terrainTiles.push_back(tile);
+            slot.terrain = tile;
 
             // Add blades to this tile
-            Blades* tileBlades = new Blades(device, commandPool, tileSize, worldX, worldZ);
-            scene->AddBlades(tileBlades);
-
+            blades->LoadTile(uploader, index, GetBladeView(prepared));
+            blades->SetTileActive(index, true);
+            slot.state = SlotState::Active;
         }
     }
+
+    scene->AddBlades(blades);
+    RebuildTileIndex();
+
+    streamUploader = new UploadBatcher(device);
+    streamPool = new ThreadPool(config.maxPendingLoads);
 }
 
 
 
 TerrainManager::~TerrainManager() {
+    // Finishes (and drops) the generation jobs, then waits for the uploads still in flight
+    delete streamPool;
+    delete streamUploader;
+
     for (Terrain* tile : terrainTiles) {
         delete tile;
     }
     terrainTiles.clear();
+    delete grid;
+
+    delete blades;
+    delete tileCache;
+}
+
+void TerrainManager::Update(const glm::vec3& cameraPosition) {
+    updateCount++;
+
+    // Follow the camera once it is clearly past the center tile
+    glm::vec2 cameraTile = glm::vec2(cameraPosition.x, cameraPosition.z) / tileSize;
+    glm::vec2 windowCenter = glm::vec2(windowOrigin) + glm::vec2(gridWidth - 1, gridHeight - 1) * 0.5f;
+    glm::vec2 offset = glm::abs(cameraTile - windowCenter);
+    bool changed = false;
+    if (offset.x > 0.5f + WINDOW_HYSTERESIS || offset.y > 0.5f + WINDOW_HYSTERESIS) {
+        windowOrigin = WindowOriginFor(cameraPosition);
+        // The shown tiles stay where they are in the world but move in the window
+        RebuildTileIndex();
+    }
+
+    std::vector<uint32_t> uploaded;
+    uint32_t pendingLoads = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (uint32_t i = 0; i < slots.size(); i++) {
+        Slot& slot = slots[i];
+        bool wanted = InWindow(slot.key);
+
+        switch (slot.state) {
+        case SlotState::Active:
+            if (!wanted) {
+                ShowTile(i, false);
+                slot.state = SlotState::Retiring;
+                slot.retiredAt = updateCount;
+                changed = true;
+            }
+            break;
+
+        case SlotState::Retiring:
+            if (wanted) {
+                // Back in range before the slot was reused; its contents are still valid
+                ShowTile(i, true);
+                slot.state = SlotState::Active;
+                changed = true;
+            }
+            else if (updateCount - slot.retiredAt > RETIRE_DELAY) {
+                slot.state = SlotState::Free;
+            }
+            break;
+
+        case SlotState::Uploading:
+            if (streamUploader->IsComplete(slot.uploadTicket)) {
+                // Never shown, so the slot is free right away if the tile is no longer wanted
+                if (wanted) {
+                    ShowTile(i, true);
+                    slot.state = SlotState::Active;
+                    changed = true;
+                }
+                else {
+                    slot.state = SlotState::Free;
+                }
+            }
+            break;
+
+        case SlotState::Loading: {
+            if (slot.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                pendingLoads++;
+                break;
+            }
+            if (!wanted) {
+                slot.pending = std::future<PreparedTile>();
+                slot.state = SlotState::Free;
+                break;
+            }
+
+            // Hand over as many finished tiles as the frame budget allows, at least one
+            float elapsedMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            if (!uploaded.empty() && elapsedMs > config.frameBudgetMs) {
+                break;
+            }
+
+            PreparedTile tile = slot.pending.get();
+            slot.terrain->Load(streamUploader, std::move(tile.heights), slot.key.x * tileSize, slot.key.y * tileSize);
+            blades->LoadTile(streamUploader, i, GetBladeView(tile));
+            slot.state = SlotState::Uploading;
+            uploaded.push_back(i);
+            break;
+        }
+
+        case SlotState::Free:
+            break;
+        }
+    }
+
+    if (!uploaded.empty()) {
+        uint64_t ticket = streamUploader->Submit();
+        for (uint32_t i : uploaded) {
+            slots[i].uploadTicket = ticket;
+        }
+    }
+
+    // Start generating the missing tiles of the window, nearest to the camera first
+    std::vector<glm::ivec2> missing;
+    for (int j = 0; j < gridHeight; ++j) {
+        for (int i = 0; i < gridWidth; ++i) {
+            glm::ivec2 key = windowOrigin + glm::ivec2(i, j);
+            bool present = std::any_of(slots.begin(), slots.end(), [&](const Slot& slot) {
+                return slot.state != SlotState::Free && slot.key == key;
+            });
+            if (!present) {
+                missing.push_back(key);
+            }
+        }
+    }
+    std::sort(missing.begin(), missing.end(), [&](const glm::ivec2& a, const glm::ivec2& b) {
+        glm::vec2 da = glm::vec2(a) - cameraTile;
+        glm::vec2 db = glm::vec2(b) - cameraTile;
+        return glm::dot(da, da) < glm::dot(db, db);
+    });
+
+    for (const glm::ivec2& key : missing) {
+        if (pendingLoads >= config.maxPendingLoads) {
+            break;
+        }
+
+        auto freeSlot = std::find_if(slots.begin(), slots.end(), [](const Slot& slot) {
+            return slot.state == SlotState::Free;
+        });
+        if (freeSlot == slots.end()) {
+            break;
+        }
+
+        auto task = std::make_shared<std::packaged_task<PreparedTile()>>([this, key] {
+            return PrepareTile(key);
+        });
+        freeSlot->key = key;
+        freeSlot->pending = task->get_future();
+        freeSlot->state = SlotState::Loading;
+        streamPool->Submit([task] { (*task)(); });
+        pendingLoads++;
+    }
+
+    if (changed) {
+        RebuildTileIndex();
+    }
+
+    // Goes to the GPU through the per-frame draw arguments, without re-recording
+    for (Slot& slot : slots) {
+        if (slot.state == SlotState::Active) {
+            slot.terrain->SelectLod(cameraPosition);
+        }
+    }
+}
+
+uint32_t TerrainManager::GetActiveTileCount() const {
+    return static_cast<uint32_t>(std::count_if(slots.begin(), slots.end(), [](const Slot& slot) {
+        return slot.state == SlotState::Active;
+    }));
+}
+
+uint32_t TerrainManager::GetTriangleCount() const {
+    uint32_t triangles = 0;
+    for (const Slot& slot : slots) {
+        if (slot.state == SlotState::Active) {
+            triangles += slot.terrain->GetTriangleCount();
+        }
+    }
+    return triangles;
+}
+
+glm::ivec2 TerrainManager::WindowOriginFor(const glm::vec3& position) const {
+    // Tile k is centered at k * tileSize
+    return glm::ivec2(
+        static_cast<int>(std::round(position.x / tileSize - (gridWidth - 1) * 0.5f)),
+        static_cast<int>(std::round(position.z / tileSize - (gridHeight - 1) * 0.5f)));
+}
+
+bool TerrainManager::InWindow(const glm::ivec2& key) const {
+    glm::ivec2 local = key - windowOrigin;
+    return local.x >= 0 && local.x < gridWidth && local.y >= 0 && local.y < gridHeight;
+}
+
+void TerrainManager::RebuildTileIndex() {
+    tileIndex.assign(slots.size(), -1);
+    for (uint32_t i = 0; i < slots.size(); i++) {
+        if (slots[i].state == SlotState::Active && InWindow(slots[i].key)) {
+            glm::ivec2 local = slots[i].key - windowOrigin;
+            tileIndex[local.y * gridWidth + local.x] = static_cast<int32_t>(i);
+        }
+    }
+}
+
+const Terrain* TerrainManager::FindTile(const glm::ivec2& key) const {
+    if (!InWindow(key)) {
+        return nullptr;
+    }
+    glm::ivec2 local = key - windowOrigin;
+    int32_t slot = tileIndex[local.y * gridWidth + local.x];
+    return slot >= 0 ? slots[slot].terrain : nullptr;
+}
+
+void TerrainManager::OpenTileCache(const std::string& path) {
+    try {
+        tileCache = new TileCache(path);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << ", generating every tile" << std::endl;
+        return;
+    }
+
+    if (!tileCache->Matches(blades->GetSeed(), tileSize, resolution)) {
+        std::cerr << "Tile cache " << path << " was baked for another seed, tile size or resolution, generating every tile" << std::endl;
+        delete tileCache;
+        tileCache = nullptr;
+        return;
+    }
+    std::cout << "Tile cache " << path << ": " << tileCache->GetTileCount() << " tiles" << std::endl;
+}
+
+TerrainManager::PreparedTile TerrainManager::PrepareTile(const glm::ivec2& key) const {
+    float worldX = key.x * tileSize;
+    float worldZ = key.y * tileSize;
+
+    PreparedTile tile;
+    const TileCacheEntry* entry = tileCache != nullptr ? tileCache->Find(key) : nullptr;
+    if (entry != nullptr) {
+        // Fault the pages in here rather than in the upload on the main thread. The terrain keeps its own
+        // copy of the heights for height queries.
+        tileCache->Prefetch(*entry);
+        const float* heights = tileCache->GetHeights(*entry);
+        tile.heights.assign(heights, heights + tileCache->GetHeightCount());
+        tile.cached = entry;
+        return tile;
+    }
+
+    tile.heights = Terrain::GenerateHeights(tileSize, resolution, worldX, worldZ);
+    tile.blades = blades->PrepareTile(tileSize, worldX, worldZ);
+    return tile;
+}
+
+BladeTileView TerrainManager::GetBladeView(const PreparedTile& tile) const {
+    return tile.cached != nullptr ? tileCache->GetBlades(*tile.cached) : tile.blades.View();
+}
+
+void TerrainManager::ShowTile(uint32_t slot, bool visible) {
+    slots[slot].terrain->SetShown(visible);
+    blades->SetTileActive(slot, visible);
 }
@@ -1,19 +1,122 @@
 #pragma once
 
+#include <future>
+#include <string>
 #include <vector>
 #include "Terrain.h"
+#include "TerrainGrid.h"
 #include "Scene.h"
+#include "ThreadPool.h"
+#include "TileCache.h"
 
+class UploadBatcher;
+
+// Tile grid the application streams, and the defaults of the bake_tiles tool
+constexpr static float DEFAULT_TILE_SIZE = 15.0f;
+constexpr static int DEFAULT_TILE_RESOLUTION = 128;
+
+// Limits on how much streaming work Update does per frame
+struct StreamingConfig {
+    // Main-thread time (ms) spent handing generated tiles to the uploader. At least one tile is handed
+    // over per Update, so streaming always makes progress.
+    float frameBudgetMs = 2.0f;
+    // Tiles being generated on the background threads at once
+    uint32_t maxPendingLoads = 4;
+    // Tile cache baked by bake_tiles (see TileCache.h) to load tiles from instead of generating them.
+    // Tiles it does not hold are still generated; a cache baked for another grid or build is ignored.
+    std::string tileCachePath;
+};
+
+// Keeps a gridWidth x gridHeight window of tiles (terrain mesh and grass) centered on the camera.
+//
+// The window is backed by a fixed pool of slots: one Terrain model and one blade tile slot each, created
+// up front and drawing one shared TerrainGrid, so the scene's models, descriptor sets and the renderer's dispatches never change. When the
+// camera moves, tiles that leave the window are hidden and their slots recycled; tiles that enter it are
+// generated on a background thread, uploaded asynchronously through the manager's own UploadBatcher and
+// only shown once their upload has landed. With a tile cache, a baked tile's job only reads its pages in,
+// and the upload is staged straight out of the mapped file. Showing or hiding a tile only changes what the
+// tile's indirect draw arguments and the blade pool's tile bounds say, so the recorded command buffers never change.
 class TerrainManager {
 public:
+    // Height of the shown tile under (x, z), 0 where no tile is shown. Constant time.
     float GetHeightAt(float x, float z) const;
 
-    TerrainManager(Device* device, VkCommandPool commandPool, Scene* scene, VkImage texture, float tileSize, int resolution, int gridWidth, int gridHeight);
+    // First hit of origin + t * direction (t in [0, maxDistance]) with the shown terrain. Walks the tiles
+    // and then the grid cells the ray crosses, skipping tiles and blocks of cells it passes over, and
+    // intersects each cell's bilinear patch exactly.
+    bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, glm::vec3& hit) const;
+
+    // Fills the window around the origin. The uploads of the initial tiles are queued on uploader and are
+    // in place after its next Flush.
+    TerrainManager(Device* device, UploadBatcher* uploader, Scene* scene, VkImage texture, float tileSize, int resolution, int gridWidth, int gridHeight,
+        const StreamingConfig& config = StreamingConfig());
     ~TerrainManager();
 
+    // Moves the window to the camera, advances streaming and selects the shown tiles' terrain LOD; call
+    // once per frame, before Renderer::Frame
+    void Update(const glm::vec3& cameraPosition);
+
+    // Tiles currently shown
+    uint32_t GetActiveTileCount() const;
+    // Terrain triangles of the shown tiles' LOD selections
+    uint32_t GetTriangleCount() const;
+
 private:
+    // Slot life cycle: Free -> Loading (generating) -> Uploading -> Active -> Retiring -> Free
+    enum class SlotState { Free, Loading, Uploading, Active, Retiring };
+
+    // CPU side of a tile, produced on a streaming thread. The blades of a cached tile stay in the cache.
+    struct PreparedTile {
+        std::vector<float> heights;
+        BladeTile blades;
+        const TileCacheEntry* cached = nullptr;
+    };
+
+    struct Slot {
+        Terrain* terrain;
+        SlotState state = SlotState::Free;
+        // Tile coordinates, the tile is centered at key * tileSize
+        glm::ivec2 key;
+        std::future<PreparedTile> pending;
+        uint64_t uploadTicket = 0;
+        // Update call the slot was hidden at, see Update
+        uint64_t retiredAt = 0;
+    };
+
+    Device* device;
+    Scene* scene;
+    StreamingConfig config;
+
+    std::vector<Slot> slots;
     std::vector<Terrain*> terrainTiles; //a list of pointers to all the Terrain tiles we generated
+    TerrainGrid* grid; // vertex and index buffer shared by every tile
+    Blades* blades; // one blade pool shared by every tile
+    TileCache* tileCache = nullptr; // null without a usable cache
 
     float tileSize; //how big each square terrain tile
     int resolution; // how many subdivisions per tile
+    int gridWidth;
+    int gridHeight;
+
+    // Tile coordinates of the window's lowest corner
+    glm::ivec2 windowOrigin;
+    // Slot of the shown tile at every position of the window (row-major, relative to windowOrigin), -1
+    // where there is none
+    std::vector<int32_t> tileIndex;
+    uint64_t updateCount = 0;
+
+    // Streaming uploads, submitted without waiting
+    UploadBatcher* streamUploader;
+    // Generation jobs; their blade generation fans out over ThreadPool::Shared(), which must not be
+    // waited on from its own workers
+    ThreadPool* streamPool;
+
+    glm::ivec2 WindowOriginFor(const glm::vec3& position) const;
+    bool InWindow(const glm::ivec2& key) const;
+    void RebuildTileIndex();
+    const Terrain* FindTile(const glm::ivec2& key) const;
+    void OpenTileCache(const std::string& path);
+    PreparedTile PrepareTile(const glm::ivec2& key) const;
+    BladeTileView GetBladeView(const PreparedTile& tile) const;
+    void ShowTile(uint32_t slot, bool visible);
 };
@@ -0,0 +1,113 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <exception>
+
+ThreadPool::ThreadPool(unsigned int numThreads) {
+    if (numThreads == 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    workers.reserve(numThreads);
+    for (unsigned int i = 0; i < numThreads; ++i) {
+        workers.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned int ThreadPool::GetThreadCount() const {
+    return static_cast<unsigned int>(workers.size());
+}
+
+std::future<void> ThreadPool::Submit(std::function<void()> task) {
+    std::packaged_task<void()> packaged(std::move(task));
+    std::future<void> result = packaged.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(packaged));
+    }
+    condition.notify_one();
+    return result;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t, size_t, size_t)>& fn, size_t numChunks) {
+    if (count == 0) {
+        return;
+    }
+
+    if (numChunks == 0) {
+        numChunks = workers.size();
+    }
+    numChunks = std::max<size_t>(1, std::min(numChunks, count));
+
+    size_t chunkSize = (count + numChunks - 1) / numChunks;
+
+    std::vector<std::future<void>> pending;
+    pending.reserve(numChunks - 1);
+    for (size_t chunk = 1; chunk < numChunks; ++chunk) {
+        size_t begin = chunk * chunkSize;
+        size_t end = std::min(count, begin + chunkSize);
+        if (begin >= end) {
+            break;
+        }
+        pending.push_back(Submit([&fn, begin, end, chunk]() { fn(begin, end, chunk); }));
+    }
+
+    // The workers reference fn, so every chunk has to finish before this returns, even if one of them throws.
+    // The first exception (the caller's chunk, then the workers' in chunk order) is rethrown once all are done.
+    std::exception_ptr error;
+    try {
+        fn(0, std::min(count, chunkSize), 0);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    // get() rethrows any exception raised on a worker
+    for (std::future<void>& f : pending) {
+        try {
+            f.get();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+ThreadPool& ThreadPool::Shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::WorkerLoop() {
+    while (true) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+            if (stopping && tasks.empty()) {
+                return;
+            }
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // numThreads = 0 uses one worker per hardware thread
+    explicit ThreadPool(unsigned int numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int GetThreadCount() const;
+
+    std::future<void> Submit(std::function<void()> task);
+
+    // Splits [0, count) into numChunks contiguous ranges (0 = one per worker) and blocks until
+    // every range has run. fn receives (begin, end, chunkIndex); the calling thread runs chunk 0.
+    // If chunks throw, the first exception is rethrown after all of them have finished.
+    void ParallelFor(size_t count, const std::function<void(size_t, size_t, size_t)>& fn, size_t numChunks = 0);
+
+    // Process-wide pool shared by the simulation, generation and recording paths
+    static ThreadPool& Shared();
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> workers;
+    std::queue<std::packaged_task<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+};
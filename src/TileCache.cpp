@@ -0,0 +1,307 @@
+#include "TileCache.h"
+#include "Terrain.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    constexpr char TILE_CACHE_MAGIC[8] = { 'G', 'R', 'S', 'T', 'I', 'L', 'E', 'S' };
+
+    uint64_t alignUp(uint64_t offset) {
+        return (offset + TILE_CACHE_ALIGNMENT - 1) / TILE_CACHE_ALIGNMENT * TILE_CACHE_ALIGNMENT;
+    }
+
+    bool keyLess(const TileCacheEntry& entry, const glm::ivec2& key) {
+        return entry.keyZ < key.y || (entry.keyZ == key.y && entry.keyX < key.x);
+    }
+
+    size_t gridVertexCount(int resolution) {
+        return static_cast<size_t>(resolution + 1) * (resolution + 1);
+    }
+}
+
+TileCache::TileCache(const std::string& path) : path(path) {
+    Map();
+    try {
+        Validate();
+    }
+    catch (...) {
+        Unmap();
+        throw;
+    }
+}
+
+TileCache::~TileCache() {
+    Unmap();
+}
+
+void TileCache::Map() {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open tile cache " + path);
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        throw std::runtime_error("Failed to read tile cache " + path);
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (view == nullptr) {
+        if (mapping != nullptr) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        throw std::runtime_error("Failed to map tile cache " + path);
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    size = static_cast<size_t>(fileSize.QuadPart);
+    data = static_cast<const char*>(view);
+#else
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error("Failed to open tile cache " + path);
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size == 0) {
+        close(file);
+        throw std::runtime_error("Failed to read tile cache " + path);
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, file, 0);
+    // The mapping keeps the file referenced
+    close(file);
+    if (view == MAP_FAILED) {
+        throw std::runtime_error("Failed to map tile cache " + path);
+    }
+    size = static_cast<size_t>(status.st_size);
+    data = static_cast<const char*>(view);
+#endif
+}
+
+void TileCache::Unmap() {
+    if (data == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(static_cast<HANDLE>(mappingHandle));
+    CloseHandle(static_cast<HANDLE>(fileHandle));
+#else
+    munmap(const_cast<char*>(data), size);
+#endif
+    data = nullptr;
+}
+
+void TileCache::Validate() {
+    auto fail = [&](const std::string& reason) {
+        throw std::runtime_error("Tile cache " + path + ": " + reason);
+    };
+    auto inFile = [&](uint64_t offset, uint64_t bytes) {
+        return offset <= size && bytes <= size - offset;
+    };
+
+    if (size < sizeof(TileCacheHeader)) {
+        fail("truncated header");
+    }
+    header = reinterpret_cast<const TileCacheHeader*>(data);
+
+    if (memcmp(header->magic, TILE_CACHE_MAGIC, sizeof(TILE_CACHE_MAGIC)) != 0) {
+        fail("not a tile cache");
+    }
+    if (header->version != TILE_CACHE_VERSION) {
+        fail("version " + std::to_string(header->version) + ", expected " + std::to_string(TILE_CACHE_VERSION));
+    }
+    if (strncmp(header->bladeLayout, BLADE_LAYOUT_NAME, sizeof(header->bladeLayout)) != 0
+        || header->numBlades != NUM_BLADES || header->clustersPerTile != CLUSTERS_PER_TILE
+        || header->bladesSize != BLADES_BUFFER_SIZE) {
+        fail("baked for another blade layout, rebake it with this build");
+    }
+    if (header->fileSize != size) {
+        fail("truncated");
+    }
+    if (header->resolution <= 0) {
+        fail("bad resolution");
+    }
+    if (!inFile(header->entriesOffset, static_cast<uint64_t>(header->tileCount) * sizeof(TileCacheEntry))) {
+        fail("bad tile directory");
+    }
+
+    const TileCacheEntry* directory = reinterpret_cast<const TileCacheEntry*>(data + header->entriesOffset);
+    uint64_t heightsSize = gridVertexCount(header->resolution) * sizeof(float);
+    for (uint32_t i = 0; i < header->tileCount; i++) {
+        const TileCacheEntry& entry = directory[i];
+        if (!inFile(entry.bladesOffset, header->bladesSize)
+            || !inFile(entry.clusterBoundsOffset, CLUSTERS_PER_TILE * sizeof(BladeBounds))
+            || !inFile(entry.heightsOffset, heightsSize)) {
+            fail("tile " + std::to_string(i) + " out of range");
+        }
+        if (i > 0 && !keyLess(directory[i - 1], glm::ivec2(entry.keyX, entry.keyZ))) {
+            fail("tile directory not sorted");
+        }
+    }
+    entries = directory;
+}
+
+void TileCache::Bake(const std::string& path, uint64_t seed, float tileSize, int resolution,
+    const glm::ivec2& keyMin, const glm::ivec2& keyMax,
+    const std::function<void(uint32_t baked, uint32_t total)>& progress) {
+    if (resolution <= 0 || keyMax.x < keyMin.x || keyMax.y < keyMin.y) {
+        throw std::runtime_error("Nothing to bake");
+    }
+
+    uint32_t tileCount = static_cast<uint32_t>((keyMax.x - keyMin.x + 1) * (keyMax.y - keyMin.y + 1));
+
+    // Every size is fixed, so the whole layout is known before anything is generated
+    TileCacheHeader fileHeader = {};
+    memcpy(fileHeader.magic, TILE_CACHE_MAGIC, sizeof(TILE_CACHE_MAGIC));
+    fileHeader.version = TILE_CACHE_VERSION;
+    strncpy(fileHeader.bladeLayout, BLADE_LAYOUT_NAME, sizeof(fileHeader.bladeLayout));
+    fileHeader.numBlades = NUM_BLADES;
+    fileHeader.clustersPerTile = CLUSTERS_PER_TILE;
+    fileHeader.resolution = resolution;
+    fileHeader.tileSize = tileSize;
+    fileHeader.seed = seed;
+    fileHeader.bladesSize = BLADES_BUFFER_SIZE;
+    fileHeader.tileCount = tileCount;
+    fileHeader.entriesOffset = alignUp(sizeof(TileCacheHeader));
+
+    uint64_t clusterBoundsSize = CLUSTERS_PER_TILE * sizeof(BladeBounds);
+    uint64_t heightsSize = gridVertexCount(resolution) * sizeof(float);
+    uint64_t offset = alignUp(fileHeader.entriesOffset + tileCount * sizeof(TileCacheEntry));
+
+    std::vector<TileCacheEntry> entries(tileCount);
+    for (uint32_t i = 0; i < tileCount; i++) {
+        TileCacheEntry& entry = entries[i];
+        entry.bladesOffset = offset;
+        entry.clusterBoundsOffset = entry.bladesOffset + BLADES_BUFFER_SIZE;
+        entry.heightsOffset = entry.clusterBoundsOffset + clusterBoundsSize;
+        offset = alignUp(entry.heightsOffset + heightsSize);
+    }
+    fileHeader.fileSize = offset;
+
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to write tile cache " + temporaryPath);
+        }
+        auto writeAt = [&](uint64_t at, const void* bytes, uint64_t count) {
+            file.seekp(static_cast<std::streamoff>(at));
+            file.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(count));
+        };
+
+        // Row by row, like the directory
+        uint32_t i = 0;
+        for (int z = keyMin.y; z <= keyMax.y; z++) {
+            for (int x = keyMin.x; x <= keyMax.x; x++, i++) {
+                float worldX = x * tileSize;
+                float worldZ = z * tileSize;
+                BladeTile blades = Blades::PrepareTile(seed, tileSize, worldX, worldZ);
+                std::vector<float> heights = Terrain::GenerateHeights(tileSize, resolution, worldX, worldZ);
+
+                TileCacheEntry& entry = entries[i];
+                entry.keyX = x;
+                entry.keyZ = z;
+                entry.bounds = blades.bounds;
+                writeAt(entry.bladesOffset, blades.data.data(), BLADES_BUFFER_SIZE);
+                writeAt(entry.clusterBoundsOffset, blades.clusterBounds.data(), clusterBoundsSize);
+                writeAt(entry.heightsOffset, heights.data(), heightsSize);
+
+                if (progress) {
+                    progress(i + 1, tileCount);
+                }
+            }
+        }
+
+        writeAt(fileHeader.entriesOffset, entries.data(), entries.size() * sizeof(TileCacheEntry));
+        writeAt(0, &fileHeader, sizeof(fileHeader));
+        // Pads the last tile out to the alignment
+        if (entries.back().heightsOffset + heightsSize < fileHeader.fileSize) {
+            char zero = 0;
+            writeAt(fileHeader.fileSize - 1, &zero, 1);
+        }
+
+        if (!file) {
+            throw std::runtime_error("Failed to write tile cache " + temporaryPath);
+        }
+    }
+
+    // rename does not replace an existing file everywhere
+    std::remove(path.c_str());
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Failed to write tile cache " + path);
+    }
+}
+
+bool TileCache::Matches(uint64_t seed, float tileSize, int resolution) const {
+    return header->seed == seed && header->tileSize == tileSize && header->resolution == resolution;
+}
+
+uint32_t TileCache::GetTileCount() const {
+    return header->tileCount;
+}
+
+const TileCacheHeader& TileCache::GetHeader() const {
+    return *header;
+}
+
+const TileCacheEntry& TileCache::GetEntry(uint32_t index) const {
+    return entries[index];
+}
+
+const TileCacheEntry* TileCache::Find(const glm::ivec2& key) const {
+    const TileCacheEntry* end = entries + header->tileCount;
+    const TileCacheEntry* entry = std::lower_bound(entries, end, key, keyLess);
+    if (entry == end || entry->keyX != key.x || entry->keyZ != key.y) {
+        return nullptr;
+    }
+    return entry;
+}
+
+BladeTileView TileCache::GetBlades(const TileCacheEntry& entry) const {
+    BladeTileView view;
+    // Same origin as Blades::PrepareTile gets from the tile manager
+    view.origin = glm::vec3(entry.keyX * header->tileSize, 0.0f, entry.keyZ * header->tileSize);
+    view.data = data + entry.bladesOffset;
+    view.bounds = entry.bounds;
+    view.clusterBounds = reinterpret_cast<const BladeBounds*>(data + entry.clusterBoundsOffset);
+    return view;
+}
+
+const float* TileCache::GetHeights(const TileCacheEntry& entry) const {
+    return reinterpret_cast<const float*>(data + entry.heightsOffset);
+}
+
+size_t TileCache::GetHeightCount() const {
+    return gridVertexCount(header->resolution);
+}
+
+void TileCache::Prefetch(const TileCacheEntry& entry) const {
+    // A tile's sections are contiguous, from its blades to the end of its heights
+    uint64_t begin = entry.bladesOffset;
+    uint64_t end = entry.heightsOffset + GetHeightCount() * sizeof(float);
+#ifndef _WIN32
+    // Starts the read-ahead of the whole range at once; the mapping is page aligned and so is begin
+    madvise(const_cast<char*>(data + begin), static_cast<size_t>(end - begin), MADV_WILLNEED);
+#endif
+    volatile char sink = 0;
+    for (uint64_t offset = begin; offset < end; offset += TILE_CACHE_ALIGNMENT) {
+        sink += data[offset];
+    }
+    sink += data[end - 1];
+    (void)sink;
+}
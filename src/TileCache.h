@@ -0,0 +1,110 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Blades.h"
+
+// Bumped whenever the layout below or the generation of the baked data changes
+constexpr static uint32_t TILE_CACHE_VERSION = 2;
+// Every section starts at a multiple of this, so a tile's data begins on a page of the mapping
+constexpr static uint64_t TILE_CACHE_ALIGNMENT = 4096;
+
+// Start of the file. Everything is little endian, offsets are from the start of the file.
+struct TileCacheHeader {
+    char magic[8];           // "GRSTILES"
+    uint32_t version;        // TILE_CACHE_VERSION
+    char bladeLayout[8];     // BLADE_LAYOUT_NAME of the build that baked it, zero padded
+    uint32_t numBlades;      // NUM_BLADES
+    uint32_t clustersPerTile;
+    int32_t resolution;      // grid cells per tile side
+    float tileSize;
+    uint32_t tileCount;
+    uint64_t seed;           // blade generation seed
+    uint64_t bladesSize;     // bytes of a tile's blades (BLADES_BUFFER_SIZE)
+    uint64_t entriesOffset;  // tileCount TileCacheEntry
+    uint64_t fileSize;
+};
+
+// Directory entry of one tile, sorted by key (z, then x)
+struct TileCacheEntry {
+    // Tile coordinates, the tile is centered at key * tileSize
+    int32_t keyX;
+    int32_t keyZ;
+    uint64_t pad0;
+    BladeBounds bounds;
+    // bladesSize bytes laid out like BladeTile::data, ready to be copied to the blade buffer
+    uint64_t bladesOffset;
+    // CLUSTERS_PER_TILE BladeBounds
+    uint64_t clusterBoundsOffset;
+    // (resolution + 1)^2 float, the tile's height map
+    uint64_t heightsOffset;
+    uint64_t pad1;
+};
+
+static_assert(sizeof(TileCacheHeader) == 72, "TileCacheHeader layout changed, bump TILE_CACHE_VERSION");
+static_assert(sizeof(TileCacheEntry) == 80, "TileCacheEntry layout changed, bump TILE_CACHE_VERSION");
+
+// Baked terrain and grass tiles, memory mapped.
+//
+// Every tile's blades, cluster bounds and heights are stored exactly as they are uploaded, so nothing is
+// parsed or converted on load: LoadTile stages the blades straight out of the mapping and the terrain takes
+// its heights with one bulk copy. The grid the heights displace is the same for every tile and is not stored. The file is only checked once, when it is opened. Pages
+// are read in on first access; Prefetch touches a tile's pages up front, so a streaming thread can take
+// the I/O instead of the thread doing the upload.
+//
+// The baked data is what Blades::PrepareTile and Terrain::GenerateHeights produce for the same seed,
+// tile size and resolution, in a build with the same blade layout. A cache that does not match the build
+// or the requested grid should not be used; see Matches.
+class TileCache {
+public:
+    // Maps the file and validates its header and directory. Throws if the file is missing, truncated or
+    // of another version or blade layout.
+    explicit TileCache(const std::string& path);
+    ~TileCache();
+
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    // Generates the tiles with keys in [keyMin, keyMax] (both inclusive) and writes them to path, through
+    // a temporary file. progress, if set, is called after each tile. Throws if the file cannot be written.
+    static void Bake(const std::string& path, uint64_t seed, float tileSize, int resolution,
+        const glm::ivec2& keyMin, const glm::ivec2& keyMax,
+        const std::function<void(uint32_t baked, uint32_t total)>& progress = nullptr);
+
+    // Whether the tiles were baked with these parameters
+    bool Matches(uint64_t seed, float tileSize, int resolution) const;
+
+    uint32_t GetTileCount() const;
+    const TileCacheHeader& GetHeader() const;
+    // Directory order, index < GetTileCount()
+    const TileCacheEntry& GetEntry(uint32_t index) const;
+    // nullptr if the tile was not baked. Binary search over the directory.
+    const TileCacheEntry* Find(const glm::ivec2& key) const;
+
+    // Views into the mapping, valid for the lifetime of the cache
+    BladeTileView GetBlades(const TileCacheEntry& entry) const;
+    const float* GetHeights(const TileCacheEntry& entry) const;
+    size_t GetHeightCount() const;
+
+    // Reads every page of the tile's data, so later accesses do not wait for the disk
+    void Prefetch(const TileCacheEntry& entry) const;
+
+private:
+    std::string path;
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+
+    const TileCacheHeader* header = nullptr;
+    const TileCacheEntry* entries = nullptr;
+
+    void Map();
+    void Unmap();
+    void Validate();
+};
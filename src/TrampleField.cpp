@@ -0,0 +1,121 @@
+#include "TrampleField.h"
+#include "BufferUtils.h"
+#include "Image.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+static_assert((TRAMPLE_RESOLUTION & (TRAMPLE_RESOLUTION - 1)) == 0, "shaders/trample.comp needs a power of two TRAMPLE_RESOLUTION");
+
+TrampleField::TrampleField(Device* device) : device(device) {
+    Image::Create(device, TRAMPLE_RESOLUTION, TRAMPLE_RESOLUTION, TRAMPLE_FORMAT, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+
+    view = Image::CreateView(device, image, TRAMPLE_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.mipLodBias = 0.0f;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = 0.0f;
+
+    if (vkCreateSampler(device->GetVkDevice(), &samplerInfo, nullptr, &sampler) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create trample field sampler");
+    }
+
+    Follow(glm::vec3(0.0f));
+    submittedWindowMin = windowMin;
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::CreateBuffer(device, sizeof(TrampleInfo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, infoBuffers[i], infoBufferMemories[i]);
+    }
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        UpdateBuffer(i);
+    }
+}
+
+TrampleField::~TrampleField() {
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        BufferUtils::DestroyBuffer(device, infoBuffers[i], infoBufferMemories[i]);
+    }
+    vkDestroySampler(device->GetVkDevice(), sampler, nullptr);
+    vkDestroyImageView(device->GetVkDevice(), view, nullptr);
+    Image::Destroy(device, image, imageMemory);
+}
+
+void TrampleField::RecordClear(VkCommandBuffer commandBuffer) const {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // Zero is flat grass in every channel
+    VkClearColorValue flat = {};
+    vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_GENERAL, &flat, 1, &barrier.subresourceRange);
+
+    // The trample pass reads the previous contents of the texels that stay in the window
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void TrampleField::Follow(const glm::vec3& position) {
+    // Whole texels only, so texels that stay in the window keep their contents exactly
+    glm::ivec2 center(static_cast<int>(std::floor(position.x / TRAMPLE_TEXEL_SIZE)), static_cast<int>(std::floor(position.z / TRAMPLE_TEXEL_SIZE)));
+    windowMin = center - static_cast<int>(TRAMPLE_RESOLUTION / 2);
+}
+
+void TrampleField::UpdateBuffer(uint32_t frame) {
+    // Frames are submitted in order, so the window before this one is the last one submitted
+    TrampleInfo info = {};
+    info.windowMin = windowMin;
+    info.previousWindowMin = submittedWindowMin;
+    info.texelSize = TRAMPLE_TEXEL_SIZE;
+    info.recoveryTime = TRAMPLE_RECOVERY_TIME;
+    info.resolution = TRAMPLE_RESOLUTION;
+    memcpy(infoBufferMemories[frame].mapped, &info, sizeof(TrampleInfo));
+
+    submittedWindowMin = windowMin;
+}
+
+VkBuffer TrampleField::GetInfoBuffer(uint32_t frame) const {
+    return infoBuffers[frame];
+}
+
+VkImage TrampleField::GetImage() const {
+    return image;
+}
+
+VkImageView TrampleField::GetView() const {
+    return view;
+}
+
+VkSampler TrampleField::GetSampler() const {
+    return sampler;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+#include <array>
+#include "Device.h"
+#include "MemoryAllocator.h"
+#include "FramesInFlight.h"
+
+// Must match shaders/trample.comp and shaders/compute.comp. TRAMPLE_RESOLUTION is a power of two.
+constexpr static uint32_t TRAMPLE_RESOLUTION = 512;
+constexpr static float TRAMPLE_TEXEL_SIZE = 0.25f;
+// Seconds for a trample to fade to 1/e of its strength
+constexpr static float TRAMPLE_RECOVERY_TIME = 3.0f;
+constexpr static VkFormat TRAMPLE_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+// Uniform read by the trample pass and the blade simulation (std140)
+struct TrampleInfo {
+    // World texel (floor(xz / texelSize)) at the window's lowest corner, this frame and the frame before
+    glm::ivec2 windowMin;
+    glm::ivec2 previousWindowMin;
+    float texelSize;
+    float recoveryTime;
+    uint32_t resolution;
+    uint32_t pad0;
+};
+
+// World-space record of where colliders have pushed the grass, so blades stay flattened after a
+// collider has moved on and recover over TRAMPLE_RECOVERY_TIME.
+//
+// A square window of resolution x resolution texels of texelSize, centered on the camera, is stored
+// toroidally (world texel w at image texel w mod resolution, like a clipmap level): when the window
+// moves, only the texels that wrap around to the other side are cleared and nothing is copied. Each
+// texel holds the direction the grass lies in (xy, ground-plane xz) and how flat it is (z, 0..1).
+//
+// shaders/trample.comp runs once per frame over the whole field: it fades every texel, clears the ones
+// that entered the window and splats the footprint (the ground-plane projection) of the colliders binned
+// under the texel's cell. The simulation then samples the field once per blade, however many colliders
+// passed over it. The image stays in VK_IMAGE_LAYOUT_GENERAL; it is written and read on the compute queue
+// only, so a single copy serves every frame in flight. It is exclusive to the compute queue family, so it
+// is also cleared there (see RecordClear) rather than through an upload on the transfer queue.
+class TrampleField {
+public:
+    // The image's contents are undefined until RecordClear has run
+    explicit TrampleField(Device* device);
+    ~TrampleField();
+
+    // Clears the field to flat grass and leaves it in VK_IMAGE_LAYOUT_GENERAL, ready for the trample
+    // pass. Must be recorded for the queue family that runs the trample pass, before its first dispatch.
+    void RecordClear(VkCommandBuffer commandBuffer) const;
+
+    // Centers the window on position. Takes effect with the next UpdateBuffer.
+    void Follow(const glm::vec3& position);
+    // Copies the window of the frame about to be submitted into its uniform buffer
+    void UpdateBuffer(uint32_t frame);
+
+    VkBuffer GetInfoBuffer(uint32_t frame) const;
+    VkImage GetImage() const;
+    VkImageView GetView() const;
+    VkSampler GetSampler() const;
+
+private:
+    Device* device;
+
+    VkImage image;
+    MemoryAllocation imageMemory;
+    VkImageView view;
+    // Bilinear with repeat addressing, which wraps the toroidal storage for free
+    VkSampler sampler;
+
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> infoBuffers;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> infoBufferMemories;
+
+    // Window of the next frame, and of the last one handed to UpdateBuffer
+    glm::ivec2 windowMin;
+    glm::ivec2 submittedWindowMin;
+};
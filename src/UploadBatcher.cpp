@@ -0,0 +1,343 @@
+#include "UploadBatcher.h"
+#include "BufferUtils.h"
+#include "Instance.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    // Offsets into the ring are kept aligned for buffer-to-image copies (multiple of 4 and of the texel size)
+    constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+}
+
+UploadBatcher::UploadBatcher(Device* device, VkDeviceSize stagingSize)
+    : device(device), stagingSize(stagingSize) {
+
+    // Its own pool, so the command buffers can be reset and reused once their batch completes
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = device->GetInstance()->GetQueueFamilyIndices()[QueueFlags::Transfer];
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    if (vkCreateCommandPool(device->GetVkDevice(), &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create upload command pool");
+    }
+
+    std::array<VkCommandBuffer, BATCH_COUNT> commandBuffers;
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = BATCH_COUNT;
+
+    if (vkAllocateCommandBuffers(device->GetVkDevice(), &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate upload command buffers");
+    }
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    for (uint32_t i = 0; i < BATCH_COUNT; i++) {
+        batches[i].commandBuffer = commandBuffers[i];
+        if (vkCreateFence(device->GetVkDevice(), &fenceInfo, nullptr, &batches[i].fence) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create upload fence");
+        }
+    }
+
+    BufferUtils::CreateBuffer(device, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    stagingData = static_cast<char*>(stagingBufferMemory.mapped);
+}
+
+UploadBatcher::~UploadBatcher() {
+    Flush();
+
+    BufferUtils::DestroyBuffer(device, stagingBuffer, stagingBufferMemory);
+
+    for (Batch& batch : batches) {
+        vkDestroyFence(device->GetVkDevice(), batch.fence, nullptr);
+    }
+    vkDestroyCommandPool(device->GetVkDevice(), commandPool, nullptr);
+}
+
+void UploadBatcher::Upload(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset) {
+    Upload(data, size, &dstBuffer, 1, dstOffset);
+}
+
+void UploadBatcher::Upload(const void* data, VkDeviceSize size, const VkBuffer* dstBuffers, uint32_t dstBufferCount, VkDeviceSize dstOffset) {
+    if (size == 0) {
+        return;
+    }
+
+    // Regions of one vkCmdCopyBuffer must not overlap, and the later write has to win
+    for (uint32_t i = 0; i < dstBufferCount; i++) {
+        if (Overlaps(dstBuffers[i], dstOffset, size)) {
+            Submit();
+            break;
+        }
+    }
+
+    VkBuffer srcBuffer;
+    VkDeviceSize srcOffset;
+    Stage(data, size, srcBuffer, srcOffset);
+
+    if (srcBuffer != stagingBuffer) {
+        // Oversized uploads have their own source buffer, so they cannot join the grouped ring copies.
+        // They are submitted right away, which keeps later copies to the same range ordered after them.
+        BeginRecording();
+        for (uint32_t i = 0; i < dstBufferCount; i++) {
+            VkBufferCopy region = { srcOffset, dstOffset, size };
+            vkCmdCopyBuffer(batches[currentBatch].commandBuffer, srcBuffer, dstBuffers[i], 1, &region);
+        }
+        Submit();
+        return;
+    }
+
+    for (uint32_t i = 0; i < dstBufferCount; i++) {
+        pendingCopies.push_back({ dstBuffers[i], { srcOffset, dstOffset, size } });
+    }
+}
+
+void UploadBatcher::UploadImage(const void* data, VkDeviceSize size, VkImage image, uint32_t width, uint32_t height, VkImageLayout finalLayout) {
+    VkBuffer srcBuffer;
+    VkDeviceSize srcOffset;
+    Stage(data, size, srcBuffer, srcOffset);
+    BeginRecording();
+    VkCommandBuffer commandBuffer = batches[currentBatch].commandBuffer;
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = srcOffset;
+    region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    region.imageOffset = { 0, 0, 0 };
+    region.imageExtent = { width, height, 1 };
+    vkCmdCopyBufferToImage(commandBuffer, srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    // Nothing reads the image before its batch's fence has signaled, which orders it before any later submission
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = finalLayout;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+uint64_t UploadBatcher::Submit() {
+    if (!pendingCopies.empty()) {
+        BeginRecording();
+
+        // One call per destination, regions in upload order
+        std::stable_sort(pendingCopies.begin(), pendingCopies.end(), [](const PendingCopy& a, const PendingCopy& b) {
+            return a.dstBuffer < b.dstBuffer;
+        });
+
+        std::vector<VkBufferCopy> regions;
+        for (size_t begin = 0; begin < pendingCopies.size();) {
+            size_t end = begin;
+            regions.clear();
+            while (end < pendingCopies.size() && pendingCopies[end].dstBuffer == pendingCopies[begin].dstBuffer) {
+                regions.push_back(pendingCopies[end].region);
+                end++;
+            }
+            vkCmdCopyBuffer(batches[currentBatch].commandBuffer, stagingBuffer, pendingCopies[begin].dstBuffer, static_cast<uint32_t>(regions.size()), regions.data());
+            begin = end;
+        }
+        pendingCopies.clear();
+    }
+
+    if (!recording) {
+        // Everything uploaded so far is covered by the batches already submitted
+        return submittedTicket;
+    }
+
+    Batch& batch = batches[currentBatch];
+    vkEndCommandBuffer(batch.commandBuffer);
+    recording = false;
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+
+    if (vkQueueSubmit(device->GetQueue(QueueFlags::Transfer), 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit uploads");
+    }
+
+    batch.ticket = ++submittedTicket;
+    inFlight.push_back(currentBatch);
+    currentBatch = (currentBatch + 1) % BATCH_COUNT;
+    submitCount++;
+    return batch.ticket;
+}
+
+bool UploadBatcher::IsComplete(uint64_t ticket) {
+    while (!inFlight.empty() && vkGetFenceStatus(device->GetVkDevice(), batches[inFlight.front()].fence) == VK_SUCCESS) {
+        Recycle(batches[inFlight.front()]);
+        inFlight.pop_front();
+    }
+    UpdateStagingTail();
+    return ticket <= completedTicket;
+}
+
+void UploadBatcher::Flush() {
+    Submit();
+    while (!inFlight.empty()) {
+        RetireOldest();
+    }
+}
+
+uint32_t UploadBatcher::GetSubmitCount() const {
+    return submitCount;
+}
+
+void UploadBatcher::Stage(const void* data, VkDeviceSize size, VkBuffer& buffer, VkDeviceSize& offset) {
+    // The batch being recorded owns whatever is staged for it
+    BeginRecording();
+
+    if (size > stagingSize) {
+        VkBuffer oversizedBuffer;
+        MemoryAllocation oversizedMemory;
+        BufferUtils::CreateBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, oversizedBuffer, oversizedMemory);
+        memcpy(oversizedMemory.mapped, data, static_cast<size_t>(size));
+
+        batches[currentBatch].oversizedBuffers.push_back(oversizedBuffer);
+        batches[currentBatch].oversizedMemories.push_back(oversizedMemory);
+        buffer = oversizedBuffer;
+        offset = 0;
+        return;
+    }
+
+    while (!Reserve(size, offset)) {
+        // The ring is full: wait for the oldest batch to consume its part, submitting the batch being
+        // recorded first if it is the only one left
+        if (inFlight.empty()) {
+            Submit();
+        }
+        RetireOldest();
+        BeginRecording();
+    }
+
+    memcpy(stagingData + offset, data, static_cast<size_t>(size));
+    stagingHead = offset + size;
+
+    Batch& batch = batches[currentBatch];
+    if (!batch.staged) {
+        batch.staged = true;
+        batch.stagingBegin = offset;
+    }
+    UpdateStagingTail();
+
+    buffer = stagingBuffer;
+}
+
+bool UploadBatcher::Reserve(VkDeviceSize size, VkDeviceSize& offset) const {
+    VkDeviceSize alignedHead = (stagingHead + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+    if (stagingHead >= stagingTail) {
+        // Free space is [head, end) followed by [0, tail). Wrapping must leave the head short of the tail,
+        // so that head == tail always means an empty ring.
+        if (alignedHead + size <= stagingSize) {
+            offset = alignedHead;
+            return true;
+        }
+        if (size < stagingTail) {
+            offset = 0;
+            return true;
+        }
+        return false;
+    }
+
+    // Wrapped: free space is [head, tail)
+    if (alignedHead + size < stagingTail) {
+        offset = alignedHead;
+        return true;
+    }
+    return false;
+}
+
+bool UploadBatcher::Overlaps(VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size) const {
+    for (const PendingCopy& copy : pendingCopies) {
+        if (copy.dstBuffer == dstBuffer && dstOffset < copy.region.dstOffset + copy.region.size && copy.region.dstOffset < dstOffset + size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void UploadBatcher::BeginRecording() {
+    if (recording) {
+        return;
+    }
+
+    // Batches are recorded round robin, so the next one is the oldest in flight when all of them are
+    while (std::find(inFlight.begin(), inFlight.end(), currentBatch) != inFlight.end()) {
+        RetireOldest();
+    }
+
+    VkCommandBuffer commandBuffer = batches[currentBatch].commandBuffer;
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    // Batches in flight may overlap on the queue; order this one's copies after theirs
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    recording = true;
+}
+
+void UploadBatcher::RetireOldest() {
+    Batch& batch = batches[inFlight.front()];
+    vkWaitForFences(device->GetVkDevice(), 1, &batch.fence, VK_TRUE, UINT64_MAX);
+    Recycle(batch);
+    inFlight.pop_front();
+    UpdateStagingTail();
+}
+
+void UploadBatcher::Recycle(Batch& batch) {
+    vkResetFences(device->GetVkDevice(), 1, &batch.fence);
+    vkResetCommandBuffer(batch.commandBuffer, 0);
+
+    for (size_t i = 0; i < batch.oversizedBuffers.size(); i++) {
+        BufferUtils::DestroyBuffer(device, batch.oversizedBuffers[i], batch.oversizedMemories[i]);
+    }
+    batch.oversizedBuffers.clear();
+    batch.oversizedMemories.clear();
+
+    batch.staged = false;
+    completedTicket = std::max(completedTicket, batch.ticket);
+}
+
+void UploadBatcher::UpdateStagingTail() {
+    // The oldest batch that still reads the ring holds the tail
+    for (uint32_t index : inFlight) {
+        if (batches[index].staged) {
+            stagingTail = batches[index].stagingBegin;
+            return;
+        }
+    }
+    if (recording && batches[currentBatch].staged) {
+        stagingTail = batches[currentBatch].stagingBegin;
+        return;
+    }
+
+    // Nothing live: start over at the beginning of the ring
+    stagingHead = 0;
+    stagingTail = 0;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <array>
+#include <deque>
+#include <vector>
+#include "Device.h"
+#include "MemoryAllocator.h"
+
+// Batches host-to-device uploads. Data is copied into one persistently mapped staging ring right away,
+// and the copies out of it are recorded into a command buffer that is submitted to the transfer queue as
+// one batch, with one fence for the whole batch instead of a queue drain per buffer.
+//
+// Flush submits the batch and waits for it. Submit hands it to the queue without waiting and returns a
+// ticket that IsComplete can poll, so uploads can land in the background while frames are rendered; up to
+// BATCH_COUNT batches are in flight, each with its own command buffer and fence, and the ring only reuses
+// staging space once the batch that reads it has completed. Batches are ordered against each other, so a
+// later upload to the same range always wins.
+//
+// The batch is also submitted when the ring runs out of space, when a copy would overlap one already
+// pending, and on destruction (which waits for everything). Uploads larger than the ring get a staging
+// buffer of their own and are submitted right away.
+class UploadBatcher {
+public:
+    static constexpr VkDeviceSize DEFAULT_STAGING_SIZE = 32 * 1024 * 1024;
+    static constexpr uint32_t BATCH_COUNT = 4;
+
+    UploadBatcher(Device* device, VkDeviceSize stagingSize = DEFAULT_STAGING_SIZE);
+    ~UploadBatcher();
+
+    // Copies size bytes of data to [dstOffset, dstOffset + size) of dstBuffer (which needs TRANSFER_DST)
+    void Upload(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset = 0);
+    // Same, staging the data once for several destination buffers
+    void Upload(const void* data, VkDeviceSize size, const VkBuffer* dstBuffers, uint32_t dstBufferCount, VkDeviceSize dstOffset = 0);
+
+    // Uploads tightly packed texels to the whole of a single mip level, single layer color image and leaves it
+    // in finalLayout. The image's previous contents are discarded.
+    void UploadImage(const void* data, VkDeviceSize size, VkImage image, uint32_t width, uint32_t height, VkImageLayout finalLayout);
+
+    // Submits everything recorded so far without waiting. The returned ticket completes once every upload
+    // made before the call has landed.
+    uint64_t Submit();
+    // Polls the batches in flight; never blocks
+    bool IsComplete(uint64_t ticket);
+
+    // Submits everything recorded so far and waits for it
+    void Flush();
+
+    // Batches submitted so far, for logging
+    uint32_t GetSubmitCount() const;
+
+private:
+    struct PendingCopy {
+        VkBuffer dstBuffer;
+        VkBufferCopy region;
+    };
+
+    struct Batch {
+        VkCommandBuffer commandBuffer;
+        VkFence fence;
+        uint64_t ticket = 0;
+
+        // Range of the ring the batch reads, [stagingBegin, stagingEnd) possibly wrapping around
+        bool staged = false;
+        VkDeviceSize stagingBegin = 0;
+
+        // Dedicated staging buffers of oversized uploads, released when the batch completes
+        std::vector<VkBuffer> oversizedBuffers;
+        std::vector<MemoryAllocation> oversizedMemories;
+    };
+
+    Device* device;
+
+    VkCommandPool commandPool;
+    std::array<Batch, BATCH_COUNT> batches;
+    // The batch being recorded, and the submitted ones oldest first
+    uint32_t currentBatch = 0;
+    std::deque<uint32_t> inFlight;
+    bool recording = false;
+
+    uint64_t submittedTicket = 0;
+    uint64_t completedTicket = 0;
+
+    VkBuffer stagingBuffer;
+    MemoryAllocation stagingBufferMemory;
+    char* stagingData;
+    VkDeviceSize stagingSize;
+    // Live data occupies [stagingTail, stagingHead), wrapping around when the head is below the tail
+    VkDeviceSize stagingHead = 0;
+    VkDeviceSize stagingTail = 0;
+
+    // Buffer copies are grouped by destination on submission, one vkCmdCopyBuffer per destination buffer
+    std::vector<PendingCopy> pendingCopies;
+
+    uint32_t submitCount = 0;
+
+    // Copies data into staging memory and returns the buffer and offset it landed at
+    void Stage(const void* data, VkDeviceSize size, VkBuffer& buffer, VkDeviceSize& offset);
+    bool Reserve(VkDeviceSize size, VkDeviceSize& offset) const;
+    bool Overlaps(VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size) const;
+    void BeginRecording();
+    // Waits for the oldest batch in flight and recycles it
+    void RetireOldest();
+    void Recycle(Batch& batch);
+    void UpdateStagingTail();
+};
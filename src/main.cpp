@@ -1,13 +1,32 @@
-#include <vulkan/vulkan.h>
+﻿#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <glm/packing.hpp>
 #include "Instance.h"
+#include "MemoryAllocator.h"
 #include "Window.h"
 #include "Renderer.h"
+#include "GpuProfiler.h"
+#include "BladeSimulator.h"
+#include "Blades.h"
+#include "BufferUtils.h"
 #include "Camera.h"
 #include "Scene.h"
 #include "Image.h"
 #include "Terrain.h"
 #include "TerrainManager.h"
+#include "ThreadPool.h"
+#include "TileCache.h"
+#include "UploadBatcher.h"
 
 Device* device;
 SwapChain* swapChain;
@@ -20,6 +39,41 @@ Scene* scene;
 
 
 float collisionRadius = 0.5f;
+// Sphere following the cursor while the right mouse button is held
+uint32_t cursorCollider;
+// Capsules walking around the origin, see --colliders
+std::vector<uint32_t> walkerColliders;
+
+// Command line options
+//   --headless          render offscreen without a window or swap chain (e.g. on lavapipe)
+//   --frames N          stop after N frames (defaults to 1000 when headless, 8 with --validate)
+//   --width W           framebuffer width
+//   --height H          framebuffer height
+//   --timings FILE      write per-frame timings (ms) as CSV on exit
+//   --gpu-profile FILE  write the GPU profiler's last frames on exit, as JSON if FILE ends in .json, else CSV
+//   --bench NAME        run a benchmark instead of rendering: generation, tile-cache (needs --tile-cache),
+//                       record (headless, times command buffer recording per tile and thread count),
+//                       cpu-sim (times the CPU reference simulation BladeSimulator, needs no GPU)
+//   --validate          headless; checks the simulation and culling of every frame against BladeSimulator
+//                       and exits with 1 if they differ. With --colliders the walkers move and trample the
+//                       grass, which BladeSimulator mirrors too.
+//   --stream-budget MS  main-thread time per frame for handing streamed-in tiles to the GPU
+//   --colliders N       add N capsule colliders walking through the grass
+//   --sim-config FILE   read the blade simulation tunables (see BladeSimulationParams.h) from FILE
+//   --tile-cache FILE   load tiles from a cache baked by bake_tiles instead of generating them
+struct Options {
+    bool headless = false;
+    bool validate = false;
+    uint32_t frames = 0;
+    int width = 640;
+    int height = 480;
+    std::string timingsPath;
+    std::string gpuProfilePath;
+    std::string bench;
+    StreamingConfig streaming;
+    uint32_t colliders = 0;
+    BladeSimulationParams simulation;
+};
 
 
 
@@ -99,21 +153,12 @@ namespace {
             glm::vec3 rayOrigin = camera->GetPosition();
             glm::vec3 rayDirection = rayWorld;
 
-            constexpr float step = 0.1f;
             constexpr float maxDistance = 10000.0f;
 
-            // Raymarch along the direction until we hit the terrain
-            for (float t = 0.0f; t < maxDistance; t += step) {
-                glm::vec3 point = rayOrigin + rayDirection * t;
-                float terrainHeight = terrainManager->GetHeightAt(point.x, point.z);
-
-                if (point.y <= terrainHeight) {
-                    glm::vec4 transform = glm::vec4(point.x, terrainHeight, point.z, collisionRadius * 2.5f);
-                    for (Blades* b : scene->GetBlades()) {
-                        b->UpdateTransformation(transform);
-                    }
-                    break;
-                }
+            // Exact first hit with the terrain surface
+            glm::vec3 point;
+            if (terrainManager->Raycast(rayOrigin, rayDirection, maxDistance, point)) {
+                scene->GetColliders()->Set(cursorCollider, Collider::Sphere(point, collisionRadius * 2.5f));
             }
         }
 
@@ -132,18 +177,10 @@ namespace {
             // Adjust collision size based on scroll input
             collisionRadius += static_cast<float>(yOffset * scrollSensitivity);
 
-            // Update transformation for all blade groups using new collision size
-            const float newScale = collisionRadius * 2.5f;
-            for (Blades* bladeGroup : scene->GetBlades()) {
-                glm::vec4 prevTransform = bladeGroup->GetTransformationData().transform;
-
-                bladeGroup->UpdateTransformation(glm::vec4(
-                    prevTransform.x,
-                    prevTransform.y,
-                    prevTransform.z,
-                    newScale
-                ));
-            }
+            // Resize the cursor's collider in place
+            Collider collider = scene->GetColliders()->Get(cursorCollider);
+            collider.start.w = collisionRadius * 2.5f;
+            scene->GetColliders()->Set(cursorCollider, collider);
         }
         else {
             // Zoom camera in/out using scroll
@@ -180,51 +217,665 @@ namespace {
         }
     }
 
+    Options parseOptions(int argc, char** argv) {
+        Options options;
+        for (int i = 1; i < argc; ++i) {
+            auto hasValue = [&]() { return i + 1 < argc; };
+
+            if (strcmp(argv[i], "--headless") == 0) {
+                options.headless = true;
+            }
+            else if (strcmp(argv[i], "--validate") == 0) {
+                options.validate = true;
+                options.headless = true;
+            }
+            else if (strcmp(argv[i], "--frames") == 0 && hasValue()) {
+                options.frames = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (strcmp(argv[i], "--width") == 0 && hasValue()) {
+                options.width = std::stoi(argv[++i]);
+            }
+            else if (strcmp(argv[i], "--height") == 0 && hasValue()) {
+                options.height = std::stoi(argv[++i]);
+            }
+            else if (strcmp(argv[i], "--timings") == 0 && hasValue()) {
+                options.timingsPath = argv[++i];
+            }
+            else if (strcmp(argv[i], "--gpu-profile") == 0 && hasValue()) {
+                options.gpuProfilePath = argv[++i];
+            }
+            else if (strcmp(argv[i], "--bench") == 0 && hasValue()) {
+                options.bench = argv[++i];
+            }
+            else if (strcmp(argv[i], "--stream-budget") == 0 && hasValue()) {
+                options.streaming.frameBudgetMs = std::stof(argv[++i]);
+            }
+            else if (strcmp(argv[i], "--colliders") == 0 && hasValue()) {
+                options.colliders = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (strcmp(argv[i], "--sim-config") == 0 && hasValue()) {
+                options.simulation = BladeSimulationParams::Load(argv[++i]);
+            }
+            else if (strcmp(argv[i], "--tile-cache") == 0 && hasValue()) {
+                options.streaming.tileCachePath = argv[++i];
+            }
+            else {
+                std::cerr << "Unknown or incomplete option: " << argv[i] << std::endl;
+            }
+        }
+
+        if (options.validate && options.frames == 0) {
+            options.frames = 8;
+        }
+        if (options.headless && options.frames == 0) {
+            options.frames = 1000;
+        }
+        return options;
+    }
+
+    void reportFrameTimings(const std::vector<float>& frameTimes, const std::string& csvPath) {
+        if (frameTimes.empty()) {
+            return;
+        }
+
+        std::vector<float> sorted = frameTimes;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](float p) {
+            size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+            return sorted[index];
+        };
+
+        float total = std::accumulate(sorted.begin(), sorted.end(), 0.0f);
+        float mean = total / sorted.size();
+
+        std::cout << "Frames: " << sorted.size() << std::endl;
+        std::cout << "Frame time (ms): mean " << mean
+            << ", min " << sorted.front()
+            << ", p50 " << percentile(0.5f)
+            << ", p95 " << percentile(0.95f)
+            << ", p99 " << percentile(0.99f)
+            << ", max " << sorted.back() << std::endl;
+        std::cout << "Average FPS: " << 1000.0f / mean << std::endl;
+
+        if (!csvPath.empty()) {
+            std::ofstream csv(csvPath);
+            if (!csv.is_open()) {
+                std::cerr << "Failed to open " << csvPath << std::endl;
+                return;
+            }
+
+            csv << "frame,ms\n";
+            for (size_t i = 0; i < frameTimes.size(); ++i) {
+                csv << i << "," << frameTimes[i] << "\n";
+            }
+        }
+    }
+
+    // Moves the --colliders capsules along circles around the origin, standing upright on the terrain
+    void updateWalkers(float time) {
+        constexpr float twoPi = 6.28318530718f;
+        for (size_t i = 0; i < walkerColliders.size(); ++i) {
+            float angle = 0.3f * time + twoPi * i / walkerColliders.size();
+            float circle = 4.0f + 3.0f * (i % 5);
+            glm::vec3 feet(circle * std::cos(angle), 0.0f, circle * std::sin(angle));
+            feet.y = terrainManager->GetHeightAt(feet.x, feet.z);
+
+            scene->GetColliders()->Set(walkerColliders[i],
+                Collider::Capsule(feet + glm::vec3(0.0f, 0.4f, 0.0f), feet + glm::vec3(0.0f, 1.4f, 0.0f), 0.4f));
+        }
+    }
+
+    // FNV-1a over the generated blade data, to compare runs that split the work differently
+    uint64_t checksumBlades(uint64_t hash, const std::vector<Blade>& blades) {
+        for (const Blade& blade : blades) {
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&blade);
+            size_t size = 4 * sizeof(glm::vec4);
+            for (size_t i = 0; i < size; ++i) {
+                hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+            }
+            hash = (hash ^ static_cast<uint64_t>(blade.bladeType)) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    // Times the blade generation of square grids of tiles on one thread and on the shared pool, and
+    // checks that both produce the same blades. Returns false on a mismatch.
+    bool benchGeneration() {
+        constexpr float tileSize = 15.0f;
+        ThreadPool serial(1);
+        ThreadPool& parallel = ThreadPool::Shared();
+
+        auto run = [&](ThreadPool& pool, uint32_t grid, uint64_t& checksum) {
+            checksum = 0xCBF29CE484222325ull;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (uint32_t z = 0; z < grid; ++z) {
+                for (uint32_t x = 0; x < grid; ++x) {
+                    std::vector<Blade> blades = Blades::GenerateTile(DEFAULT_BLADE_SEED, tileSize, x * tileSize, z * tileSize, &pool);
+                    checksum = checksumBlades(checksum, blades);
+                }
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            return std::chrono::duration<float, std::milli>(end - start).count();
+        };
+
+        bool deterministic = true;
+        std::cout << "grid,tiles,blades,serial_ms,parallel_ms,threads,speedup" << std::endl;
+        for (uint32_t grid : { 1u, 2u, 4u, 8u }) {
+            uint64_t serialChecksum, parallelChecksum;
+            float serialMs = run(serial, grid, serialChecksum);
+            float parallelMs = run(parallel, grid, parallelChecksum);
+
+            uint32_t tiles = grid * grid;
+            std::cout << grid << "x" << grid << "," << tiles << "," << static_cast<uint64_t>(tiles) * NUM_BLADES << ","
+                << serialMs << "," << parallelMs << "," << parallel.GetThreadCount() << "," << serialMs / parallelMs << std::endl;
+
+            if (serialChecksum != parallelChecksum) {
+                std::cerr << "Blades of the " << grid << "x" << grid << " grid differ between thread counts" << std::endl;
+                deterministic = false;
+            }
+        }
+        return deterministic;
+    }
+
+    // Times loading every tile of the cache at path against generating it: the cached path maps the file,
+    // reads each tile's pages in, copies its heights out and its blades into a staging-sized buffer (what
+    // TerrainManager and LoadTile do). Run it right after dropping the OS page cache for cold numbers.
+    // Returns false if the cache is unusable or a cached tile differs from the generated one.
+    bool benchTileCache(const std::string& path) {
+        if (path.empty()) {
+            std::cerr << "--bench tile-cache needs --tile-cache FILE" << std::endl;
+            return false;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        std::unique_ptr<TileCache> mapped;
+        try {
+            mapped.reset(new TileCache(path));
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return false;
+        }
+        const TileCache& cache = *mapped;
+        const TileCacheHeader& header = cache.GetHeader();
+        std::vector<char> staging(BLADES_BUFFER_SIZE);
+        for (uint32_t i = 0; i < cache.GetTileCount(); ++i) {
+            const TileCacheEntry& entry = cache.GetEntry(i);
+            cache.Prefetch(entry);
+            std::vector<float> heights(cache.GetHeights(entry), cache.GetHeights(entry) + cache.GetHeightCount());
+            memcpy(staging.data(), cache.GetBlades(entry).data, BLADES_BUFFER_SIZE);
+        }
+        float cacheMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        bool identical = true;
+        float generateMs = 0.0f;
+        for (uint32_t i = 0; i < cache.GetTileCount(); ++i) {
+            const TileCacheEntry& entry = cache.GetEntry(i);
+            float worldX = entry.keyX * header.tileSize;
+            float worldZ = entry.keyZ * header.tileSize;
+
+            auto tileStart = std::chrono::high_resolution_clock::now();
+            BladeTile blades = Blades::PrepareTile(header.seed, header.tileSize, worldX, worldZ);
+            std::vector<float> heights = Terrain::GenerateHeights(header.tileSize, header.resolution, worldX, worldZ);
+            generateMs += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - tileStart).count();
+
+            BladeTileView cached = cache.GetBlades(entry);
+            if (memcmp(cached.data, blades.data.data(), BLADES_BUFFER_SIZE) != 0
+                || memcmp(cached.clusterBounds, blades.clusterBounds.data(), CLUSTERS_PER_TILE * sizeof(BladeBounds)) != 0
+                || memcmp(cache.GetHeights(entry), heights.data(), heights.size() * sizeof(float)) != 0) {
+                std::cerr << "Cached tile (" << entry.keyX << ", " << entry.keyZ << ") differs from the generated one" << std::endl;
+                identical = false;
+            }
+        }
+
+        float megabytes = header.fileSize / (1024.0f * 1024.0f);
+        std::cout << "tiles,megabytes,generate_ms,cache_ms,cache_mb_per_s,speedup" << std::endl;
+        std::cout << cache.GetTileCount() << "," << megabytes << "," << generateMs << "," << cacheMs << ","
+            << megabytes / (cacheMs / 1000.0f) << "," << generateMs / cacheMs << std::endl;
+        return identical;
+    }
+
+    // Times re-recording the graphics command buffers of every frame in flight (what a resize costs the
+    // main thread, and showing or hiding a tile each frame in flight) for square grids of terrain tiles,
+    // recorded over 1, 2, 4 and all hardware threads. The tiles are flat and share one grid; a single
+    // empty blade slot stands in for the grass.
+    void benchRecording(Device* device, UploadBatcher* uploader, VkImage texture, const Options& options) {
+        constexpr uint32_t repeats = 20;
+        VkExtent2D extent = { static_cast<uint32_t>(options.width), static_cast<uint32_t>(options.height) };
+
+        std::vector<unsigned int> threadCounts = { 1, 2, 4 };
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        if (hardwareThreads > threadCounts.back()) {
+            threadCounts.push_back(hardwareThreads);
+        }
+
+        std::cout << "grid,tiles,threads,command_buffers,record_ms,us_per_draw,speedup" << std::endl;
+        for (uint32_t grid : { 3u, 9u, 17u, 33u }) {
+            Scene* benchScene = new Scene(device);
+            TerrainGrid* terrainGrid = new TerrainGrid(device, uploader, DEFAULT_TILE_RESOLUTION);
+            std::vector<float> flat(terrainGrid->GetVertexCount(), 0.0f);
+            std::vector<Terrain*> tiles;
+            for (uint32_t z = 0; z < grid; ++z) {
+                for (uint32_t x = 0; x < grid; ++x) {
+                    Terrain* tile = new Terrain(device, uploader, terrainGrid, DEFAULT_TILE_SIZE, flat, x * DEFAULT_TILE_SIZE, z * DEFAULT_TILE_SIZE);
+                    tile->SetTexture(texture);
+                    benchScene->AddModel(tile);
+                    tiles.push_back(tile);
+                }
+            }
+            Blades* blades = new Blades(device, uploader, 1);
+            benchScene->AddBlades(blades);
+            uploader->Flush();
+
+            float serialMs = 0.0f;
+            for (unsigned int threads : threadCounts) {
+                ThreadPool recordPool(threads);
+                Renderer* benchRenderer = new Renderer(device, extent, benchScene, camera, options.simulation, &recordPool);
+                auto start = std::chrono::high_resolution_clock::now();
+                for (uint32_t i = 0; i < repeats; ++i) {
+                    benchRenderer->RerecordCommandBuffers();
+                }
+                float recordMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repeats;
+                if (threads == 1) {
+                    serialMs = recordMs;
+                }
+
+                uint32_t commandBuffers = MAX_FRAMES_IN_FLIGHT * benchRenderer->GetImageCount();
+                std::cout << grid << "x" << grid << "," << tiles.size() << "," << threads << "," << commandBuffers << "," << recordMs << ","
+                    << 1000.0f * recordMs / (commandBuffers * tiles.size()) << "," << serialMs / recordMs << std::endl;
+
+                vkDeviceWaitIdle(device->GetVkDevice());
+                delete benchRenderer;
+            }
+
+            delete blades;
+            for (Terrain* tile : tiles) {
+                delete tile;
+            }
+            delete terrainGrid;
+            delete benchScene;
+        }
+    }
+
+    // Times BladeSimulator on square grids of tiles laid out like the blade pool, for a few frames from the
+    // initial camera, on one thread and on the shared pool, and checks that both leave the same blades and
+    // visible lists. Needs no GPU. Returns false on a mismatch.
+    bool benchCpuSimulation(const BladeSimulationParams& params) {
+        constexpr uint32_t frames = 10;
+        constexpr float frameTime = 1.0f / 60.0f;
+        ThreadPool serial(1);
+        ThreadPool& parallel = ThreadPool::Shared();
+        CameraBufferObject cameraBufferObject = Camera::GetInitialBufferObject(640.0f / 480.0f);
+        std::vector<Collider> colliders;
+
+        auto run = [&](ThreadPool& pool, std::vector<Blade>& blades, std::vector<Blade>& culledBlades) {
+            BladeSimulator simulator(&pool);
+            simulator.GetParams() = params;
+            Time time;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (uint32_t frame = 0; frame < frames; ++frame) {
+                time.deltaTime = frameTime;
+                time.totalTime += frameTime;
+                simulator.Simulate(blades, cameraBufferObject, time, colliders, culledBlades);
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            return std::chrono::duration<float, std::milli>(end - start).count() / frames;
+        };
+
+        bool deterministic = true;
+        std::cout << "grid,tiles,blades,visible,serial_ms,parallel_ms,threads,speedup,mblades_per_s" << std::endl;
+        for (int grid : { 1, 3, 5 }) {
+            std::vector<Blade> pool;
+            for (int z = -grid / 2; z <= grid / 2; ++z) {
+                for (int x = -grid / 2; x <= grid / 2; ++x) {
+                    std::vector<Blade> tile = Blades::GenerateTile(DEFAULT_BLADE_SEED, DEFAULT_TILE_SIZE, x * DEFAULT_TILE_SIZE, z * DEFAULT_TILE_SIZE);
+                    pool.insert(pool.end(), tile.begin(), tile.end());
+                }
+            }
+
+            std::vector<Blade> serialBlades = pool;
+            std::vector<Blade> parallelBlades = pool;
+            std::vector<Blade> serialCulled, parallelCulled;
+            float serialMs = run(serial, serialBlades, serialCulled);
+            float parallelMs = run(parallel, parallelBlades, parallelCulled);
+
+            std::cout << grid << "x" << grid << "," << grid * grid << "," << pool.size() << "," << parallelCulled.size() << ","
+                << serialMs << "," << parallelMs << "," << parallel.GetThreadCount() << "," << serialMs / parallelMs << ","
+                << pool.size() / (parallelMs * 1000.0f) << std::endl;
+
+            constexpr uint64_t basis = 0xCBF29CE484222325ull;
+            if (checksumBlades(basis, serialBlades) != checksumBlades(basis, parallelBlades)
+                || checksumBlades(basis, serialCulled) != checksumBlades(basis, parallelCulled)) {
+                std::cerr << "Simulated blades of the " << grid << "x" << grid << " grid differ between thread counts" << std::endl;
+                deterministic = false;
+            }
+        }
+        return deterministic;
+    }
+
+    // Exact bits of a blade's base, which the simulation never changes: identifies the blade in a visible list
+    using BladeKey = std::array<uint32_t, 3>;
+
+    BladeKey bladeKey(const Blade& blade) {
+        BladeKey key;
+        memcpy(key.data(), &blade.v0, sizeof(key));
+        return key;
+    }
+
+#ifdef GRASS_COMPACT_BLADES
+    glm::vec4 unpackHalf4(const uint32_t* words) {
+        return glm::vec4(glm::unpackHalf2x16(words[0]), glm::unpackHalf2x16(words[1]));
+    }
+
+    // Blade of compact half4 control points and attribs relative to the tile origin, as compute.comp loads it
+    Blade decodeCompactBlade(const uint32_t* base, const uint32_t* middle, const uint32_t* tip, uint32_t attribs, const glm::vec4& origin) {
+        Blade blade;
+        blade.v0 = unpackHalf4(base) + glm::vec4(glm::vec3(origin), 0.0f);
+        blade.v1 = unpackHalf4(middle) + glm::vec4(glm::vec3(origin), 0.0f);
+        blade.v2 = unpackHalf4(tip) + glm::vec4(glm::vec3(origin), 0.0f);
+        blade.up = glm::vec4(0.0f, 1.0f, 0.0f, glm::unpackHalf2x16(attribs).x);
+        blade.bladeType = static_cast<int>((attribs >> 16) & 0x3u);
+        return blade;
+    }
+#endif
+
+    // Every blade of the pool, from a readback of one of its blades buffers
+    std::vector<Blade> decodeBladeState(const std::vector<char>& data, uint32_t bladeCapacity, const std::vector<glm::vec4>& tileOrigins) {
+        std::vector<Blade> blades(bladeCapacity);
+#ifdef GRASS_COMPACT_BLADES
+        const uint32_t* words = reinterpret_cast<const uint32_t*>(data.data());
+        for (uint32_t id = 0; id < bladeCapacity; ++id) {
+            blades[id] = decodeCompactBlade(words + 2 * id, words + 2 * (bladeCapacity + id), words + 2 * (2 * bladeCapacity + id),
+                words[6 * bladeCapacity + id], tileOrigins[id / NUM_BLADES]);
+        }
+#else
+        (void)tileOrigins;
+        memcpy(blades.data(), data.data(), bladeCapacity * sizeof(Blade));
+#endif
+        return blades;
+    }
+
+    // Compares one frame of the pool's simulation with BladeSimulator. input is the state the frame started
+    // from, the readbacks are what it left. Only the clusters the GPU's cluster pass kept are compared: the
+    // others are neither simulated nor drawn there. The simulator must have seen every earlier frame, for its
+    // trample field to match the GPU's. Prints a line and returns false on a mismatch.
+    bool validateBladeFrame(uint32_t frameNumber, BladeSimulator& simulator, Blades* blades, VkCommandPool commandPool,
+        uint32_t frame, const std::vector<Blade>& input, const std::vector<glm::vec4>& tileOrigins) {
+        uint32_t tileCapacity = blades->GetTileCapacity();
+        uint32_t bladeCapacity = tileCapacity * NUM_BLADES;
+
+        std::vector<char> stateData(blades->GetBladesBufferSize());
+        BufferUtils::ReadBuffer(device, commandPool, blades->GetBladesBuffer(frame), stateData.size(), stateData.data());
+        std::vector<Blade> gpuState = decodeBladeState(stateData, bladeCapacity, tileOrigins);
+
+        std::vector<BladeDrawIndirect> drawArgs(tileCapacity);
+        BufferUtils::ReadBuffer(device, commandPool, blades->GetNumBladesBuffer(frame), blades->GetNumBladesBufferSize(), drawArgs.data());
+        std::vector<CulledBlade> culled(bladeCapacity);
+        BufferUtils::ReadBuffer(device, commandPool, blades->GetCulledBladesBuffer(frame), blades->GetCulledBladesBufferSize(), culled.data());
+        std::vector<uint32_t> clusterList(blades->GetClusterBufferSize() / sizeof(uint32_t));
+        BufferUtils::ReadBuffer(device, commandPool, blades->GetClusterBuffer(), blades->GetClusterBufferSize(), clusterList.data());
+
+        // The dispatch counts CLUSTER_SIZE / workgroup size workgroups per kept cluster, whose ids follow it
+        std::vector<bool> simulated(tileCapacity * CLUSTERS_PER_TILE, false);
+        uint32_t clusterCount = clusterList[0] / (CLUSTER_SIZE / renderer->GetSimulationWorkgroupSize());
+        if (clusterCount > simulated.size()) {
+            std::cerr << "Frame " << frameNumber << ": " << clusterCount << " clusters in the list" << std::endl;
+            return false;
+        }
+        for (uint32_t i = 0; i < clusterCount; ++i) {
+            uint32_t cluster = clusterList[4 + i];
+            if (cluster >= simulated.size()) {
+                std::cerr << "Frame " << frameNumber << ": cluster " << cluster << " in the list" << std::endl;
+                return false;
+            }
+            simulated[cluster] = true;
+        }
+
+        CameraBufferObject cameraBufferObject = { camera->GetViewMatrix(), camera->GetProjectionMatrix() };
+        std::vector<Collider> colliders = { scene->GetColliders()->Get(cursorCollider) };
+        for (uint32_t id : walkerColliders) {
+            colliders.push_back(scene->GetColliders()->Get(id));
+        }
+
+        bool trampling = false;
+        for (const Collider& collider : colliders) {
+            trampling = trampling || collider.start.w > 0.0f;
+        }
+
+        std::vector<Blade> cpuCulled;
+        std::vector<uint32_t> cpuCulledIds;
+        std::vector<Blade> cpuState = input;
+        simulator.Simulate(cpuState, cameraBufferObject, scene->GetTime(), colliders, cpuCulled, &cpuCulledIds, blades->GetClusterBounds());
+
+        // Both skip the clusters beyond the distance culling range; the GPU also skips those outside the view
+        uint32_t clusterMismatches = 0;
+        for (uint32_t cluster = 0; cluster < simulated.size(); ++cluster) {
+            if (simulated[cluster] && !simulator.IsClusterSimulated(cluster)) {
+                clusterMismatches++;
+            }
+        }
+
+        // Control points: float rounding, or half precision relative to the tile origin in the compact layout.
+        // The GPU filters the trample field with only subTexelPrecisionBits of sub-texel precision, which
+        // shifts the rest position of trampled blades a little.
+#ifdef GRASS_COMPACT_BLADES
+        float tolerance = 1e-2f;
+#else
+        float tolerance = trampling ? 5e-3f : 1e-3f;
+#endif
+        float maxError = 0.0f;
+        uint32_t stateMismatches = 0;
+        for (uint32_t id = 0; id < bladeCapacity; ++id) {
+            if (!simulated[id / CLUSTER_SIZE] || !simulator.IsClusterSimulated(id / CLUSTER_SIZE)) {
+                continue;
+            }
+            float error = std::max(glm::length(glm::vec3(gpuState[id].v1) - glm::vec3(cpuState[id].v1)),
+                glm::length(glm::vec3(gpuState[id].v2) - glm::vec3(cpuState[id].v2)));
+            maxError = std::max(maxError, error);
+            if (!(error <= tolerance)) {
+                stateMismatches++;
+            }
+        }
+
+        // Visible lists per tile, as sorted keys
+        std::vector<std::vector<BladeKey>> gpuVisible(tileCapacity), cpuVisible(tileCapacity);
+        for (size_t i = 0; i < cpuCulledIds.size(); ++i) {
+            uint32_t id = cpuCulledIds[i];
+            if (simulated[id / CLUSTER_SIZE]) {
+                cpuVisible[id / NUM_BLADES].push_back(bladeKey(input[id]));
+            }
+        }
+
+        uint32_t gpuCount = 0;
+        uint32_t cpuCount = 0;
+        uint32_t visibilityMismatches = 0;
+        for (uint32_t tile = 0; tile < tileCapacity; ++tile) {
+#ifdef GRASS_CULL_INDICES
+            uint32_t count = drawArgs[tile].indexCount;
+#else
+            uint32_t count = drawArgs[tile].vertexCount;
+#endif
+            if (count > NUM_BLADES) {
+                std::cerr << "Frame " << frameNumber << ": tile " << tile << " draws " << count << " blades" << std::endl;
+                return false;
+            }
+
+            for (uint32_t i = 0; i < count; ++i) {
+                const CulledBlade& record = culled[tile * NUM_BLADES + i];
+#if defined(GRASS_CULL_INDICES)
+                if (record >= bladeCapacity) {
+                    std::cerr << "Frame " << frameNumber << ": tile " << tile << " draws blade " << record << std::endl;
+                    return false;
+                }
+                gpuVisible[tile].push_back(bladeKey(input[record]));
+#elif defined(GRASS_COMPACT_BLADES)
+                gpuVisible[tile].push_back(bladeKey(decodeCompactBlade(record.v0, record.v1, record.v2, record.attribs, tileOrigins[tile])));
+#else
+                gpuVisible[tile].push_back(bladeKey(record));
+#endif
+            }
+
+            std::sort(gpuVisible[tile].begin(), gpuVisible[tile].end());
+            std::sort(cpuVisible[tile].begin(), cpuVisible[tile].end());
+            std::vector<BladeKey> difference;
+            std::set_symmetric_difference(gpuVisible[tile].begin(), gpuVisible[tile].end(),
+                cpuVisible[tile].begin(), cpuVisible[tile].end(), std::back_inserter(difference));
+
+            gpuCount += count;
+            cpuCount += static_cast<uint32_t>(cpuVisible[tile].size());
+            visibilityMismatches += static_cast<uint32_t>(difference.size());
+        }
+
+        // Blades right at a culling threshold may fall either way between the CPU and GPU arithmetic
+        uint32_t allowedMismatches = std::max(8u, cpuCount / 1000);
+        bool valid = clusterMismatches == 0 && stateMismatches == 0 && visibilityMismatches <= allowedMismatches;
+
+        std::cout << "Frame " << frameNumber << ": " << clusterCount << " clusters (" << clusterMismatches << " kept beyond max_dist), visible blades GPU " << gpuCount << " CPU " << cpuCount
+            << ", visibility mismatches " << visibilityMismatches << " (allowed " << allowedMismatches << "), max control point error "
+            << maxError << ", over " << tolerance << ": " << stateMismatches << (valid ? "" : " FAILED") << std::endl;
+        return valid;
+    }
+
+    // Runs the headless frames, checking each one's simulation and culling against BladeSimulator: the blade state
+    // a frame starts from is read back, simulated on the CPU with the frame's camera, time and colliders, and compared
+    // with the blades, numBladesBuffer and culledBladesBuffer the frame left. Returns false if any frame differs.
+    bool validateSimulation(const Options& options) {
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        VkCommandPool commandPool;
+        if (vkCreateCommandPool(device->GetVkDevice(), &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create readback command pool");
+        }
+
+        // One simulator per pool for the whole run, as each carries its trample field from frame to frame
+        std::vector<std::unique_ptr<BladeSimulator>> simulators;
+        for (size_t i = 0; i < scene->GetBlades().size(); ++i) {
+            simulators.emplace_back(new BladeSimulator());
+            simulators.back()->GetParams() = options.simulation;
+        }
+
+        bool valid = true;
+        for (uint32_t frameNumber = 0; frameNumber < options.frames; ++frameNumber) {
+            uint32_t frame = renderer->GetCurrentFrame();
+
+            // Every earlier frame has to be done with the state this one starts from
+            vkDeviceWaitIdle(device->GetVkDevice());
+            std::vector<std::vector<Blade>> inputs;
+            std::vector<std::vector<glm::vec4>> tileOrigins;
+            for (Blades* blades : scene->GetBlades()) {
+                std::vector<glm::vec4> origins(blades->GetTileCapacity());
+                BufferUtils::ReadBuffer(device, commandPool, blades->GetTileBuffer(), blades->GetTileBufferSize(), origins.data());
+                std::vector<char> data(blades->GetBladesBufferSize());
+                BufferUtils::ReadBuffer(device, commandPool, blades->GetPreviousBladesBuffer(frame), data.size(), data.data());
+                inputs.push_back(decodeBladeState(data, blades->GetTileCapacity() * NUM_BLADES, origins));
+                tileOrigins.push_back(origins);
+            }
+
+            scene->UpdateTime();
+            updateWalkers(scene->GetTime().totalTime);
+            renderer->Frame();
+            vkDeviceWaitIdle(device->GetVkDevice());
+
+            for (size_t i = 0; i < scene->GetBlades().size(); ++i) {
+                if (!validateBladeFrame(frameNumber, *simulators[i], scene->GetBlades()[i], commandPool, frame, inputs[i], tileOrigins[i])) {
+                    valid = false;
+                }
+            }
+        }
+
+        vkDestroyCommandPool(device->GetVkDevice(), commandPool, nullptr);
+        std::cout << "Validation against BladeSimulator " << (valid ? "passed" : "FAILED") << std::endl;
+        return valid;
+    }
 
 }
 
-int main() {
+int main(int argc, char** argv) {
+    Options options = parseOptions(argc, argv);
+
+    // The record benchmark needs a device, the others run before one is created
+    bool benchRecord = options.bench == "record";
+    if (benchRecord) {
+        options.headless = true;
+    }
+    else if (!options.bench.empty()) {
+        if (options.bench == "generation") {
+            return benchGeneration() ? 0 : 1;
+        }
+        if (options.bench == "tile-cache") {
+            return benchTileCache(options.streaming.tileCachePath) ? 0 : 1;
+        }
+        if (options.bench == "cpu-sim") {
+            return benchCpuSimulation(options.simulation) ? 0 : 1;
+        }
+        std::cerr << "Unknown benchmark: " << options.bench << std::endl;
+        return 1;
+    }
 
     static constexpr char* applicationName = "Vulkan Grass Rendering";
-    InitializeWindow(640, 480, applicationName);
 
-    unsigned int glfwExtensionCount = 0;
-    const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    Instance* instance = nullptr;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    QueueFlagBits requiredQueues = QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit;
 
-    Instance* instance = new Instance(applicationName, glfwExtensionCount, glfwExtensions);
+    if (options.headless) {
+        // No window system: no surface, no present queue, no swap chain extension
+        instance = new Instance(applicationName);
+        instance->PickPhysicalDevice({}, requiredQueues);
 
-    VkSurfaceKHR surface;
-    if (glfwCreateWindowSurface(instance->GetVkInstance(), GetGLFWWindow(), nullptr, &surface) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create window surface");
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(instance->GetPhysicalDevice(), &properties);
+        std::cout << "Headless on " << properties.deviceName << " (" << options.width << "x" << options.height << ", " << options.frames << " frames)" << std::endl;
+        std::cout << "Blade layout: " << BLADE_LAYOUT_NAME << " (" << BLADES_BUFFER_SIZE / NUM_BLADES << " bytes/blade), cull output: "
+            << CULL_OUTPUT_NAME << " (" << sizeof(CulledBlade) << " bytes/visible blade)" << std::endl;
     }
+    else {
+        InitializeWindow(options.width, options.height, applicationName);
+
+        unsigned int glfwExtensionCount = 0;
+        const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+        instance = new Instance(applicationName, glfwExtensionCount, glfwExtensions);
 
-    instance->PickPhysicalDevice({ VK_KHR_SWAPCHAIN_EXTENSION_NAME }, QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit, surface);
+        if (glfwCreateWindowSurface(instance->GetVkInstance(), GetGLFWWindow(), nullptr, &surface) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create window surface");
+        }
+
+        requiredQueues |= QueueFlagBit::PresentBit;
+        instance->PickPhysicalDevice({ VK_KHR_SWAPCHAIN_EXTENSION_NAME }, requiredQueues, surface);
+    }
 
     VkPhysicalDeviceFeatures deviceFeatures = {};
     deviceFeatures.tessellationShader = VK_TRUE;
     deviceFeatures.fillModeNonSolid = VK_TRUE;
     deviceFeatures.samplerAnisotropy = VK_TRUE;
 
-    device = instance->CreateDevice(QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit, deviceFeatures);
+    // Optional: let the grass pass draw every tile of the blade pool with one indirect call
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(instance->GetPhysicalDevice(), &supportedFeatures);
+    deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+    // Optional: tessellation and fragment invocation counts in the GPU profiler
+    deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
 
-    swapChain = device->CreateSwapChain(surface, 5);
+    device = instance->CreateDevice(requiredQueues, deviceFeatures);
 
-    camera = new Camera(device, 640.f / 480.f);
+    if (!options.headless) {
+        swapChain = device->CreateSwapChain(surface, 5);
+    }
 
-    VkCommandPoolCreateInfo transferPoolInfo = {};
-    transferPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    transferPoolInfo.queueFamilyIndex = device->GetInstance()->GetQueueFamilyIndices()[QueueFlags::Transfer];
-    transferPoolInfo.flags = 0;
+    camera = new Camera(device, static_cast<float>(options.width) / options.height);
 
-    VkCommandPool transferCommandPool;
-    if (vkCreateCommandPool(device->GetVkDevice(), &transferPoolInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create command pool");
-    }
+    // All startup uploads (textures, terrain and blades) are staged into one ring and submitted in batches
+    UploadBatcher* uploader = new UploadBatcher(device);
 
     VkImage grassImage;
-    VkDeviceMemory grassImageMemory;
+    MemoryAllocation grassImageMemory;
     Image::FromFile(device,
-        transferCommandPool,
+        uploader,
         "images/grass.jpg",
         VK_FORMAT_R8G8B8A8_UNORM,
         VK_IMAGE_TILING_OPTIMAL,
@@ -238,7 +889,7 @@ int main() {
     
     //float planeDim = 15.f;
     //float halfWidth = planeDim * 0.5f;
-    //Model* plane = new Model(device, transferCommandPool,
+    //Model* plane = new Model(device, uploader,
     //    {
     //        { { -halfWidth, 0.0f, halfWidth }, { 1.0f, 0.0f, 0.0f },{ 1.0f, 0.0f } },
     //        { { halfWidth, 0.0f, halfWidth }, { 0.0f, 1.0f, 0.0f },{ 0.0f, 0.0f } },
@@ -249,60 +900,114 @@ int main() {
     //);
     //plane->SetTexture(grassImage);
 
+    if (benchRecord) {
+        benchRecording(device, uploader, grassImage, options);
+
+        Image::Destroy(device, grassImage, grassImageMemory);
+        delete uploader;
+        delete camera;
+        delete device;
+        delete instance;
+        return 0;
+    }
+
     scene = new Scene(device);
+    cursorCollider = scene->GetColliders()->Add(Collider::Sphere(glm::vec3(0.0f), 0.0f));
+    for (uint32_t i = 0; i < options.colliders; ++i) {
+        walkerColliders.push_back(scene->GetColliders()->Add(Collider::Sphere(glm::vec3(0.0f), 0.0f)));
+    }
 
   
 
-    //terrain = new Terrain(device, transferCommandPool, planeDim, 100);
+    //terrain = new Terrain(device, uploader, planeDim, 100);
     //terrain->SetTexture(grassImage); //Important!
 
     int gridWidth = 3;
     int gridHeight = 3;
-    float tileSize = 15.0f;
-    int resolution = 100;
+    float tileSize = DEFAULT_TILE_SIZE;
+    int resolution = DEFAULT_TILE_RESOLUTION;
 
-    //terrainManager = new TerrainManager(device, transferCommandPool, scene, grassImage, tileSize, resolution, gridWidth, gridHeight, 1, 2);
+    //terrainManager = new TerrainManager(device, uploader, scene, grassImage, tileSize, resolution, gridWidth, gridHeight, 1, 2);
 
-    terrainManager = new TerrainManager(device, transferCommandPool, scene, grassImage, tileSize, resolution, gridWidth, gridHeight);
+    terrainManager = new TerrainManager(device, uploader, scene, grassImage, tileSize, resolution, gridWidth, gridHeight, options.streaming);
+    uploader->Flush();
+    std::cout << "Startup uploads: " << uploader->GetSubmitCount() << " submissions" << std::endl;
+    device->GetAllocator()->DumpStats(std::cout);
 
     for (auto* b : scene->GetBlades()) {
-        std::cout << b->GetNumBladesBuffer() << std::endl;
+        std::cout << b->GetNumBladesBuffer(0) << std::endl;
     }
 
 
-    renderer = new Renderer(device, swapChain, scene, camera);
-
-    glfwSetWindowSizeCallback(GetGLFWWindow(), resizeCallback);
-    glfwSetMouseButtonCallback(GetGLFWWindow(), mouseDownCallback);
-    glfwSetCursorPosCallback(GetGLFWWindow(), mouseMoveCallback);
-    glfwSetScrollCallback(GetGLFWWindow(), scrollCallback);
-    glfwSetKeyCallback(GetGLFWWindow(), keyCallback);
-
-
-    while (!ShouldQuit()) {
-        glfwPollEvents();
-        scene->UpdateTime();
-
-        //terrainManager->Update(camera->GetPosition());
-
-
-        // FPS logging
-        static float fpsTimer = 0.0f;
-        fpsTimer += scene->GetTime().deltaTime;
-        if (fpsTimer > 1.0f) {
-            //std::cout << "FPS: " << scene->GetFPS() << std::endl;
-            fpsTimer = 0.0f;
+    bool valid = true;
+    if (options.validate) {
+        // The camera does not move, so no tile streams in or out between the readbacks
+        VkExtent2D extent = { static_cast<uint32_t>(options.width), static_cast<uint32_t>(options.height) };
+        renderer = new Renderer(device, extent, scene, camera, options.simulation);
+        valid = validateSimulation(options);
+    }
+    else if (options.headless) {
+        VkExtent2D extent = { static_cast<uint32_t>(options.width), static_cast<uint32_t>(options.height) };
+        renderer = new Renderer(device, extent, scene, camera, options.simulation);
+
+        for (uint32_t frame = 0; frame < options.frames; ++frame) {
+            scene->UpdateTime();
+            terrainManager->Update(camera->GetPosition());
+            updateWalkers(scene->GetTime().totalTime);
+            renderer->Frame();
         }
+    }
+    else {
+        renderer = new Renderer(device, swapChain, scene, camera, options.simulation);
+
+        glfwSetWindowSizeCallback(GetGLFWWindow(), resizeCallback);
+        glfwSetMouseButtonCallback(GetGLFWWindow(), mouseDownCallback);
+        glfwSetCursorPosCallback(GetGLFWWindow(), mouseMoveCallback);
+        glfwSetScrollCallback(GetGLFWWindow(), scrollCallback);
+        glfwSetKeyCallback(GetGLFWWindow(), keyCallback);
+
+        uint32_t frame = 0;
+        while (!ShouldQuit() && (options.frames == 0 || frame++ < options.frames)) {
+            glfwPollEvents();
+            scene->UpdateTime();
+
+            terrainManager->Update(camera->GetPosition());
+            updateWalkers(scene->GetTime().totalTime);
+
+
+            // FPS logging
+            static float fpsTimer = 0.0f;
+            fpsTimer += scene->GetTime().deltaTime;
+            if (fpsTimer > 1.0f) {
+                const GpuFrameStats* gpu = renderer->GetProfiler()->GetLatest();
+                std::cout << "FPS: " << scene->GetFPS() << ", terrain triangles " << terrainManager->GetTriangleCount();
+                if (gpu != nullptr) {
+                    std::cout << ", GPU (ms): trample " << gpu->trampleMs << ", simulation " << gpu->simulationMs
+                        << ", terrain " << gpu->terrainMs << ", grass " << gpu->grassMs
+                        << ", visible blades " << gpu->visibleBlades;
+                }
+                std::cout << std::endl;
+                fpsTimer = 0.0f;
+            }
 
-        renderer->Frame();
+            renderer->Frame();
+        }
     }
 
     vkDeviceWaitIdle(device->GetVkDevice());
 
-    vkDestroyImage(device->GetVkDevice(), grassImage, nullptr);
-    vkFreeMemory(device->GetVkDevice(), grassImageMemory, nullptr);
+    Image::Destroy(device, grassImage, grassImageMemory);
 
-    vkDestroyCommandPool(device->GetVkDevice(), transferCommandPool, nullptr);
+    delete uploader;
+
+    reportFrameTimings(renderer->GetFrameTimes(), options.timingsPath);
+    if (!options.gpuProfilePath.empty()) {
+        const std::string& path = options.gpuProfilePath;
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        if (json ? renderer->GetProfiler()->WriteJson(path) : renderer->GetProfiler()->WriteCsv(path)) {
+            std::cout << "GPU profile written to " << path << std::endl;
+        }
+    }
 
     delete scene;
 
@@ -313,8 +1018,13 @@ int main() {
     delete renderer;
     delete swapChain;
     delete device;
+    if (surface != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(instance->GetVkInstance(), surface, nullptr);
+    }
     delete instance;
 
-    DestroyWindow();
-    return 0;
+    if (!options.headless) {
+        DestroyWindow();
+    }
+    return valid ? 0 : 1;
 }
@@ -10,22 +10,30 @@ layout(set = 0, binding = 0) uniform CameraBuffer {
 };
 
 // ─────────────────────────────────────────────
-// Model Transform Uniforms
-// - model: object-to-world matrix
-// - objectTrans: xyz = offset, w = scale
+// Terrain Tile Uniforms
+// - model: grid-to-world matrix, one unit per grid cell
+// - heightMap: height of every grid vertex, (resolution + 1)^2 texels
 // ─────────────────────────────────────────────
 layout(set = 1, binding = 0) uniform ModelBuffer {
     mat4 u_ModelMatrix;
-    vec4 u_ObjectTransform; // .xyz = offset, .w = scale
+    vec4 u_ObjectTransform;
 };
 
+layout(set = 1, binding = 2) uniform sampler2D u_HeightMap;
+
 // ─────────────────────────────────────────────
 // Vertex Attributes
+// - gridCoord: vertex of the patch shared by every tile
+// - patch (per instance): xy = grid vertex the patch starts at,
+//   z = grid cells per patch cell, see TerrainPatchInstance
+// - morphRange (per instance): distances from lodCenter over which
+//   the patch morphs into the next coarser LOD level
+// - lodCenter (per instance): camera position of the LOD selection
 // ─────────────────────────────────────────────
-layout(location = 0) in vec3 a_Position;
-layout(location = 1) in vec3 a_Color;
-layout(location = 2) in vec2 a_TexCoord;
-layout(location = 3) in int a_BladeType; 
+layout(location = 0) in uvec2 a_GridCoord;
+layout(location = 1) in vec4 a_Patch;
+layout(location = 2) in vec2 a_MorphRange;
+layout(location = 3) in vec3 a_LodCenter;
 
 // ─────────────────────────────────────────────
 // Outputs to Fragment Shader / TCS
@@ -40,24 +48,42 @@ out gl_PerVertex {
     vec4 gl_Position;
 };
 
+// Bilinear height between grid vertices, from four exact texels
+// (filtering R32F is optional in Vulkan)
+float heightAt(vec2 gridPosition) {
+    ivec2 lastTexel = textureSize(u_HeightMap, 0) - 1;
+    ivec2 t0 = clamp(ivec2(floor(gridPosition)), ivec2(0), lastTexel);
+    ivec2 t1 = min(t0 + 1, lastTexel);
+    vec2 f = gridPosition - vec2(t0);
+
+    float h00 = texelFetch(u_HeightMap, t0, 0).r;
+    float h10 = texelFetch(u_HeightMap, ivec2(t1.x, t0.y), 0).r;
+    float h01 = texelFetch(u_HeightMap, ivec2(t0.x, t1.y), 0).r;
+    float h11 = texelFetch(u_HeightMap, t1, 0).r;
+    return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+}
+
 void main() {
-    vec3 worldPosition = a_Position;
+    vec2 patchCoord = vec2(a_GridCoord);
+    vec2 gridPosition = a_Patch.xy + patchCoord * a_Patch.z;
 
     // ─────────────────────────────────────────
-    // Conditional transformation for special case
-    // If UV == (0.7, 0.7), apply scale and translation
+    // CDLOD morph: over the morph range, odd patch vertices
+    // slide onto their even neighbours, which are the vertices
+    // of the next coarser level
     // ─────────────────────────────────────────
-    if (abs(a_TexCoord.x - 0.7) < 0.001 && abs(a_TexCoord.y - 0.7) < 0.001) {
-        worldPosition = worldPosition * u_ObjectTransform.w + u_ObjectTransform.xyz;
-    }
+    vec4 worldPosition = u_ModelMatrix * vec4(gridPosition.x, texelFetch(u_HeightMap, ivec2(gridPosition), 0).r, gridPosition.y, 1.0);
+    float morph = clamp((distance(worldPosition.xyz, a_LodCenter) - a_MorphRange.x) / (a_MorphRange.y - a_MorphRange.x), 0.0, 1.0);
+    patchCoord -= fract(patchCoord * 0.5) * 2.0 * morph;
+    gridPosition = a_Patch.xy + patchCoord * a_Patch.z;
 
     // ─────────────────────────────────────────
     // Final MVP transformation to clip space
     // ─────────────────────────────────────────
-    gl_Position = u_ProjMatrix * u_ViewMatrix * u_ModelMatrix * vec4(worldPosition, 1.0);
+    gl_Position = u_ProjMatrix * u_ViewMatrix * u_ModelMatrix * vec4(gridPosition.x, heightAt(gridPosition), gridPosition.y, 1.0);
 
-    // Pass through color, texcoord, and blade type
-    v_Color = a_Color;
-    v_TexCoord = a_TexCoord;
+    // The texture spans the tile
+    v_Color = vec3(0.0, 1.0, 0.0);
+    v_TexCoord = gridPosition / vec2(textureSize(u_HeightMap, 0) - 1);
     v_BladeType = 1;
 }
@@ -8,14 +8,59 @@ layout(set = 1, binding = 0) uniform ModelBuffer {
     mat4 u_ModelMatrix; // Transforms from object to world space
 };
 
+#ifdef GRASS_CULL_INDICES
+// ─────────────────────────────────────────────
+// Distance LOD. Culling only lists the visible blade ids here, with no copy of the blade
+// to widen, so the width scale of shaders/compute.comp is applied per vertex instead.
+// Must match the constants and lodWidthScale there.
+// ─────────────────────────────────────────────
+layout(set = 0, binding = 0) uniform CameraBuffer {
+    mat4 u_ViewMatrix;
+    mat4 u_ProjMatrix;
+};
+
+layout(constant_id = 7) const bool DIST_CULL              = true;
+layout(constant_id = 10) const float MAX_DIST             = 40.0;
+layout(constant_id = 11) const float LOD_NEAR_DIST        = 10.0;
+layout(constant_id = 13) const float LOD_FADE_BAND        = 0.1;
+layout(constant_id = 14) const float MAX_WIDTH_SCALE      = 3.0;
+
+float bladeRandom(uint id) {
+    id ^= id >> 16;
+    id *= 0x7feb352du;
+    id ^= id >> 15;
+    id *= 0x846ca68bu;
+    id ^= id >> 16;
+    return float(id >> 8) / 16777216.0;
+}
+
+float lodWidthScale(uint id, float viewDist) {
+    if (!DIST_CULL || viewDist <= LOD_NEAR_DIST) {
+        return 1.0;
+    }
+    float density = clamp((MAX_DIST - viewDist) / (MAX_DIST - LOD_NEAR_DIST), 0.0, 1.0);
+    float margin = density - bladeRandom(id);
+    if (margin <= 0.0) {
+        return 0.0;
+    }
+    return min(1.0 / density, MAX_WIDTH_SCALE) * min(margin / LOD_FADE_BAND, 1.0);
+}
+#endif
+
 // ─────────────────────────────────────────────
 // Vertex Attributes: positions of triangle vertices
 // ─────────────────────────────────────────────
 layout(location = 0) in vec4 a_Pos0;  // Vertex position 0 (includes metadata in .w)
 layout(location = 1) in vec4 a_Pos1;  // Vertex position 1
 layout(location = 2) in vec4 a_Pos2;  // Vertex position 2
+#ifdef GRASS_COMPACT_BLADES
+// Positions are half floats relative to the tile they belong to
+layout(location = 4) in uint a_Attribs;   // low 16 bits = stiffness, bits 16..17 = blade type
+layout(location = 5) in vec4 a_TileOrigin; // per draw (instance rate): origin of the tile
+#else
 layout(location = 3) in vec4 a_Up;        // up
 layout(location = 4) in int a_BladeType; 
+#endif
 
 // ─────────────────────────────────────────────
 // Vertex Outputs to the next stage
@@ -46,15 +91,32 @@ vec4 TransformToWorldSpace(mat4 modelMatrix, vec4 localPosition) {
 // ─────────────────────────────────────────────
 void main() {
     // Convert local space triangle vertices to world space
+#ifdef GRASS_COMPACT_BLADES
+    vec4 tileOffset = vec4(a_TileOrigin.xyz, 0.0);
+    v_WorldPos0 = TransformToWorldSpace(u_ModelMatrix, a_Pos0 + tileOffset);
+    v_WorldPos1 = TransformToWorldSpace(u_ModelMatrix, a_Pos1 + tileOffset);
+    v_WorldPos2 = TransformToWorldSpace(u_ModelMatrix, a_Pos2 + tileOffset);
+#else
     v_WorldPos0 = TransformToWorldSpace(u_ModelMatrix, a_Pos0);
     v_WorldPos1 = TransformToWorldSpace(u_ModelMatrix, a_Pos1);
     v_WorldPos2 = TransformToWorldSpace(u_ModelMatrix, a_Pos2);
+#endif
+
+#ifdef GRASS_CULL_INDICES
+    // The index is the blade's global id, as used by the simulation
+    vec3 camWorldPos = inverse(u_ViewMatrix)[3].xyz;
+    v_WorldPos2.w *= lodWidthScale(uint(gl_VertexIndex), length(v_WorldPos0.xz - camWorldPos.xz));
+#endif
 
     // Only v_WorldPos0 is used to write gl_Position.
     // This is just to satisfy Vulkan validation requirements—
     // the tessellation stage will use the world positions directly.
     gl_Position = v_WorldPos0;
 
+#ifdef GRASS_COMPACT_BLADES
+    v_BladeType = int((a_Attribs >> 16) & 0x3u);
+#else
     v_BladeType = a_BladeType;
+#endif
 
 }
@@ -0,0 +1,74 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "TerrainManager.h"
+#include "TileCache.h"
+
+// Bakes the terrain and grass of a square grid of tiles around the origin into a tile cache, which the
+// application loads with --tile-cache instead of generating the tiles at startup and while streaming.
+//
+// usage: bake_tiles OUTPUT [options]
+//   --radius N       bake tiles -N..N on both axes (default 3, a 7x7 grid)
+//   --tile-size S    tile size (default DEFAULT_TILE_SIZE)
+//   --resolution R   terrain grid cells per tile side (default DEFAULT_TILE_RESOLUTION)
+//   --seed N         blade generation seed (default DEFAULT_BLADE_SEED)
+//
+// The cache holds blades in the layout of this build (see GRASS_COMPACT_BLADES); the application ignores
+// a cache baked for another layout, seed, tile size or resolution.
+int main(int argc, char** argv) {
+    std::string output;
+    int radius = 3;
+    float tileSize = DEFAULT_TILE_SIZE;
+    int resolution = DEFAULT_TILE_RESOLUTION;
+    uint64_t seed = DEFAULT_BLADE_SEED;
+
+    for (int i = 1; i < argc; ++i) {
+        auto hasValue = [&]() { return i + 1 < argc; };
+        if (strcmp(argv[i], "--radius") == 0 && hasValue()) {
+            radius = std::stoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tile-size") == 0 && hasValue()) {
+            tileSize = std::stof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--resolution") == 0 && hasValue()) {
+            resolution = std::stoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue()) {
+            seed = std::stoull(argv[++i], nullptr, 0);
+        }
+        else if (argv[i][0] != '-' && output.empty()) {
+            output = argv[i];
+        }
+        else {
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    if (output.empty() || radius < 0 || tileSize <= 0.0f || resolution <= 0) {
+        std::cerr << "usage: bake_tiles OUTPUT [--radius N] [--tile-size S] [--resolution R] [--seed N]" << std::endl;
+        return 1;
+    }
+
+    uint32_t side = 2 * radius + 1;
+    std::cout << "Baking " << side << "x" << side << " tiles (" << BLADE_LAYOUT_NAME << " blades) to " << output << std::endl;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    try {
+        TileCache::Bake(output, seed, tileSize, resolution, glm::ivec2(-radius), glm::ivec2(radius),
+            [](uint32_t baked, uint32_t total) {
+                std::cout << "\r" << baked << "/" << total << std::flush;
+            });
+    }
+    catch (const std::exception& e) {
+        std::cerr << std::endl << e.what() << std::endl;
+        return 1;
+    }
+    float seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+
+    TileCache cache(output);
+    std::cout << std::endl << "Wrote " << cache.GetHeader().fileSize / (1024 * 1024) << " MB in " << seconds << " s" << std::endl;
+    return 0;
+}